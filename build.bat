@@ -1,5 +0,0 @@
-@echo off
-
-SET COMPILER_FLAGS=/Zi /nologo
-
-call cl %COMPILER_FLAGS% src/*.c
\ No newline at end of file
@@ -1,183 +1,847 @@
 #include "ai.h"
-#include "io.h"
 #include "logger.h"
+#include "bitbase.h"
 #include <float.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
 
-static float ai_evaluate_position(const Chess_Context* chess_ctx, Chess_Color color) {
-    float evaluation = 0.0f;
+#define AI_TABLEBASE_WIN_SCORE 500.0f
+// Kept below the gain of promoting, so known wins still push the pawn.
+#define AI_BITBASE_WIN_BONUS 5.0f
 
-    for (int y = 0; y < CHESS_BOARD_HEIGHT; ++y) {
-        for (int x = 0; x < CHESS_BOARD_WIDTH; ++x) {
-            const Chess_Piece* piece = &chess_ctx->board[y][x];
-            if (piece->type != CHESS_PIECE_EMPTY && piece->color == color) {
-                switch (piece->type) {
-                    case CHESS_PIECE_KING: evaluation += 1000.0f; break;
-                    case CHESS_PIECE_QUEEN: evaluation += 9.0f; break;
-                    case CHESS_PIECE_ROOK: evaluation += 5.0f; break;
-                    case CHESS_PIECE_BISHOP: evaluation += 3.0f; break;
-                    case CHESS_PIECE_KNIGHT: evaluation += 3.0f; break;
-                    case CHESS_PIECE_PAWN: evaluation += 1.0f; break;
-                }
-            } else if (piece->type != CHESS_PIECE_EMPTY && piece->color != color) {
-                switch (piece->type) {
-                    case CHESS_PIECE_KING: evaluation -= 1000.0f; break;
-                    case CHESS_PIECE_QUEEN: evaluation -= 9.0f; break;
-                    case CHESS_PIECE_ROOK: evaluation -= 5.0f; break;
-                    case CHESS_PIECE_BISHOP: evaluation -= 3.0f; break;
-                    case CHESS_PIECE_KNIGHT: evaluation -= 3.0f; break;
-                    case CHESS_PIECE_PAWN: evaluation -= 1.0f; break;
-                }
-            }
+#define AI_ORDERING_TT_MOVE 30000
+#define AI_ORDERING_CAPTURE 20000
+#define AI_ORDERING_PROMOTION 19000
+#define AI_HISTORY_MAX 16000
+// Nodes between two looks at the clock and at the stop request.
+#define AI_CONTROL_CHECK_NODES 1024
+// Later MultiPV lines are searched with beta just above the previous line's score, and again with a full window in
+// the rare case they fail high.
+#define AI_MULTI_PV_MARGIN 0.01f
 
-            if (piece->type == CHESS_PIECE_PAWN) {
-                float pawn_value;
-                if (piece->color == CHESS_COLOR_WHITE) {
-                    pawn_value = (y - 1) * 0.1f;
-                } else {
-                    pawn_value = (6 - y) * 0.1f;
-                }
+static AI_Eval_Params eval_params = { {
+    [AI_PARAM_QUEEN] = 9.0f,
+    [AI_PARAM_ROOK] = 5.0f,
+    [AI_PARAM_BISHOP] = 3.0f,
+    [AI_PARAM_KNIGHT] = 3.0f,
+    [AI_PARAM_PAWN] = 1.0f,
+    [AI_PARAM_PAWN_ADVANCE] = 0.1f,
+    [AI_PARAM_ROOK_OPEN_FILE] = 1.0f,
+    [AI_PARAM_ROOK_SEMI_OPEN_FILE] = 0.8f,
+    // Fitted with goldenpawn tune on self-play positions, the weights above held fixed.
+    [AI_PARAM_MOBILITY] = 0.006f,
+    [AI_PARAM_KING_ZONE_ATTACKS] = 0.094f,
+    [AI_PARAM_THREATS] = 0.863f,
+} };
 
-                float rank_value = (x < 3.5f) ? (1.0f / 3.5f) * x : ((-1.0f / 3.5f) * x + 2);
+const char* const ai_param_names[AI_PARAMS_NUM] = {
+    "queen", "rook", "bishop", "knight", "pawn", "pawn_advance", "rook_open_file", "rook_semi_open_file",
+    "mobility", "king_zone_attacks", "threats"
+};
 
-                pawn_value *= rank_value;
+// Indexed by packed piece and square: material plus the pawn advance bonus, from white's point of view.
+static float piece_square_values[CHESS_PIECE_PACK(CHESS_PIECE_PAWN, CHESS_COLOR_BLACK) + 1][CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH];
+static pthread_once_t eval_tables_once = PTHREAD_ONCE_INIT;
+// Whether any attack term has a weight, since the attack map is only worth computing for the evaluation then.
+static int eval_attacks_used;
 
-                if (piece->color == color) {
-                    evaluation += pawn_value;
-                } else {
-                    evaluation -= pawn_value;
+// Pawns gain pawn_advance per rank advanced, weighted towards the centre files. Returns the weight of a pawn of
+// the color on the square.
+static float pawn_advance_weight(int y, int x, Chess_Color color) {
+    float file_value = (x < 3.5f) ? (1.0f / 3.5f) * x : ((-1.0f / 3.5f) * x + 2);
+    return (color == CHESS_COLOR_WHITE ? y - 1 : 6 - y) * file_value;
+}
+
+static void eval_tables_init() {
+    const float* values = eval_params.values;
+    const float material[] = { 0.0f, 1000.0f, values[AI_PARAM_QUEEN], values[AI_PARAM_KNIGHT], values[AI_PARAM_BISHOP],
+        values[AI_PARAM_ROOK], values[AI_PARAM_PAWN] };
+
+    for (int type = CHESS_PIECE_KING; type <= CHESS_PIECE_PAWN; ++type) {
+        for (int y = 0; y < CHESS_BOARD_HEIGHT; ++y) {
+            for (int x = 0; x < CHESS_BOARD_WIDTH; ++x) {
+                float white_value = material[type];
+                float black_value = material[type];
+                if (type == CHESS_PIECE_PAWN) {
+                    white_value += pawn_advance_weight(y, x, CHESS_COLOR_WHITE) * values[AI_PARAM_PAWN_ADVANCE];
+                    black_value += pawn_advance_weight(y, x, CHESS_COLOR_BLACK) * values[AI_PARAM_PAWN_ADVANCE];
                 }
+                piece_square_values[CHESS_PIECE_PACK(type, CHESS_COLOR_WHITE)][CHESS_SQUARE(y, x)] = white_value;
+                piece_square_values[CHESS_PIECE_PACK(type, CHESS_COLOR_BLACK)][CHESS_SQUARE(y, x)] = -black_value;
             }
+        }
+    }
+    eval_attacks_used = values[AI_PARAM_MOBILITY] != 0.0f || values[AI_PARAM_KING_ZONE_ATTACKS] != 0.0f ||
+        values[AI_PARAM_THREATS] != 0.0f;
+}
 
-            if (piece->type == CHESS_PIECE_ROOK) {
-                int open_file = 1;
-                int semi_open_file = 1;
-
-                for (int i = 0; i < CHESS_BOARD_HEIGHT; ++i) {
-                    Chess_Piece* file_piece = &chess_ctx->board[i][x];
-                    if (file_piece->type == CHESS_PIECE_PAWN) {
-                        if (file_piece->color != piece->color) {
-                            open_file = 0;
-                        } else {
-                            open_file = 0;
-                            semi_open_file = 0;
-                            break;
-                        }
-                    }
-                }
+void ai_eval_params_get(AI_Eval_Params* params) {
+    *params = eval_params;
+}
 
-                if (open_file) {
-                    if (piece->color == color) {
-                        evaluation += 1.0f;
-                    } else {
-                        evaluation -= 1.0f;
-                    }
-                } else if (semi_open_file) {
-                    if (piece->color == color) {
-                        evaluation += 0.8f;
-                    } else {
-                        evaluation -= 0.8f;
-                    }
-                }
+// The tables are shared by every search, so this must not run while anything is being evaluated.
+void ai_eval_params_set(const AI_Eval_Params* params) {
+    pthread_once(&eval_tables_once, eval_tables_init);
+    eval_params = *params;
+    eval_tables_init();
+}
+
+// Counts rooks on open (no pawns) and semi-open (no own pawns) files, white's minus black's.
+static void rook_files_count(const uint8_t pawn_files[2], const uint8_t rooks[2][CHESS_BOARD_WIDTH], int* open, int* semi_open) {
+    *open = *semi_open = 0;
+    for (int c = 0; c < 2; ++c) {
+        int sign = c == CHESS_COLOR_INDEX(CHESS_COLOR_WHITE) ? 1 : -1;
+        for (int x = 0; x < CHESS_BOARD_WIDTH; ++x) {
+            if (!rooks[c][x]) {
+                continue;
+            }
+            if (!((pawn_files[0] | pawn_files[1]) & (1 << x))) {
+                *open += sign * rooks[c][x];
+            } else if (!(pawn_files[c] & (1 << x))) {
+                *semi_open += sign * rooks[c][x];
             }
         }
     }
+}
+
+// White's minus black's: squares attacked that are not taken by own pieces, attacks on the enemy king zone, and
+// enemy pieces other than the king attacked and not defended.
+static void attack_terms_count(const Chess_Context* chess_ctx, const Chess_Attack_Map* attack_map, float terms[3]) {
+    memset(terms, 0, 3 * sizeof(float));
+    for (int c = 0; c < 2; ++c) {
+        float sign = c == CHESS_COLOR_INDEX(CHESS_COLOR_WHITE) ? 1.0f : -1.0f;
+        Chess_Bitboard attacks = attack_map->by_type[c][CHESS_PIECE_EMPTY];
+        Chess_Bitboard targets = attack_map->pieces[1 - c] & ~(1ULL << chess_ctx->king_square[1 - c]);
+        terms[0] += sign * __builtin_popcountll(attacks & ~attack_map->pieces[c]);
+        terms[1] += sign * attack_map->king_zone_attacks[c];
+        terms[2] += sign * __builtin_popcountll(attacks & targets & ~attack_map->by_type[1 - c][CHESS_PIECE_EMPTY]);
+    }
+}
+
+// A single pass over the board adds the table values and records pawn and rook files for the rook file terms. The
+// attack map is computed here when the caller has none and an attack term is used.
+static float ai_evaluate_position(const Chess_Context* chess_ctx, Chess_Color color, const Chess_Attack_Map* attack_map) {
+    float evaluation = 0.0f;
+    uint8_t pawn_files[2] = { 0 };
+    uint8_t rooks[2][CHESS_BOARD_WIDTH] = { { 0 } };
+    int pieces_num = 0;
+
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        Chess_Packed_Piece piece = chess_ctx->board[square];
+        if (piece == CHESS_PIECE_EMPTY) {
+            continue;
+        }
+        ++pieces_num;
+        evaluation += piece_square_values[piece][square];
+
+        int color_index = CHESS_COLOR_INDEX(CHESS_PIECE_COLOR(piece));
+        int x = square % CHESS_BOARD_WIDTH;
+        if (CHESS_PIECE_TYPE(piece) == CHESS_PIECE_PAWN) {
+            pawn_files[color_index] |= 1 << x;
+        } else if (CHESS_PIECE_TYPE(piece) == CHESS_PIECE_ROOK) {
+            ++rooks[color_index][x];
+        }
+    }
+
+    int open, semi_open;
+    rook_files_count(pawn_files, rooks, &open, &semi_open);
+    evaluation += open * eval_params.values[AI_PARAM_ROOK_OPEN_FILE] +
+        semi_open * eval_params.values[AI_PARAM_ROOK_SEMI_OPEN_FILE];
+
+    if (eval_attacks_used) {
+        Chess_Attack_Map computed_map;
+        float terms[3];
+        if (!attack_map) {
+            chess_attack_map_compute(chess_ctx, &computed_map);
+            attack_map = &computed_map;
+        }
+        attack_terms_count(chess_ctx, attack_map, terms);
+        evaluation += terms[0] * eval_params.values[AI_PARAM_MOBILITY] +
+            terms[1] * eval_params.values[AI_PARAM_KING_ZONE_ATTACKS] + terms[2] * eval_params.values[AI_PARAM_THREATS];
+    }
+
+    if (color == CHESS_COLOR_BLACK) {
+        evaluation = -evaluation;
+    }
+
+    Chess_Color kpk_winner;
+    if (pieces_num == 3 && bitbase_kpk_probe(chess_ctx, &kpk_winner)) {
+        if (kpk_winner == CHESS_COLOR_COLORLESS) {
+            return 0.0f;
+        }
+        evaluation += kpk_winner == color ? AI_BITBASE_WIN_BONUS : -AI_BITBASE_WIN_BONUS;
+    }
 
     return evaluation;
 }
 
-static float alphabeta(const Chess_Context* chess_ctx, Chess_Color color, int depth,
-    float alpha, float beta, int maximizing_player, Chess_Move* chosen_move) {
+static void eval_cache_release(AI_Context* ai_ctx) {
+    memory_block_free(&ai_ctx->eval_cache);
+    if (ai_ctx->eval_cache_budget) {
+        tt_budget_return(ai_ctx->eval_cache_budget, ai_ctx->eval_cache_size_mb);
+    }
+    ai_ctx->eval_cache_size_mb = 0;
+    ai_ctx->eval_slots = NULL;
+    ai_ctx->eval_mask = 0;
+}
+
+static int eval_cache_init(AI_Context* ai_ctx, size_t size_mb) {
+    size_t slots_num = 1;
+    eval_cache_release(ai_ctx);
+    if (!size_mb) {
+        return 0;
+    }
+    if (ai_ctx->eval_cache_budget) {
+        size_t granted_mb = tt_budget_reserve(ai_ctx->eval_cache_budget, size_mb);
+        if (!granted_mb) {
+            log_debug("Error: the hash budget has no room left for the eval cache");
+            return -1;
+        }
+        size_mb = granted_mb;
+    }
+    while (slots_num * 2 * sizeof(uint64_t) <= size_mb * 1024 * 1024) {
+        slots_num *= 2;
+    }
+    if (memory_block_alloc(&ai_ctx->eval_cache, slots_num * sizeof(uint64_t), 0)) {
+        if (ai_ctx->eval_cache_budget) {
+            tt_budget_return(ai_ctx->eval_cache_budget, size_mb);
+        }
+        return -1;
+    }
+    ai_ctx->eval_cache_size_mb = size_mb;
+    ai_ctx->eval_slots = ai_ctx->eval_cache.data;
+    ai_ctx->eval_mask = slots_num - 1;
+    return 0;
+}
+
+// Rounded and clamped, since king captures inside the search produce scores around a thousand pawns.
+int ai_score_to_centipawns(float score) {
+    float centipawns = score * 100.0f;
+    if (centipawns > AI_MAX_CENTIPAWNS) return AI_MAX_CENTIPAWNS;
+    if (centipawns < -AI_MAX_CENTIPAWNS) return -AI_MAX_CENTIPAWNS;
+    return (int)(centipawns + (centipawns >= 0.0f ? 0.5f : -0.5f));
+}
+
+int ai_score_to_mate(float score) {
+    if (score > -AI_MATE_BOUND && score < AI_MATE_BOUND) {
+        return 0;
+    }
+    int plies = (int)(AI_MATE_SCORE - (score > 0.0f ? score : -score) + 0.5f);
+    return score > 0.0f ? (plies + 1) / 2 : -(plies / 2);
+}
+
+// Static evaluation in pawns from the point of view of the side to move.
+float ai_evaluate(const Chess_Context* chess_ctx) {
+    pthread_once(&eval_tables_once, eval_tables_init);
+    return ai_evaluate_position(chess_ctx, chess_ctx->current_turn, NULL);
+}
+
+// The evaluation is linear in the parameters: from white's point of view it is the sum of each parameter times its
+// coefficient here. Returns -1 for positions where the bitbase overrides the evaluation.
+int ai_eval_features(const Chess_Context* chess_ctx, float coefficients[AI_PARAMS_NUM]) {
+    static const int8_t type_params[] = { -1, -1, AI_PARAM_QUEEN, AI_PARAM_KNIGHT, AI_PARAM_BISHOP, AI_PARAM_ROOK, AI_PARAM_PAWN };
+    uint8_t pawn_files[2] = { 0 };
+    uint8_t rooks[2][CHESS_BOARD_WIDTH] = { { 0 } };
+    int pieces_num = 0;
+
+    memset(coefficients, 0, AI_PARAMS_NUM * sizeof(float));
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        Chess_Packed_Piece piece = chess_ctx->board[square];
+        if (piece == CHESS_PIECE_EMPTY) {
+            continue;
+        }
+        ++pieces_num;
+
+        Chess_Color color = CHESS_PIECE_COLOR(piece);
+        Chess_Piece_Type type = CHESS_PIECE_TYPE(piece);
+        float sign = color == CHESS_COLOR_WHITE ? 1.0f : -1.0f;
+        int x = square % CHESS_BOARD_WIDTH;
+        if (type_params[type] >= 0) {
+            coefficients[type_params[type]] += sign;
+        }
+        if (type == CHESS_PIECE_PAWN) {
+            coefficients[AI_PARAM_PAWN_ADVANCE] += sign * pawn_advance_weight(square / CHESS_BOARD_WIDTH, x, color);
+            pawn_files[CHESS_COLOR_INDEX(color)] |= 1 << x;
+        } else if (type == CHESS_PIECE_ROOK) {
+            ++rooks[CHESS_COLOR_INDEX(color)][x];
+        }
+    }
+
+    int open, semi_open;
+    rook_files_count(pawn_files, rooks, &open, &semi_open);
+    coefficients[AI_PARAM_ROOK_OPEN_FILE] = open;
+    coefficients[AI_PARAM_ROOK_SEMI_OPEN_FILE] = semi_open;
+
+    Chess_Attack_Map attack_map;
+    float terms[3];
+    chess_attack_map_compute(chess_ctx, &attack_map);
+    attack_terms_count(chess_ctx, &attack_map, terms);
+    coefficients[AI_PARAM_MOBILITY] = terms[0];
+    coefficients[AI_PARAM_KING_ZONE_ATTACKS] = terms[1];
+    coefficients[AI_PARAM_THREATS] = terms[2];
+
+    Chess_Color kpk_winner;
+    return pieces_num == 3 && bitbase_kpk_probe(chess_ctx, &kpk_winner) ? -1 : 0;
+}
+
+static float tablebase_score(Syzygy_WDL wdl, const Chess_Context* chess_ctx, Chess_Color color) {
+    // Cursed wins and blessed losses are draws under the fifty-move rule.
+    float score = wdl == SYZYGY_WDL_WIN ? AI_TABLEBASE_WIN_SCORE : wdl == SYZYGY_WDL_LOSS ? -AI_TABLEBASE_WIN_SCORE : 0.0f;
+    return chess_ctx->current_turn == color ? score : -score;
+}
+
+static const int16_t ordering_values[] = { 0, 20, 9, 3, 3, 5, 1 };
+
+// Most valuable victim first, then least valuable attacker.
+static int16_t capture_score(const Chess_Context* chess_ctx, Chess_Packed_Move move) {
+    Chess_Piece_Type victim = CHESS_MOVE_FLAGS(move) == CHESS_MOVE_FLAG_EN_PASSANT ? CHESS_PIECE_PAWN :
+        CHESS_PIECE_TYPE(chess_ctx->board[CHESS_MOVE_TO(move)]);
+    Chess_Piece_Type attacker = CHESS_PIECE_TYPE(chess_ctx->board[CHESS_MOVE_FROM(move)]);
+    return AI_ORDERING_CAPTURE + ordering_values[victim] * 10 - ordering_values[attacker];
+}
+
+// The transposition table move comes first, then captures, promotions, and quiet moves by their history score.
+static void moves_score(const AI_Context* ai_ctx, const Chess_Context* chess_ctx, Chess_Move_List* move_list, Chess_Packed_Move tt_move) {
+    const int (*history)[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH] = ai_ctx->history[CHESS_COLOR_INDEX(chess_ctx->current_turn)];
+
+    for (int i = 0; i < move_list->count; ++i) {
+        Chess_Packed_Move move = move_list->moves[i];
+        int from = CHESS_MOVE_FROM(move);
+        int to = CHESS_MOVE_TO(move);
+        int16_t score = 0;
+
+        if (move == tt_move) {
+            score = AI_ORDERING_TT_MOVE;
+        } else if (CHESS_MOVE_IS_CAPTURE(move)) {
+            score = capture_score(chess_ctx, move);
+        } else if (CHESS_MOVE_IS_PROMOTION(move)) {
+            score = AI_ORDERING_PROMOTION + ordering_values[chess_move_promotion_type(move)];
+        } else {
+            score = (int16_t)(history[from][to] < AI_HISTORY_MAX ? history[from][to] : AI_HISTORY_MAX);
+        }
+
+        move_list->scores[i] = score;
+    }
+}
+
+// Quiet moves that cause a cutoff are rewarded by depth squared. Everything is halved once a value gets too large,
+// so the table keeps favouring recent results.
+static void history_update(AI_Context* ai_ctx, Chess_Color color, Chess_Packed_Move move, int depth) {
+    int (*history)[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH] = ai_ctx->history[CHESS_COLOR_INDEX(color)];
+    int* value = &history[CHESS_MOVE_FROM(move)][CHESS_MOVE_TO(move)];
+    *value += depth * depth;
+    if (*value > AI_HISTORY_MAX) {
+        for (int c = 0; c < 2; ++c) {
+            for (int from = 0; from < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++from) {
+                for (int to = 0; to < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++to) {
+                    ai_ctx->history[c][from][to] /= 2;
+                }
+            }
+        }
+    }
+}
+
+// Selection step: brings the best scored move among the remaining ones to the given index.
+static Chess_Packed_Move move_pick(Chess_Move_List* move_list, int index) {
+    int best = index;
+    for (int i = index + 1; i < move_list->count; ++i) {
+        if (move_list->scores[i] > move_list->scores[best]) {
+            best = i;
+        }
+    }
+
+    Chess_Packed_Move move = move_list->moves[best];
+    int16_t score = move_list->scores[best];
+    move_list->moves[best] = move_list->moves[index];
+    move_list->scores[best] = move_list->scores[index];
+    move_list->moves[index] = move;
+    move_list->scores[index] = score;
+    return move;
+}
+
+// Captures and promotions only, standing pat on the static evaluation. Scores are for the side to move.
+static float quiescence(const Chess_Context* chess_ctx, float alpha, float beta) {
+    Chess_Attack_Map attack_map;
+    chess_attack_map_compute(chess_ctx, &attack_map);
+    float stand_pat = ai_evaluate_position(chess_ctx, chess_ctx->current_turn, &attack_map);
+    if (stand_pat >= beta) {
+        return stand_pat;
+    }
+    if (stand_pat > alpha) {
+        alpha = stand_pat;
+    }
+
+    Chess_Move_List move_list;
+    Chess_Context child_ctx;
+    chess_generate_moves_with_attacks(chess_ctx, &attack_map, &move_list);
+
+    int tactical_num = 0;
+    for (int i = 0; i < move_list.count; ++i) {
+        Chess_Packed_Move move = move_list.moves[i];
+        if (CHESS_MOVE_IS_CAPTURE(move)) {
+            move_list.scores[tactical_num] = capture_score(chess_ctx, move);
+        } else if (CHESS_MOVE_IS_PROMOTION(move)) {
+            move_list.scores[tactical_num] = AI_ORDERING_PROMOTION + ordering_values[chess_move_promotion_type(move)];
+        } else {
+            continue;
+        }
+        move_list.moves[tactical_num++] = move;
+    }
+    move_list.count = tactical_num;
+
+    for (int i = 0; i < move_list.count; ++i) {
+        chess_make_move(chess_ctx, &child_ctx, move_pick(&move_list, i));
+        float score = -quiescence(&child_ctx, -beta, -alpha);
+        if (score >= beta) {
+            return score;
+        }
+        if (score > alpha) {
+            alpha = score;
+        }
+    }
+    return alpha;
+}
+
+float ai_quiescence(const Chess_Context* chess_ctx) {
+    pthread_once(&eval_tables_once, eval_tables_init);
+    return quiescence(chess_ctx, -FLT_MAX, FLT_MAX);
+}
+
+// Mate scores count plies from the root, while the table keeps them counted from the node they were found at.
+static float mate_score_from_table(float score, int ply) {
+    return score >= AI_MATE_BOUND ? score - ply : score <= -AI_MATE_BOUND ? score + ply : score;
+}
+
+static float mate_score_to_table(float score, int ply) {
+    return score >= AI_MATE_BOUND ? score + ply : score <= -AI_MATE_BOUND ? score - ply : score;
+}
+
+// A position without legal moves, from the point of view of color.
+static float terminal_score(const Chess_Context* chess_ctx, Chess_Color color, int ply) {
+    if (!chess_in_check(chess_ctx)) {
+        return 0.0f;
+    }
+    return chess_ctx->current_turn == color ? -(AI_MATE_SCORE - ply) : AI_MATE_SCORE - ply;
+}
+
+// A parent never sees its children's replies, so mates and stalemates at the horizon are caught here. Only positions
+// with a legal move are stored in the eval cache, so a hit skips the legality test as well; a miss computes one
+// attack map for both. The evaluation of one side is the negation of the other's, so a single score per position
+// serves both. An empty slot reads as zero, which no stored slot is taken to be.
+static float leaf_evaluate(AI_Context* ai_ctx, const Chess_Context* chess_ctx, Chess_Color color, int ply) {
+    Chess_Attack_Map attack_map;
+    uint64_t* slot = NULL;
+    float score;
+    uint32_t score_bits;
+
+    if (ai_ctx->eval_slots) {
+        slot = &ai_ctx->eval_slots[chess_ctx->hash & ai_ctx->eval_mask];
+        uint64_t value = __atomic_load_n(slot, __ATOMIC_RELAXED);
+        ++ai_ctx->eval_probes;
+        if (value && (uint32_t)(value >> 32) == (uint32_t)(chess_ctx->hash >> 32)) {
+            ++ai_ctx->eval_hits;
+            score_bits = (uint32_t)value;
+            memcpy(&score, &score_bits, sizeof(score));
+            return color == chess_ctx->current_turn ? score : -score;
+        }
+    }
+
+    chess_attack_map_compute(chess_ctx, &attack_map);
+    if (!chess_has_legal_move_with_attacks(chess_ctx, &attack_map)) {
+        return terminal_score(chess_ctx, color, ply);
+    }
+    score = ai_evaluate_position(chess_ctx, chess_ctx->current_turn, &attack_map);
+    if (slot) {
+        memcpy(&score_bits, &score, sizeof(score));
+        __atomic_store_n(slot, (chess_ctx->hash & 0xFFFFFFFF00000000ULL) | score_bits, __ATOMIC_RELAXED);
+    }
+    return color == chess_ctx->current_turn ? score : -score;
+}
+
+// The search scores from the point of view of color while the table stores them for the side to move,
+// so scores and bounds are flipped when the two differ.
+static TT_Bound tt_bound_flip(TT_Bound bound) {
+    return bound == TT_BOUND_LOWER ? TT_BOUND_UPPER : bound == TT_BOUND_UPPER ? TT_BOUND_LOWER : bound;
+}
+
+uint64_t ai_time_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Both may be called from another thread while the search runs.
+void ai_deadline_set(AI_Context* ai_ctx, uint64_t time_ms) {
+    atomic_store_explicit(&ai_ctx->deadline_ns, time_ms ? ai_time_now_ns() + time_ms * 1000000 : 0, memory_order_relaxed);
+}
+
+void ai_stop(AI_Context* ai_ctx) {
+    atomic_store_explicit(&ai_ctx->stop_requested, 1, memory_order_relaxed);
+}
+
+static int search_control_stops(const AI_Context* ai_ctx) {
+    if (atomic_load_explicit(&ai_ctx->stop_requested, memory_order_relaxed)) {
+        return 1;
+    }
+    uint64_t deadline_ns = atomic_load_explicit(&ai_ctx->deadline_ns, memory_order_relaxed);
+    return deadline_ns && ai_time_now_ns() >= deadline_ns;
+}
+
+static float alphabeta(AI_Context* ai_ctx, const Chess_Context* chess_ctx, Chess_Color color, int depth,
+    float alpha, float beta, int maximizing_player, Chess_Packed_Move* chosen_move) {
+    Syzygy_Context* syzygy_ctx = ai_ctx->syzygy_ctx;
     Chess_Context auxiliar_ctx;
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH];
-    int available_moves_num;
+    Chess_Move_List move_list;
     float child_result;
 
-    int chosen_move_set = 0;
+    // Once stopped, every node unwinds without touching the tables; the caller discards the result.
+    if (ai_ctx->stop) {
+        return 0.0f;
+    }
+    if (ai_ctx->nodes_limit && ai_ctx->nodes >= ai_ctx->nodes_limit) {
+        ai_ctx->stop = 1;
+        return 0.0f;
+    }
+    if (ai_ctx->nodes % AI_CONTROL_CHECK_NODES == 0 && search_control_stops(ai_ctx)) {
+        ai_ctx->stop = 1;
+        return 0.0f;
+    }
+    ++ai_ctx->nodes;
 
+    int ply = ai_ctx->root_depth - depth;
     if (depth == 0) {
-        return ai_evaluate_position(chess_ctx, color);
+        return leaf_evaluate(ai_ctx, chess_ctx, color, ply);
     }
-    
+
+    int flip = chess_ctx->current_turn != color;
+    float alpha_orig = alpha, beta_orig = beta;
+    Chess_Packed_Move tt_move = CHESS_MOVE_NONE;
+    TT_Entry entry;
+    if (tt_probe(&ai_ctx->tt_ctx, chess_ctx->hash, &entry)) {
+        tt_move = entry.move;
+        if (!chosen_move && entry.depth >= depth) {
+            float score = mate_score_from_table(flip ? -entry.score : entry.score, ply);
+            TT_Bound bound = flip ? tt_bound_flip(entry.bound) : entry.bound;
+            if (bound == TT_BOUND_EXACT || (bound == TT_BOUND_LOWER && score >= beta) || (bound == TT_BOUND_UPPER && score <= alpha)) {
+                return score;
+            }
+        }
+    }
+
+    // Only probe right after a capture or pawn move, where the WDL value is exact with respect to the fifty-move rule.
+    if (!chosen_move && depth >= syzygy_ctx->probe_depth && chess_ctx->halfmove_clock == 0 && syzygy_can_probe(syzygy_ctx, chess_ctx)) {
+        Syzygy_WDL wdl;
+        if (syzygy_probe_wdl(syzygy_ctx, chess_ctx, &wdl)) {
+            return tablebase_score(wdl, chess_ctx, color);
+        }
+    }
+
+    Chess_Attack_Map attack_map;
+    chess_attack_map_compute(chess_ctx, &attack_map);
+    chess_generate_moves_with_attacks(chess_ctx, &attack_map, &move_list);
+    if (chosen_move && ai_ctx->root_excluded_num) {
+        int kept = 0;
+        for (int i = 0; i < move_list.count; ++i) {
+            int excluded = 0;
+            for (int j = 0; j < ai_ctx->root_excluded_num && !excluded; ++j) {
+                excluded = move_list.moves[i] == ai_ctx->root_excluded[j];
+            }
+            if (!excluded) {
+                move_list.moves[kept++] = move_list.moves[i];
+            }
+        }
+        move_list.count = kept;
+    }
+    if (!move_list.count) {
+        // A root whose moves were all taken by earlier lines ends up here too, with no move and an unused score.
+        return terminal_score(chess_ctx, color, ply);
+    }
+    moves_score(ai_ctx, chess_ctx, &move_list, tt_move);
+
+    // we do this to be sure that chosen_move will always be set if there is at least 1 available move.
+    // without this, the chosen move will not be set when there is a forced mate in N, where N < depth
+    if (chosen_move && move_list.count > 0) {
+        *chosen_move = move_pick(&move_list, 0);
+    }
+
+    float value;
+    Chess_Packed_Move best_move = CHESS_MOVE_NONE;
+
     if (maximizing_player) {
-        float value = -FLT_MAX;
-        int beta_cut_off = 0;
-
-        for (int y = 0; y < CHESS_BOARD_HEIGHT && !beta_cut_off; ++y) {
-            for (int x = 0; x < CHESS_BOARD_WIDTH && !beta_cut_off; ++x) {
-                const Chess_Piece* piece = &chess_ctx->board[y][x];
-                if (piece->type != CHESS_PIECE_EMPTY && piece->color == chess_ctx->current_turn) {
-                    available_moves_num = chess_available_moves_get(chess_ctx, CHESS_POS(y, x), available_moves);
-                    for (int k = 0; k < available_moves_num && !beta_cut_off; ++k) {
-                        chess_move_piece(chess_ctx, &auxiliar_ctx, &available_moves[k]);
-                        child_result = alphabeta(&auxiliar_ctx, color, depth - 1, alpha, beta, 0, 0);
-
-                        // we do this to be sure that chosen_move will always be set if there is at least 1 available move.
-                        // without this, the chosen move will not be set when there is a forced mate in N, where N < depth
-                        if (!chosen_move_set && chosen_move) {
-                            chosen_move_set = 1;
-                            *chosen_move = available_moves[k];
-                        }
-
-                        if (child_result > value) {
-                            value = child_result;
-                            if (chosen_move) *chosen_move = available_moves[k];
-                        }
-                        if (value > alpha) {
-                            alpha = value;
-                        }
-                        if (alpha >= beta) {
-                            beta_cut_off = 1;
-                        }
-                    }
+        value = -FLT_MAX;
+
+        for (int k = 0; k < move_list.count; ++k) {
+            Chess_Packed_Move move = move_pick(&move_list, k);
+            chess_make_move(chess_ctx, &auxiliar_ctx, move);
+            child_result = alphabeta(ai_ctx, &auxiliar_ctx, color, depth - 1, alpha, beta, 0, 0);
+            if (ai_ctx->stop) {
+                return 0.0f;
+            }
+
+            if (child_result > value) {
+                value = child_result;
+                best_move = move;
+                if (chosen_move) *chosen_move = move;
+            }
+            if (value > alpha) {
+                alpha = value;
+            }
+            if (alpha >= beta) {
+                if (!CHESS_MOVE_IS_CAPTURE(move) && !CHESS_MOVE_IS_PROMOTION(move)) {
+                    history_update(ai_ctx, chess_ctx->current_turn, move, depth);
                 }
+                break;
             }
         }
-
-        return value;
     } else {
-        float value = FLT_MAX;
-        int alpha_cut_off = 0;
-
-        for (int y = 0; y < CHESS_BOARD_HEIGHT && !alpha_cut_off; ++y) {
-            for (int x = 0; x < CHESS_BOARD_WIDTH && !alpha_cut_off; ++x) {
-                const Chess_Piece* piece = &chess_ctx->board[y][x];
-                if (piece->type != CHESS_PIECE_EMPTY && piece->color == chess_ctx->current_turn) {
-                    available_moves_num = chess_available_moves_get(chess_ctx, CHESS_POS(y, x), available_moves);
-                    for (int k = 0; k < available_moves_num && !alpha_cut_off; ++k) {
-                        chess_move_piece(chess_ctx, &auxiliar_ctx, &available_moves[k]);
-                        child_result = alphabeta(&auxiliar_ctx, color, depth - 1, alpha, beta, 1, 0);
-
-                        // we do this to be sure that chosen_move will always be set if there is at least 1 available move.
-                        // without this, the chosen move will not be set when there is a forced mate in N, where N < depth
-                        if (!chosen_move_set && chosen_move) {
-                            chosen_move_set = 1;
-                            *chosen_move = available_moves[k];
-                        }
-
-                        if (child_result < value) {
-                            value = child_result;
-                            if (chosen_move) *chosen_move = available_moves[k];
-                        }
-                        if (value < beta) {
-                            beta = value;
-                        }
-                        if (alpha >= beta) {
-                            alpha_cut_off = 1;
-                        }
-                    }
+        value = FLT_MAX;
+
+        for (int k = 0; k < move_list.count; ++k) {
+            Chess_Packed_Move move = move_pick(&move_list, k);
+            chess_make_move(chess_ctx, &auxiliar_ctx, move);
+            child_result = alphabeta(ai_ctx, &auxiliar_ctx, color, depth - 1, alpha, beta, 1, 0);
+            if (ai_ctx->stop) {
+                return 0.0f;
+            }
+
+            if (child_result < value) {
+                value = child_result;
+                best_move = move;
+                if (chosen_move) *chosen_move = move;
+            }
+            if (value < beta) {
+                beta = value;
+            }
+            if (alpha >= beta) {
+                if (!CHESS_MOVE_IS_CAPTURE(move) && !CHESS_MOVE_IS_PROMOTION(move)) {
+                    history_update(ai_ctx, chess_ctx->current_turn, move, depth);
                 }
+                break;
             }
         }
+    }
 
+    // A root searched without some of its moves has no value of its own to store.
+    if (chosen_move && ai_ctx->root_excluded_num) {
         return value;
     }
+    TT_Bound bound = value <= alpha_orig ? TT_BOUND_UPPER : value >= beta_orig ? TT_BOUND_LOWER : TT_BOUND_EXACT;
+    float stored = mate_score_to_table(value, ply);
+    tt_store(&ai_ctx->tt_ctx, chess_ctx->hash, depth, flip ? -stored : stored, flip ? tt_bound_flip(bound) : bound, best_move);
+
+    return value;
 }
 
-void ai_get_best_move(const Chess_Context* chess_ctx, char* move_str) {
+int ai_init(AI_Context* ai_ctx, Syzygy_Context* syzygy_ctx, size_t hash_size_mb, TT_Budget* tt_budget) {
+    pthread_once(&eval_tables_once, eval_tables_init);
+    memset(ai_ctx, 0, sizeof(AI_Context));
+    ai_ctx->syzygy_ctx = syzygy_ctx;
+    ai_ctx->eval_cache_budget = tt_budget;
+    if (tt_init(&ai_ctx->tt_ctx, hash_size_mb, tt_budget)) {
+        return -1;
+    }
+    // Under a budget the cache gets what the table left, and the search does without one when nothing is left.
+    if (eval_cache_init(ai_ctx, AI_EVAL_CACHE_DEFAULT_SIZE_MB) && !tt_budget) {
+        tt_release(&ai_ctx->tt_ctx);
+        return -1;
+    }
+    return 0;
+}
+
+void ai_release(AI_Context* ai_ctx) {
+    tt_release(&ai_ctx->tt_ctx);
+    eval_cache_release(ai_ctx);
+}
+
+// The old table is released first so that its memory counts towards the new one when there is a budget.
+int ai_hash_size_set(AI_Context* ai_ctx, size_t hash_size_mb) {
+    TT_Budget* tt_budget = ai_ctx->tt_ctx.budget;
+    size_t old_size_mb = ai_ctx->tt_ctx.size_mb;
+    tt_release(&ai_ctx->tt_ctx);
+    if (tt_init(&ai_ctx->tt_ctx, hash_size_mb, tt_budget)) {
+        tt_init(&ai_ctx->tt_ctx, old_size_mb, tt_budget);
+        return -1;
+    }
+    return 0;
+}
+
+int ai_eval_cache_size_set(AI_Context* ai_ctx, size_t size_mb) {
+    size_t old_size_mb = ai_ctx->eval_cache_size_mb;
+    if (eval_cache_init(ai_ctx, size_mb)) {
+        eval_cache_init(ai_ctx, old_size_mb);
+        return -1;
+    }
+    return 0;
+}
+
+void ai_new_game(AI_Context* ai_ctx) {
+    tt_clear(&ai_ctx->tt_ctx);
+    memset(ai_ctx->history, 0, sizeof(ai_ctx->history));
+}
+
+// Follows the table moves from the root, checking each one against the generated moves since the
+// entries may belong to other positions.
+static int pv_extract(const AI_Context* ai_ctx, const Chess_Context* chess_ctx, Chess_Packed_Move first_move,
+    Chess_Packed_Move* pv, int max_length) {
+    Chess_Context ctx = *chess_ctx;
+    Chess_Move_List move_list;
+    Chess_Packed_Move move = first_move;
+    int length = 0;
+
+    while (move != CHESS_MOVE_NONE && length < max_length) {
+        chess_generate_moves(&ctx, &move_list);
+        int found = 0;
+        for (int i = 0; i < move_list.count && !found; ++i) {
+            found = move_list.moves[i] == move;
+        }
+        if (!found) {
+            break;
+        }
+
+        pv[length++] = move;
+        chess_make_move(&ctx, &ctx, move);
+
+        TT_Entry entry;
+        move = tt_probe(&ai_ctx->tt_ctx, ctx.hash, &entry) ? entry.move : CHESS_MOVE_NONE;
+    }
+
+    return length;
+}
+
+// One root search per line, each leaving out the moves of the lines before it, so every line is the best move among
+// the rest; the table and history carry over from line to line. Returns the number of lines completed, which is
+// fewer than wanted when the search stops or the root runs out of moves. On a stop during the first line, lines[0]
+// still gets the move that was being searched.
+static int root_lines_search(AI_Context* ai_ctx, const Chess_Context* chess_ctx, int depth, int lines_wanted, AI_Line* lines) {
+    Chess_Color color = chess_ctx->current_turn;
+    int lines_num = 0;
+
+    ai_ctx->root_depth = depth;
+    for (ai_ctx->root_excluded_num = 0; lines_num < lines_wanted; ++lines_num) {
+        Chess_Packed_Move move = CHESS_MOVE_NONE;
+        float beta = lines_num ? lines[lines_num - 1].score + AI_MULTI_PV_MARGIN : FLT_MAX;
+        float score = alphabeta(ai_ctx, chess_ctx, color, depth, -FLT_MAX, beta, 1, &move);
+        if (!ai_ctx->stop && score >= beta) {
+            score = alphabeta(ai_ctx, chess_ctx, color, depth, -FLT_MAX, FLT_MAX, 1, &move);
+        }
+        if (!lines_num) {
+            lines[0].pv[0] = move;
+            lines[0].score = score;
+        }
+        if (ai_ctx->stop || move == CHESS_MOVE_NONE) {
+            break;
+        }
+
+        // Kept in order even if a line came out above the one before it.
+        int index = lines_num;
+        for (; index > 0 && lines[index - 1].score < score; --index) {
+            lines[index] = lines[index - 1];
+        }
+        lines[index].pv[0] = move;
+        lines[index].pv_length = 1;
+        lines[index].score = score;
+        ai_ctx->root_excluded[ai_ctx->root_excluded_num++] = move;
+    }
+    ai_ctx->root_excluded_num = 0;
+    return lines_num;
+}
+
+static void result_pvs_extract(const AI_Context* ai_ctx, const Chess_Context* chess_ctx, AI_Result* result, int depth) {
+    for (int i = 0; i < result->lines_num; ++i) {
+        AI_Line* line = &result->lines[i];
+        line->pv_length = pv_extract(ai_ctx, chess_ctx, line->pv[0], line->pv, depth);
+    }
+    result->pv_length = pv_extract(ai_ctx, chess_ctx, result->best_move, result->pv, depth);
+}
+
+// Iterative deepening: each iteration orders the next one through the table, and an iteration cut short by
+// the node limit is thrown away.
+void ai_search(AI_Context* ai_ctx, const Chess_Context* chess_ctx, const AI_Limits* limits, AI_Result* result) {
+    Syzygy_WDL wdl;
+
+    memset(result, 0, sizeof(AI_Result));
+    ai_ctx->nodes = 0;
+    ai_ctx->eval_probes = 0;
+    ai_ctx->eval_hits = 0;
+    ai_ctx->nodes_limit = limits->nodes;
+    ai_ctx->stop = 0;
+
+    if (syzygy_can_probe(ai_ctx->syzygy_ctx, chess_ctx) && syzygy_root_probe(ai_ctx->syzygy_ctx, chess_ctx, &result->best_move, &wdl)) {
+        result->score = tablebase_score(wdl, chess_ctx, chess_ctx->current_turn);
+        result->pv[0] = result->best_move;
+        result->pv_length = 1;
+        return;
+    }
+
+    if (limits->time_ms) {
+        ai_deadline_set(ai_ctx, limits->time_ms);
+    }
+
+    tt_new_search(&ai_ctx->tt_ctx);
+    int unbounded = limits->nodes || limits->time_ms || limits->infinite;
+    int max_depth = limits->depth > 0 ? limits->depth : unbounded ? AI_MAX_DEPTH : AI_DEFAULT_DEPTH;
+    if (max_depth > AI_MAX_DEPTH) {
+        max_depth = AI_MAX_DEPTH;
+    }
+
+    int lines_wanted = limits->multi_pv < 1 ? 1 : limits->multi_pv > AI_MAX_MULTI_PV ? AI_MAX_MULTI_PV : limits->multi_pv;
+    AI_Line lines[AI_MAX_MULTI_PV];
+    for (int depth = 1; depth <= max_depth; ++depth) {
+        uint64_t iteration_start_ns = ai_time_now_ns();
+        int lines_num = root_lines_search(ai_ctx, chess_ctx, depth, lines_wanted, lines);
+        if (!lines_num) {
+            // Stopped in the first line, or no legal move. The first iteration keeps its partial move, so that
+            // there is always one to play.
+            if (result->best_move == CHESS_MOVE_NONE) {
+                result->best_move = lines[0].pv[0];
+                result->score = lines[0].score;
+                result->depth = depth;
+            }
+            break;
+        }
+
+        memcpy(result->lines, lines, lines_num * sizeof(AI_Line));
+        result->lines_num = lines_num;
+        result->best_move = lines[0].pv[0];
+        result->score = lines[0].score;
+        result->depth = depth;
+        if (ai_ctx->stop) {
+            break;
+        }
+        if (limits->iteration_callback) {
+            result->nodes = ai_ctx->nodes;
+            result->eval_probes = ai_ctx->eval_probes;
+            result->eval_hits = ai_ctx->eval_hits;
+            result_pvs_extract(ai_ctx, chess_ctx, result, depth);
+            if (limits->iteration_callback(result, limits->user_data)) {
+                break;
+            }
+        }
+
+        // The next iteration takes several times as long as this one, so it is not started if it can't finish.
+        uint64_t deadline_ns = atomic_load_explicit(&ai_ctx->deadline_ns, memory_order_relaxed);
+        uint64_t now_ns = ai_time_now_ns();
+        if (deadline_ns && now_ns + 2 * (now_ns - iteration_start_ns) > deadline_ns) {
+            break;
+        }
+    }
+
+    result->nodes = ai_ctx->nodes;
+    result->eval_probes = ai_ctx->eval_probes;
+    result->eval_hits = ai_ctx->eval_hits;
+    result_pvs_extract(ai_ctx, chess_ctx, result, result->depth > 0 ? result->depth : 1);
+}
+
+void ai_get_best_move(AI_Context* ai_ctx, const Chess_Context* chess_ctx, char* move_str) {
+    AI_Limits limits = { AI_DEFAULT_DEPTH, 0 };
+    AI_Result result;
     Chess_Move chosen_move;
-    float evaluation = alphabeta(chess_ctx, chess_ctx->current_turn, 5, -FLT_MAX, FLT_MAX, 1, &chosen_move);
-    io_move_to_uci_notation(&chosen_move, move_str);
-    log_debug("best move is %s, with evaluation of %.3f", move_str, evaluation);
+
+    ai_search(ai_ctx, chess_ctx, &limits, &result);
+    chess_move_unpack(result.best_move, &chosen_move);
+    chess_move_to_uci_notation(&chosen_move, move_str);
+    log_debug("best move is %s, with evaluation of %.3f after %llu nodes", move_str, result.score, (unsigned long long)result.nodes);
 }
 
 void ai_get_random_move(const Chess_Context* chess_ctx, char* move_str) {
@@ -187,8 +851,8 @@ void ai_get_random_move(const Chess_Context* chess_ctx, char* move_str) {
     #if 0
     for (int y = 0; y < CHESS_BOARD_HEIGHT; ++y) {
         for (int x = 0; x < CHESS_BOARD_WIDTH; ++x) {
-            Chess_Piece* piece = &chess_ctx->board[y][x];
-            if (piece->type != CHESS_PIECE_EMPTY) {
+            Chess_Piece piece = chess_piece_get(chess_ctx, CHESS_POS(y, x));
+            if (piece.type != CHESS_PIECE_EMPTY) {
                 available_moves_num += available_moves_get(chess_ctx, CHESS_POS(y, x), available_moves + available_moves_num);
             }
         }
@@ -197,8 +861,8 @@ void ai_get_random_move(const Chess_Context* chess_ctx, char* move_str) {
 
     //////////////// TEST ////////////////
 
-    const Chess_Piece* piece = &chess_ctx->board[0][4];
-    if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_WHITE) {
+    Chess_Piece piece = chess_piece_get(chess_ctx, CHESS_POS(0, 4));
+    if (piece.type == CHESS_PIECE_KING && piece.color == CHESS_COLOR_WHITE) {
         available_moves_num = chess_available_moves_get(chess_ctx, CHESS_POS(0, 4), available_moves);
         for (int i = 0; i < available_moves_num; ++i) {
             Chess_Move current = available_moves[i];
@@ -210,8 +874,8 @@ void ai_get_random_move(const Chess_Context* chess_ctx, char* move_str) {
         }
     }
 
-    piece = &chess_ctx->board[7][4];
-    if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_BLACK) {
+    piece = chess_piece_get(chess_ctx, CHESS_POS(7, 4));
+    if (piece.type == CHESS_PIECE_KING && piece.color == CHESS_COLOR_BLACK) {
         available_moves_num = chess_available_moves_get(chess_ctx, CHESS_POS(7, 4), available_moves);
         for (int i = 0; i < available_moves_num; ++i) {
             Chess_Move current = available_moves[i];
@@ -232,8 +896,8 @@ void ai_get_random_move(const Chess_Context* chess_ctx, char* move_str) {
         int h = rand() % CHESS_BOARD_HEIGHT;
         int w = rand() % CHESS_BOARD_WIDTH;
         Chess_Board_Position pos = CHESS_POS(h, w);
-        if (chess_ctx->board[pos.y][pos.x].type != CHESS_PIECE_EMPTY &&
-            chess_ctx->board[pos.y][pos.x].color == chess_ctx->current_turn) {
+        Chess_Piece piece = chess_piece_get(chess_ctx, pos);
+        if (piece.type != CHESS_PIECE_EMPTY && piece.color == chess_ctx->current_turn) {
             available_moves_num = chess_available_moves_get(chess_ctx, pos, available_moves);
             if (available_moves_num > 0) {
                 int r = rand() % available_moves_num;
@@ -243,5 +907,5 @@ void ai_get_random_move(const Chess_Context* chess_ctx, char* move_str) {
         }
     }
 
-    io_move_to_uci_notation(&move, move_str);
+    chess_move_to_uci_notation(&move, move_str);
 }
\ No newline at end of file
@@ -1,8 +1,127 @@
 #ifndef GOLDENPAWN_AI_H
 #define GOLDENPAWN_AI_H
 #include "chess.h"
+#include "syzygy.h"
+#include "tt.h"
+#include <stdatomic.h>
 
-void ai_get_best_move(const Chess_Context* chess_ctx, char* move);
+#define AI_DEFAULT_DEPTH 5
+#define AI_MAX_DEPTH 64
+#define AI_MAX_CENTIPAWNS 100000
+#define AI_MAX_MULTI_PV 32
+// Being mated scores -(AI_MATE_SCORE - plies from the root), so shorter mates score higher. Scores beyond
+// AI_MATE_BOUND are mates.
+#define AI_MATE_SCORE 10000.0f
+#define AI_MATE_BOUND (AI_MATE_SCORE - 2 * AI_MAX_DEPTH)
+#define AI_EVAL_CACHE_DEFAULT_SIZE_MB 4
+#define AI_EVAL_CACHE_MAX_SIZE_MB 1024
+
+// Evaluation weights in pawns, tunable with `goldenpawn tune`.
+typedef enum {
+    AI_PARAM_QUEEN,
+    AI_PARAM_ROOK,
+    AI_PARAM_BISHOP,
+    AI_PARAM_KNIGHT,
+    AI_PARAM_PAWN,
+    AI_PARAM_PAWN_ADVANCE,
+    AI_PARAM_ROOK_OPEN_FILE,
+    AI_PARAM_ROOK_SEMI_OPEN_FILE,
+    AI_PARAM_MOBILITY,
+    AI_PARAM_KING_ZONE_ATTACKS,
+    AI_PARAM_THREATS,
+    AI_PARAMS_NUM
+} AI_Param;
+
+typedef struct {
+    float values[AI_PARAMS_NUM];
+} AI_Eval_Params;
+
+extern const char* const ai_param_names[AI_PARAMS_NUM];
+
+// Search state that outlives a single search: it is kept between moves of the same game.
+typedef struct {
+    Syzygy_Context* syzygy_ctx;
+    TT_Context tt_ctx;
+    int history[2][CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH][CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH];
+    uint64_t nodes;
+    uint64_t nodes_limit;
+    int stop;
+    // Depth of the current root search; a node's distance from the root is this minus its depth.
+    int root_depth;
+    // Controls for a search running on another thread: stop_requested ends it and deadline_ns (monotonic clock,
+    // 0 for none) bounds it. ai_search only sets the deadline when given a time limit, so whoever starts a
+    // search from another thread clears both first.
+    atomic_int stop_requested;
+    _Atomic uint64_t deadline_ns;
+    // Root moves left out of the current root search, taken by earlier MultiPV lines.
+    Chess_Packed_Move root_excluded[AI_MAX_MULTI_PV];
+    int root_excluded_num;
+    // Static evaluations of the side to move by hash, one word per slot: the upper half of the key and the score.
+    // Slots are read and written whole, so the cache needs no lock; without slots every leaf is evaluated.
+    Memory_Block eval_cache;
+    size_t eval_cache_size_mb;
+    // Shared with the transposition table when the memory of several engines is capped, as in the server.
+    TT_Budget* eval_cache_budget;
+    uint64_t* eval_slots;
+    uint64_t eval_mask;
+    uint64_t eval_probes;
+    uint64_t eval_hits;
+} AI_Context;
+
+typedef struct {
+    float score;
+    Chess_Packed_Move pv[AI_MAX_DEPTH];
+    int pv_length;
+} AI_Line;
+
+// The score is in pawns from the point of view of the side to move. With MultiPV the lines are best first and the
+// first one repeats best_move, score and pv.
+typedef struct {
+    Chess_Packed_Move best_move;
+    float score;
+    int depth;
+    uint64_t nodes;
+    uint64_t eval_probes;
+    uint64_t eval_hits;
+    Chess_Packed_Move pv[AI_MAX_DEPTH];
+    int pv_length;
+    AI_Line lines[AI_MAX_MULTI_PV];
+    int lines_num;
+} AI_Result;
+
+// Called after every completed iteration; returning non-zero ends the search with that iteration's result.
+typedef int (*AI_Iteration_Callback)(const AI_Result* result, void* user_data);
+
+// A zero field means no limit; with no limit set and infinite unset the search goes to AI_DEFAULT_DEPTH.
+typedef struct {
+    int depth;
+    uint64_t nodes;
+    AI_Iteration_Callback iteration_callback;
+    void* user_data;
+    uint64_t time_ms;
+    int infinite;
+    int multi_pv;
+} AI_Limits;
+
+int ai_init(AI_Context* ai_ctx, Syzygy_Context* syzygy_ctx, size_t hash_size_mb, TT_Budget* tt_budget);
+void ai_release(AI_Context* ai_ctx);
+int ai_hash_size_set(AI_Context* ai_ctx, size_t hash_size_mb);
+// A zero size turns the evaluation cache off.
+int ai_eval_cache_size_set(AI_Context* ai_ctx, size_t size_mb);
+void ai_new_game(AI_Context* ai_ctx);
+float ai_evaluate(const Chess_Context* chess_ctx);
+void ai_eval_params_get(AI_Eval_Params* params);
+void ai_eval_params_set(const AI_Eval_Params* params);
+int ai_eval_features(const Chess_Context* chess_ctx, float coefficients[AI_PARAMS_NUM]);
+float ai_quiescence(const Chess_Context* chess_ctx);
+int ai_score_to_centipawns(float score);
+// Moves to the mate for mate scores, negative when the side to move is mated; 0 for other scores.
+int ai_score_to_mate(float score);
+void ai_search(AI_Context* ai_ctx, const Chess_Context* chess_ctx, const AI_Limits* limits, AI_Result* result);
+uint64_t ai_time_now_ns();
+void ai_deadline_set(AI_Context* ai_ctx, uint64_t time_ms);
+void ai_stop(AI_Context* ai_ctx);
+void ai_get_best_move(AI_Context* ai_ctx, const Chess_Context* chess_ctx, char* move);
 void ai_get_random_move(const Chess_Context* chess_ctx, char* move_str);
 
-#endif
\ No newline at end of file
+#endif
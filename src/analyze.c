@@ -0,0 +1,305 @@
+#include "analyze.h"
+#include "ai.h"
+#include "memory.h"
+#include "fen.h"
+#include "bitbase.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define ANALYZE_SLOTS_PER_JOB 4
+#define ANALYZE_FEN_SIZE 128
+#define ANALYZE_OUTPUT_SIZE (ANALYZE_FEN_SIZE + AI_MAX_DEPTH * 10 + 256)
+
+typedef enum {
+    ANALYZE_SLOT_FREE,
+    ANALYZE_SLOT_QUEUED,
+    ANALYZE_SLOT_DONE
+} Analyze_Slot_State;
+
+typedef struct {
+    Analyze_Slot_State state;
+    char fen[ANALYZE_FEN_SIZE];
+    char output[ANALYZE_OUTPUT_SIZE];
+} Analyze_Slot;
+
+// Positions go through a ring of slots: the main thread fills them in input order, workers search them in
+// the same order, and the main thread writes each result once every earlier one has been written.
+typedef struct {
+    AI_Limits limits;
+    size_t hash_size_mb;
+    Syzygy_Context syzygy_ctx;
+    Analyze_Slot* slots;
+    int slots_num;
+    uint64_t submitted;
+    uint64_t next_to_search;
+    uint64_t next_to_write;
+    // Workers started and not failed; a worker only leaves early when it can't allocate its tables.
+    int workers_live;
+    int finished;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    pthread_cond_t slot_done;
+} Analyze_Context;
+
+static void usage_print() {
+    fprintf(stderr, "usage: goldenpawn analyze --epd <file> [--depth N | --nodes N] [--jobs J] [--hash MB] [--syzygy PATH]\n");
+}
+
+// EPD lines start with the first four FEN fields; the operations after them (bm, id, ...) are ignored.
+static int epd_fen_get(const char* line, char* fen) {
+    int length = 0;
+    for (int field = 0; field < 4; ++field) {
+        while (*line == ' ' || *line == '\t') {
+            ++line;
+        }
+        if (!*line || *line == '\n' || *line == '\r' || *line == '#') {
+            return -1;
+        }
+        if (field) {
+            fen[length++] = ' ';
+        }
+        while (*line && *line != ' ' && *line != '\t' && *line != '\n' && *line != '\r') {
+            if (length >= ANALYZE_FEN_SIZE - 1) {
+                return -1;
+            }
+            fen[length++] = *line++;
+        }
+    }
+    fen[length] = '\0';
+    return 0;
+}
+
+static void position_analyze(Analyze_Context* an_ctx, AI_Context* ai_ctx, Analyze_Slot* slot) {
+    Chess_Context chess_ctx;
+
+    if (fen_chess_context_parse(&chess_ctx, slot->fen)) {
+        snprintf(slot->output, ANALYZE_OUTPUT_SIZE, "{\"fen\": \"%s\", \"error\": \"invalid position\"}\n", slot->fen);
+        return;
+    }
+
+    // Every position starts from empty tables, so the results don't depend on how positions are spread over workers.
+    AI_Result result;
+    ai_new_game(ai_ctx);
+    ai_search(ai_ctx, &chess_ctx, &an_ctx->limits, &result);
+
+    char* out = slot->output;
+    char* end = slot->output + ANALYZE_OUTPUT_SIZE;
+    char move_str[6];
+    Chess_Move move;
+
+    out += snprintf(out, end - out, "{\"fen\": \"%s\", \"bm\": ", slot->fen);
+    if (result.best_move != CHESS_MOVE_NONE) {
+        chess_move_unpack(result.best_move, &move);
+        chess_move_to_uci_notation(&move, move_str);
+        out += snprintf(out, end - out, "\"%s\"", move_str);
+    } else {
+        out += snprintf(out, end - out, "null");
+    }
+    out += snprintf(out, end - out, ", \"score\": %d, \"depth\": %d, \"pv\": [", ai_score_to_centipawns(result.score), result.depth);
+    for (int i = 0; i < result.pv_length; ++i) {
+        chess_move_unpack(result.pv[i], &move);
+        chess_move_to_uci_notation(&move, move_str);
+        out += snprintf(out, end - out, i ? ", \"%s\"" : "\"%s\"", move_str);
+    }
+    snprintf(out, end - out, "], \"nodes\": %llu}\n", (unsigned long long)result.nodes);
+}
+
+static void* analyze_worker(void* arg) {
+    Analyze_Context* an_ctx = arg;
+    // Pinned before the tables are allocated and cleared, so that their pages end up on the worker's node.
+    memory_thread_pin();
+    AI_Context* ai_ctx = malloc(sizeof(AI_Context));
+    if (!ai_ctx || ai_init(ai_ctx, &an_ctx->syzygy_ctx, an_ctx->hash_size_mb, NULL)) {
+        fprintf(stderr, "analyze: could not allocate the search tables of a worker\n");
+        free(ai_ctx);
+        pthread_mutex_lock(&an_ctx->mutex);
+        --an_ctx->workers_live;
+        pthread_cond_broadcast(&an_ctx->slot_done);
+        pthread_mutex_unlock(&an_ctx->mutex);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&an_ctx->mutex);
+    for (;;) {
+        while (an_ctx->next_to_search == an_ctx->submitted && !an_ctx->finished) {
+            pthread_cond_wait(&an_ctx->work_available, &an_ctx->mutex);
+        }
+        if (an_ctx->next_to_search == an_ctx->submitted) {
+            break;
+        }
+
+        Analyze_Slot* slot = &an_ctx->slots[an_ctx->next_to_search++ % an_ctx->slots_num];
+        pthread_mutex_unlock(&an_ctx->mutex);
+
+        position_analyze(an_ctx, ai_ctx, slot);
+
+        pthread_mutex_lock(&an_ctx->mutex);
+        slot->state = ANALYZE_SLOT_DONE;
+        pthread_cond_broadcast(&an_ctx->slot_done);
+    }
+    pthread_mutex_unlock(&an_ctx->mutex);
+
+    ai_release(ai_ctx);
+    free(ai_ctx);
+    return NULL;
+}
+
+// Writes finished results in input order. Must be called with the mutex held; it is released while writing,
+// which is safe because finished slots are only touched by the main thread.
+static void results_write(Analyze_Context* an_ctx) {
+    while (an_ctx->next_to_write < an_ctx->submitted) {
+        Analyze_Slot* slot = &an_ctx->slots[an_ctx->next_to_write % an_ctx->slots_num];
+        if (slot->state != ANALYZE_SLOT_DONE) {
+            break;
+        }
+        pthread_mutex_unlock(&an_ctx->mutex);
+        fputs(slot->output, stdout);
+        pthread_mutex_lock(&an_ctx->mutex);
+        slot->state = ANALYZE_SLOT_FREE;
+        ++an_ctx->next_to_write;
+    }
+}
+
+static int arguments_parse(Analyze_Context* an_ctx, int argc, char** argv, const char** epd_path, int* jobs, const char** syzygy_path) {
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            return -1;
+        }
+        if (!strcmp(argv[i], "--epd")) {
+            *epd_path = argv[++i];
+        } else if (!strcmp(argv[i], "--depth")) {
+            an_ctx->limits.depth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--nodes")) {
+            an_ctx->limits.nodes = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--jobs")) {
+            *jobs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--hash")) {
+            an_ctx->hash_size_mb = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--syzygy")) {
+            *syzygy_path = argv[++i];
+        } else {
+            return -1;
+        }
+    }
+    if (!*epd_path || *jobs < 1 || an_ctx->hash_size_mb < 1 || an_ctx->hash_size_mb > TT_MAX_SIZE_MB ||
+        an_ctx->limits.depth < 0 || an_ctx->limits.depth > AI_MAX_DEPTH) {
+        return -1;
+    }
+    return 0;
+}
+
+int analyze_main(int argc, char** argv) {
+    Analyze_Context an_ctx;
+    const char* epd_path = NULL;
+    const char* syzygy_path = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = cpus > 0 ? (int)cpus : 1;
+
+    memset(&an_ctx, 0, sizeof(Analyze_Context));
+    an_ctx.hash_size_mb = TT_DEFAULT_SIZE_MB;
+    if (arguments_parse(&an_ctx, argc, argv, &epd_path, &jobs, &syzygy_path)) {
+        usage_print();
+        return 1;
+    }
+
+    FILE* epd_file = fopen(epd_path, "r");
+    if (!epd_file) {
+        fprintf(stderr, "analyze: could not open %s\n", epd_path);
+        return 1;
+    }
+
+    bitbase_init();
+    syzygy_init(&an_ctx.syzygy_ctx);
+    if (syzygy_path) {
+        syzygy_path_set(&an_ctx.syzygy_ctx, syzygy_path);
+    }
+
+    an_ctx.slots_num = jobs * ANALYZE_SLOTS_PER_JOB;
+    an_ctx.slots = calloc(an_ctx.slots_num, sizeof(Analyze_Slot));
+    pthread_t* workers = malloc(jobs * sizeof(pthread_t));
+    if (!an_ctx.slots || !workers) {
+        fprintf(stderr, "analyze: out of memory\n");
+        fclose(epd_file);
+        free(an_ctx.slots);
+        free(workers);
+        syzygy_release(&an_ctx.syzygy_ctx);
+        return 1;
+    }
+    pthread_mutex_init(&an_ctx.mutex, NULL);
+    pthread_cond_init(&an_ctx.work_available, NULL);
+    pthread_cond_init(&an_ctx.slot_done, NULL);
+
+    int workers_num = 0;
+    an_ctx.workers_live = jobs;
+    for (; workers_num < jobs; ++workers_num) {
+        if (pthread_create(&workers[workers_num], NULL, analyze_worker, &an_ctx)) {
+            break;
+        }
+    }
+    pthread_mutex_lock(&an_ctx.mutex);
+    an_ctx.workers_live -= jobs - workers_num;
+    pthread_mutex_unlock(&an_ctx.mutex);
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    char fen[ANALYZE_FEN_SIZE];
+
+    pthread_mutex_lock(&an_ctx.mutex);
+    while (an_ctx.workers_live && getline(&line, &line_capacity, epd_file) != -1) {
+        if (epd_fen_get(line, fen)) {
+            continue;
+        }
+
+        Analyze_Slot* slot = &an_ctx.slots[an_ctx.submitted % an_ctx.slots_num];
+        for (;;) {
+            results_write(&an_ctx);
+            if (slot->state == ANALYZE_SLOT_FREE || !an_ctx.workers_live) {
+                break;
+            }
+            pthread_cond_wait(&an_ctx.slot_done, &an_ctx.mutex);
+        }
+        if (!an_ctx.workers_live) {
+            break;
+        }
+
+        strcpy(slot->fen, fen);
+        slot->state = ANALYZE_SLOT_QUEUED;
+        ++an_ctx.submitted;
+        pthread_cond_signal(&an_ctx.work_available);
+        results_write(&an_ctx);
+    }
+
+    an_ctx.finished = 1;
+    pthread_cond_broadcast(&an_ctx.work_available);
+    for (;;) {
+        results_write(&an_ctx);
+        if (an_ctx.next_to_write == an_ctx.submitted || !an_ctx.workers_live) {
+            break;
+        }
+        pthread_cond_wait(&an_ctx.slot_done, &an_ctx.mutex);
+    }
+    int failed = !an_ctx.workers_live;
+    pthread_mutex_unlock(&an_ctx.mutex);
+    if (failed) {
+        fprintf(stderr, "analyze: no worker is left to search the positions\n");
+    }
+    fflush(stdout);
+
+    for (int i = 0; i < workers_num; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    free(line);
+    fclose(epd_file);
+    pthread_cond_destroy(&an_ctx.slot_done);
+    pthread_cond_destroy(&an_ctx.work_available);
+    pthread_mutex_destroy(&an_ctx.mutex);
+    free(workers);
+    free(an_ctx.slots);
+    syzygy_release(&an_ctx.syzygy_ctx);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,7 @@
+#ifndef GOLDENPAWN_ANALYZE_H
+#define GOLDENPAWN_ANALYZE_H
+
+// goldenpawn analyze --epd <file> [--depth N | --nodes N] [--jobs J] [--hash MB] [--syzygy PATH]
+int analyze_main(int argc, char** argv);
+
+#endif
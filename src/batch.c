@@ -0,0 +1,312 @@
+#include "batch.h"
+#include "goldenpawn.h"
+#include "fen.h"
+#include "packed.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BATCH_BUFFER_SIZE (8 * 1024 * 1024)
+#define BATCH_PACKED_CHUNK (1024 * 1024)
+
+typedef struct {
+    char* buffer;
+    size_t buffer_capacity;
+    size_t buffer_length;
+    const char** fens;
+    size_t fens_capacity;
+    Goldenpawn_Evaluation* results;
+} Batch_Context;
+
+static void usage_print() {
+    fprintf(stderr, "usage: goldenpawn eval-batch [--input <file>] [--output <file>] [--jobs J] [--quiescence] [--packed]\n");
+    fprintf(stderr, "       goldenpawn pack [--input <file>] [--output <file>]\n");
+    fprintf(stderr, "       goldenpawn unpack --input <file> [--output <file>]\n");
+}
+
+static int arguments_parse(int argc, char** argv, const char** input_path, const char** output_path, int* jobs, int* flags,
+    int* packed) {
+    for (int i = 0; i < argc; ++i) {
+        if (!strcmp(argv[i], "--quiescence")) {
+            *flags |= GOLDENPAWN_EVALUATE_QUIESCENCE;
+            continue;
+        }
+        if (!strcmp(argv[i], "--packed")) {
+            *packed = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return -1;
+        }
+        if (!strcmp(argv[i], "--input")) {
+            *input_path = argv[++i];
+        } else if (!strcmp(argv[i], "--output")) {
+            *output_path = argv[++i];
+        } else if (!strcmp(argv[i], "--jobs")) {
+            *jobs = atoi(argv[++i]);
+        } else {
+            return -1;
+        }
+    }
+    return *jobs < 1 ? -1 : 0;
+}
+
+static int fens_reserve(Batch_Context* batch_ctx, size_t count) {
+    if (count <= batch_ctx->fens_capacity) {
+        return 0;
+    }
+    size_t capacity = batch_ctx->fens_capacity ? batch_ctx->fens_capacity : 4096;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    const char** fens = realloc(batch_ctx->fens, capacity * sizeof(const char*));
+    if (!fens) {
+        return -1;
+    }
+    batch_ctx->fens = fens;
+    Goldenpawn_Evaluation* results = realloc(batch_ctx->results, capacity * sizeof(Goldenpawn_Evaluation));
+    if (!results) {
+        return -1;
+    }
+    batch_ctx->results = results;
+    batch_ctx->fens_capacity = capacity;
+    return 0;
+}
+
+// Input is read in large blocks and split into lines in place, so a block of positions costs one read, one
+// library call and one write. Every line, blank or not, gets its record.
+static int batch_run(Batch_Context* batch_ctx, FILE* input, FILE* output, int flags, int jobs, size_t* positions_num) {
+    for (;;) {
+        if (batch_ctx->buffer_capacity - batch_ctx->buffer_length < 2) {
+            size_t capacity = batch_ctx->buffer_capacity * 2;
+            char* buffer = realloc(batch_ctx->buffer, capacity);
+            if (!buffer) {
+                return -1;
+            }
+            batch_ctx->buffer = buffer;
+            batch_ctx->buffer_capacity = capacity;
+        }
+
+        size_t read_bytes = fread(batch_ctx->buffer + batch_ctx->buffer_length, 1,
+            batch_ctx->buffer_capacity - batch_ctx->buffer_length - 1, input);
+        batch_ctx->buffer_length += read_bytes;
+        int end = read_bytes == 0;
+
+        size_t count = 0, start = 0;
+        for (;;) {
+            char* newline = memchr(batch_ctx->buffer + start, '\n', batch_ctx->buffer_length - start);
+            if (!newline && !(end && start < batch_ctx->buffer_length)) {
+                break;
+            }
+            size_t line_end = newline ? (size_t)(newline - batch_ctx->buffer) : batch_ctx->buffer_length;
+            if (fens_reserve(batch_ctx, count + 1)) {
+                return -1;
+            }
+            batch_ctx->buffer[line_end] = '\0';
+            batch_ctx->fens[count++] = batch_ctx->buffer + start;
+            start = line_end + 1;
+            if (!newline) {
+                break;
+            }
+        }
+
+        if (count) {
+            if (goldenpawn_evaluate_batch(batch_ctx->fens, count, flags, jobs, batch_ctx->results) ||
+                fwrite(batch_ctx->results, sizeof(Goldenpawn_Evaluation), count, output) != count) {
+                return -1;
+            }
+            *positions_num += count;
+        }
+
+        if (end) {
+            return 0;
+        }
+        batch_ctx->buffer_length -= start;
+        memmove(batch_ctx->buffer, batch_ctx->buffer + start, batch_ctx->buffer_length);
+    }
+}
+
+// Packed input is mapped whole and evaluated a chunk at a time, straight from the records.
+static int batch_packed_run(Batch_Context* batch_ctx, const char* input_path, FILE* output, int flags, int jobs,
+    size_t* positions_num) {
+    Packed_Reader reader;
+
+    if (packed_reader_open(&reader, input_path)) {
+        fprintf(stderr, "eval-batch: %s is not a packed position file\n", input_path);
+        return -1;
+    }
+    int result = fens_reserve(batch_ctx, reader.count < BATCH_PACKED_CHUNK ? reader.count : BATCH_PACKED_CHUNK);
+    for (size_t start = 0; !result && start < reader.count; start += BATCH_PACKED_CHUNK) {
+        size_t count = reader.count - start < BATCH_PACKED_CHUNK ? reader.count - start : BATCH_PACKED_CHUNK;
+        if (goldenpawn_evaluate_packed_batch(reader.positions + start, count, flags, jobs, batch_ctx->results) ||
+            fwrite(batch_ctx->results, sizeof(Goldenpawn_Evaluation), count, output) != count) {
+            result = -1;
+        }
+        *positions_num += count;
+    }
+    packed_reader_close(&reader);
+    return result;
+}
+
+int batch_main(int argc, char** argv) {
+    Batch_Context batch_ctx;
+    const char* input_path = NULL;
+    const char* output_path = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = cpus > 0 ? (int)cpus : 1;
+    int flags = 0;
+    int packed = 0;
+
+    if (arguments_parse(argc, argv, &input_path, &output_path, &jobs, &flags, &packed) || (packed && !input_path)) {
+        usage_print();
+        return 1;
+    }
+
+    FILE* input = packed ? NULL : input_path ? fopen(input_path, "r") : stdin;
+    if (!input && !packed) {
+        fprintf(stderr, "eval-batch: could not open %s\n", input_path);
+        return 1;
+    }
+    FILE* output = output_path ? fopen(output_path, "wb") : stdout;
+    if (!output) {
+        fprintf(stderr, "eval-batch: could not create %s\n", output_path);
+        if (input && input != stdin) fclose(input);
+        return 1;
+    }
+
+    memset(&batch_ctx, 0, sizeof(Batch_Context));
+    batch_ctx.buffer = malloc(BATCH_BUFFER_SIZE);
+    batch_ctx.buffer_capacity = BATCH_BUFFER_SIZE;
+
+    struct timespec started, finished;
+    size_t positions_num = 0;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int result = packed ? batch_packed_run(&batch_ctx, input_path, output, flags, jobs, &positions_num) != 0 :
+        !batch_ctx.buffer || batch_run(&batch_ctx, input, output, flags, jobs, &positions_num);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    if (result) {
+        fprintf(stderr, "eval-batch: failed after %zu positions\n", positions_num);
+    } else {
+        fprintf(stderr, "eval-batch: %zu positions in %.3f s (%.0f per second)\n", positions_num, seconds,
+            seconds > 0 ? positions_num / seconds : 0.0);
+    }
+
+    if (fflush(output)) {
+        result = 1;
+    }
+    if (input && input != stdin) fclose(input);
+    if (output != stdout) fclose(output);
+    free(batch_ctx.buffer);
+    free(batch_ctx.fens);
+    free(batch_ctx.results);
+    return result;
+}
+
+static int paths_parse(int argc, char** argv, const char** input_path, const char** output_path) {
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            return -1;
+        }
+        if (!strcmp(argv[i], "--input")) {
+            *input_path = argv[++i];
+        } else if (!strcmp(argv[i], "--output")) {
+            *output_path = argv[++i];
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Converts FEN or EPD lines to packed positions. Lines that don't parse are skipped and counted.
+int pack_main(int argc, char** argv) {
+    const char* input_path = NULL;
+    const char* output_path = NULL;
+    Packed_Writer writer;
+
+    if (paths_parse(argc, argv, &input_path, &output_path)) {
+        usage_print();
+        return 1;
+    }
+    FILE* input = input_path ? fopen(input_path, "r") : stdin;
+    if (!input) {
+        fprintf(stderr, "pack: could not open %s\n", input_path);
+        return 1;
+    }
+    if (packed_writer_open(&writer, output_path)) {
+        fprintf(stderr, "pack: could not create %s\n", output_path ? output_path : "output");
+        if (input != stdin) fclose(input);
+        return 1;
+    }
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    size_t skipped = 0;
+    while ((length = getline(&line, &line_capacity, input)) >= 0) {
+        Chess_Context chess_ctx;
+        Packed_Position position;
+        if (fen_chess_context_parse_view(&chess_ctx, line, length) < 0 ||
+            packed_position_pack(&chess_ctx, 0, PACKED_RESULT_UNKNOWN, &position)) {
+            ++skipped;
+            continue;
+        }
+        if (packed_writer_append(&writer, &position, 1)) {
+            break;
+        }
+    }
+    free(line);
+    if (input != stdin) fclose(input);
+
+    int result = packed_writer_close(&writer) ? 1 : 0;
+    fprintf(stderr, "pack: %llu positions written, %zu lines skipped\n", (unsigned long long)writer.written, skipped);
+    return result;
+}
+
+// Prints packed positions as "<fen> <score> <result>" lines.
+int unpack_main(int argc, char** argv) {
+    static const char* results[] = { "*", "1-0", "1/2-1/2", "0-1" };
+    const char* input_path = NULL;
+    const char* output_path = NULL;
+    Packed_Reader reader;
+
+    if (paths_parse(argc, argv, &input_path, &output_path) || !input_path) {
+        usage_print();
+        return 1;
+    }
+    if (packed_reader_open(&reader, input_path)) {
+        fprintf(stderr, "unpack: %s is not a packed position file\n", input_path);
+        return 1;
+    }
+    FILE* output = output_path ? fopen(output_path, "w") : stdout;
+    if (!output) {
+        fprintf(stderr, "unpack: could not create %s\n", output_path);
+        packed_reader_close(&reader);
+        return 1;
+    }
+
+    int result = 0;
+    for (size_t i = 0; i < reader.count; ++i) {
+        const Packed_Position* position = &reader.positions[i];
+        Chess_Context chess_ctx;
+        char fen[FEN_MAX_SIZE];
+        if (packed_position_unpack(position, &chess_ctx)) {
+            fprintf(stderr, "unpack: record %zu is corrupted\n", i);
+            result = 1;
+            continue;
+        }
+        fen_from_context(&chess_ctx, fen, sizeof(fen));
+        fprintf(output, "%s %d %s\n", fen, position->score, position->result < 4 ? results[position->result] : "*");
+    }
+
+    if (fflush(output)) {
+        result = 1;
+    }
+    if (output != stdout) fclose(output);
+    packed_reader_close(&reader);
+    return result;
+}
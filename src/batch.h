@@ -0,0 +1,11 @@
+#ifndef GOLDENPAWN_BATCH_H
+#define GOLDENPAWN_BATCH_H
+
+// goldenpawn eval-batch [--input <file>] [--output <file>] [--jobs J] [--quiescence] [--packed]
+int batch_main(int argc, char** argv);
+// goldenpawn pack [--input <file>] [--output <file>]
+int pack_main(int argc, char** argv);
+// goldenpawn unpack --input <file> [--output <file>]
+int unpack_main(int argc, char** argv);
+
+#endif
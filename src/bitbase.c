@@ -0,0 +1,165 @@
+#include "bitbase.h"
+#include "tables.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// KPK positions are indexed by the white king, black king, side to move and a pawn on files a-d, ranks 2-7.
+// The pawn side is always normalized to white, so one bit per position (win or not) is enough.
+#define BITBASE_KPK_SIZE (2 * 24 * 64 * 64)
+
+typedef enum {
+    KPK_INVALID = 0,
+    KPK_UNKNOWN = 1,
+    KPK_DRAW = 2,
+    KPK_WIN = 4
+} Kpk_Result;
+
+static uint32_t kpk_bitbase[BITBASE_KPK_SIZE / 32];
+static pthread_once_t bitbase_once = PTHREAD_ONCE_INIT;
+
+static unsigned kpk_index(int stm, int black_king, int white_king, int pawn) {
+    return white_king | (black_king << 6) | (stm << 12) | ((pawn & 7) << 13) | ((6 - (pawn >> 3)) << 15);
+}
+
+static Kpk_Result kpk_initial_result(unsigned idx) {
+    int white_king = idx & 0x3F;
+    int black_king = (idx >> 6) & 0x3F;
+    int stm = (idx >> 12) & 0x01;
+    int pawn = CHESS_SQUARE(6 - ((idx >> 15) & 0x7), (idx >> 13) & 0x3);
+    int push = pawn + 8;
+
+    // Invalid if two pieces share a square or a king can be captured.
+    if (tables_distance[white_king][black_king] <= 1 || white_king == pawn || black_king == pawn ||
+        (stm == 0 && (tables_pawn_attacks[0][pawn] & (1ULL << black_king)))) {
+        return KPK_INVALID;
+    }
+
+    // Win if the pawn can be promoted without getting captured.
+    if (stm == 0 && (pawn >> 3) == 6 && white_king != push &&
+        (tables_distance[black_king][push] > 1 || tables_distance[white_king][push] == 1)) {
+        return KPK_WIN;
+    }
+
+    // Draw if it is stalemate or the black king can capture the pawn.
+    if (stm == 1 && (!(tables_king_attacks[black_king] & ~(tables_king_attacks[white_king] | tables_pawn_attacks[0][pawn])) ||
+        (tables_king_attacks[black_king] & ~tables_king_attacks[white_king] & (1ULL << pawn)))) {
+        return KPK_DRAW;
+    }
+
+    return KPK_UNKNOWN;
+}
+
+static Kpk_Result kpk_classify(const uint8_t* db, unsigned idx) {
+    int white_king = idx & 0x3F;
+    int black_king = (idx >> 6) & 0x3F;
+    int stm = (idx >> 12) & 0x01;
+    int pawn = CHESS_SQUARE(6 - ((idx >> 15) & 0x7), (idx >> 13) & 0x3);
+
+    // White needs one move to a win, black needs one move to a draw.
+    Kpk_Result good = stm == 0 ? KPK_WIN : KPK_DRAW;
+    Kpk_Result bad = stm == 0 ? KPK_DRAW : KPK_WIN;
+    int result = KPK_INVALID;
+
+    Chess_Bitboard b = tables_king_attacks[stm == 0 ? white_king : black_king];
+    while (b) {
+        int square = __builtin_ctzll(b);
+        b &= b - 1;
+        result |= stm == 0 ? db[kpk_index(1, black_king, square, pawn)] : db[kpk_index(0, square, white_king, pawn)];
+    }
+
+    if (stm == 0) {
+        if ((pawn >> 3) < 6) {
+            result |= db[kpk_index(1, black_king, white_king, pawn + 8)];
+        }
+        if ((pawn >> 3) == 1 && pawn + 8 != white_king && pawn + 8 != black_king) {
+            result |= db[kpk_index(1, black_king, white_king, pawn + 16)];
+        }
+    }
+
+    return (result & good) ? good : (result & KPK_UNKNOWN) ? KPK_UNKNOWN : bad;
+}
+
+static void bitbase_generate() {
+    uint8_t* db = malloc(BITBASE_KPK_SIZE);
+    for (unsigned idx = 0; idx < BITBASE_KPK_SIZE; ++idx) {
+        db[idx] = kpk_initial_result(idx);
+    }
+
+    // Retrograde iteration until no unknown position can be resolved anymore; leftovers are draws.
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (unsigned idx = 0; idx < BITBASE_KPK_SIZE; ++idx) {
+            if (db[idx] == KPK_UNKNOWN) {
+                db[idx] = kpk_classify(db, idx);
+                changed |= db[idx] != KPK_UNKNOWN;
+            }
+        }
+    }
+
+    memset(kpk_bitbase, 0, sizeof(kpk_bitbase));
+    for (unsigned idx = 0; idx < BITBASE_KPK_SIZE; ++idx) {
+        if (db[idx] == KPK_WIN) {
+            kpk_bitbase[idx / 32] |= 1u << (idx % 32);
+        }
+    }
+
+    free(db);
+}
+
+void bitbase_init() {
+    pthread_once(&bitbase_once, bitbase_generate);
+}
+
+// Returns 1 if the position is KPK, setting winner to the pawn side if it wins or to colorless if it is a draw.
+int bitbase_kpk_probe(const Chess_Context* chess_ctx, Chess_Color* winner) {
+    int kings[3] = { 0 };
+    int pawn = -1, pieces_num = 0;
+    Chess_Color strong_side = CHESS_COLOR_COLORLESS;
+
+    for (int y = 0; y < CHESS_BOARD_HEIGHT; ++y) {
+        for (int x = 0; x < CHESS_BOARD_WIDTH; ++x) {
+            Chess_Packed_Piece piece = chess_ctx->board[CHESS_SQUARE(y, x)];
+            if (piece == CHESS_PIECE_EMPTY) {
+                continue;
+            }
+            if (++pieces_num > 3) {
+                return 0;
+            }
+            if (CHESS_PIECE_TYPE(piece) == CHESS_PIECE_KING) {
+                kings[CHESS_PIECE_COLOR(piece)] = CHESS_SQUARE(y, x);
+            } else if (CHESS_PIECE_TYPE(piece) == CHESS_PIECE_PAWN) {
+                pawn = CHESS_SQUARE(y, x);
+                strong_side = CHESS_PIECE_COLOR(piece);
+            } else {
+                return 0;
+            }
+        }
+    }
+
+    if (pieces_num != 3 || pawn == -1) {
+        return 0;
+    }
+
+    Chess_Color weak_side = strong_side == CHESS_COLOR_WHITE ? CHESS_COLOR_BLACK : CHESS_COLOR_WHITE;
+    int strong_king = kings[strong_side];
+    int weak_king = kings[weak_side];
+    int stm = chess_ctx->current_turn == strong_side ? 0 : 1;
+
+    // Normalize so that the pawn is white and on files a-d.
+    if (strong_side == CHESS_COLOR_BLACK) {
+        strong_king ^= 56;
+        weak_king ^= 56;
+        pawn ^= 56;
+    }
+    if ((pawn & 7) > 3) {
+        strong_king ^= 7;
+        weak_king ^= 7;
+        pawn ^= 7;
+    }
+
+    unsigned idx = kpk_index(stm, weak_king, strong_king, pawn);
+    *winner = (kpk_bitbase[idx / 32] & (1u << (idx % 32))) ? strong_side : CHESS_COLOR_COLORLESS;
+    return 1;
+}
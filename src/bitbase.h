@@ -0,0 +1,8 @@
+#ifndef GOLDENPAWN_BITBASE_H
+#define GOLDENPAWN_BITBASE_H
+#include "chess.h"
+
+void bitbase_init();
+int bitbase_kpk_probe(const Chess_Context* chess_ctx, Chess_Color* winner);
+
+#endif
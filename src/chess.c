@@ -1,864 +1,968 @@
 #include "chess.h"
+#include "tables.h"
 #include "logger.h"
-#include "io.h"
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 #include <math.h>
 
-static int available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int king_can_be_exposed, int discard_non_attacking_moves);
+_Static_assert(sizeof(Chess_Context) <= 128, "Chess_Context is copied on every move and must stay within two cache lines");
 
-static Chess_Move chess_move_with_promotion(Chess_Board_Position from, Chess_Board_Position to, Chess_Piece_Type promote_to) {
-    Chess_Move move;
-    move.from = from;
-    move.to = to;
-    move.will_promote = 1;
-    move.promotion_type = promote_to;
-    return move;
-}
+static void available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move_List* move_list, int king_can_be_exposed, int discard_non_attacking_moves);
 
-static Chess_Move chess_move_no_promotion(Chess_Board_Position from, Chess_Board_Position to) {
-    Chess_Move move;
-    move.from = from;
-    move.to = to;
-    move.will_promote = 0;
-    return move;
+static int promotion_flags(Chess_Piece_Type promote_to) {
+    switch (promote_to) {
+        case CHESS_PIECE_KNIGHT: return CHESS_MOVE_FLAG_PROMOTION | 0;
+        case CHESS_PIECE_BISHOP: return CHESS_MOVE_FLAG_PROMOTION | 1;
+        case CHESS_PIECE_ROOK: return CHESS_MOVE_FLAG_PROMOTION | 2;
+        case CHESS_PIECE_QUEEN: return CHESS_MOVE_FLAG_PROMOTION | 3;
+        default: assert(0); return 0;
+    }
 }
 
-static void king_positions_fill(Chess_Context* chess_ctx) {
-    int found_white_king = 0, found_black_king = 0;
-    for (int y = 0; y < CHESS_BOARD_HEIGHT && !(found_white_king && found_black_king); ++y) {
-        for (int x = 0; x < CHESS_BOARD_WIDTH && !(found_white_king && found_black_king); ++x) {
-            Chess_Piece* current_piece = &chess_ctx->board[y][x];
-            if (current_piece->type == CHESS_PIECE_KING) {
-                if (current_piece->color == CHESS_COLOR_WHITE) {
-                    chess_ctx->white_state.king_position = CHESS_POS(y, x);
-                    found_white_king = 1;
-                } else {
-                    chess_ctx->black_state.king_position = CHESS_POS(y, x);
-                    found_black_king = 1;
-                }
-            }
-        }
+static Chess_Packed_Move chess_move_with_promotion(const Chess_Context* chess_ctx, Chess_Board_Position from, Chess_Board_Position to, Chess_Piece_Type promote_to) {
+    int flags = promotion_flags(promote_to);
+    if (CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(to.y, to.x)]) != CHESS_PIECE_EMPTY) {
+        flags |= CHESS_MOVE_FLAG_CAPTURE;
     }
-    assert(found_white_king);
-    assert(found_black_king);
+    return CHESS_MOVE_MAKE(CHESS_SQUARE(from.y, from.x), CHESS_SQUARE(to.y, to.x), flags);
 }
 
-static Chess_Piece empty_piece() {
-    Chess_Piece piece;
-    piece.color = CHESS_COLOR_COLORLESS;
-    piece.type = CHESS_PIECE_EMPTY;
-    return piece;
+static Chess_Packed_Move chess_move_no_promotion(const Chess_Context* chess_ctx, Chess_Board_Position from, Chess_Board_Position to) {
+    int flags = CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(to.y, to.x)]) != CHESS_PIECE_EMPTY ? CHESS_MOVE_FLAG_CAPTURE : CHESS_MOVE_FLAG_QUIET;
+    return CHESS_MOVE_MAKE(CHESS_SQUARE(from.y, from.x), CHESS_SQUARE(to.y, to.x), flags);
 }
 
-static int is_square_being_attacked(const Chess_Context* chess_ctx, Chess_Board_Position position, Chess_Color by_color) {
-    for (int y = 0; y < CHESS_BOARD_HEIGHT; ++y) {
-        for (int x = 0; x < CHESS_BOARD_WIDTH; ++x) {
-            const Chess_Piece* current_piece = &chess_ctx->board[y][x];
-            if (current_piece->type != CHESS_PIECE_EMPTY && current_piece->color == by_color) {
-                Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH];
-                int available_moves_num = available_moves_get(chess_ctx, CHESS_POS(y, x), available_moves, 1, 1);
-
-                for (int k = 0; k < available_moves_num; ++k) {
-                    if (available_moves[k].to.x == position.x && available_moves[k].to.y == position.y) {
-                        return 1;
-                    }
-                }
-            }
-        }
-    }
+static Chess_Packed_Move chess_move_special(Chess_Board_Position from, Chess_Board_Position to, int flags) {
+    return CHESS_MOVE_MAKE(CHESS_SQUARE(from.y, from.x), CHESS_SQUARE(to.y, to.x), flags);
+}
 
-    return 0;
+Chess_Piece_Type chess_move_promotion_type(Chess_Packed_Move move) {
+    static const Chess_Piece_Type types[] = { CHESS_PIECE_KNIGHT, CHESS_PIECE_BISHOP, CHESS_PIECE_ROOK, CHESS_PIECE_QUEEN };
+    return CHESS_MOVE_IS_PROMOTION(move) ? types[CHESS_MOVE_FLAGS(move) & 0x3] : CHESS_PIECE_EMPTY;
 }
 
-void chess_update_context(Chess_Context* chess_ctx) {
-    king_positions_fill(chess_ctx);
-    chess_ctx->white_state.is_king_under_attack = is_square_being_attacked(chess_ctx, chess_ctx->white_state.king_position, CHESS_COLOR_BLACK);
-    chess_ctx->black_state.is_king_under_attack = is_square_being_attacked(chess_ctx, chess_ctx->black_state.king_position, CHESS_COLOR_WHITE);
+void chess_move_unpack(Chess_Packed_Move packed_move, Chess_Move* move) {
+    int from = CHESS_MOVE_FROM(packed_move);
+    int to = CHESS_MOVE_TO(packed_move);
+    move->from = CHESS_POS(from / CHESS_BOARD_WIDTH, from % CHESS_BOARD_WIDTH);
+    move->to = CHESS_POS(to / CHESS_BOARD_WIDTH, to % CHESS_BOARD_WIDTH);
+    move->will_promote = CHESS_MOVE_IS_PROMOTION(packed_move) ? 1 : 0;
+    move->promotion_type = chess_move_promotion_type(packed_move);
 }
 
-// Note: this function MUST support chess_ctx == new_ctx !
-void chess_move_piece(const Chess_Context* chess_ctx, Chess_Context* new_ctx, const Chess_Move* move) {
-    *new_ctx = *chess_ctx;
-    Chess_Piece* piece = &new_ctx->board[move->from.y][move->from.x];
+// Moves coming from the GUI only carry squares and promotion, so the flags are recovered from the position.
+Chess_Packed_Move chess_move_pack(const Chess_Context* chess_ctx, const Chess_Move* move) {
+    Chess_Piece_Type type = CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(move->from.y, move->from.x)]);
 
-    // Update castles
-    if (chess_ctx->white_state.short_castling_available) {
-        if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_WHITE) {
-            // King is being moved.
-            new_ctx->white_state.short_castling_available = 0;
-        } else if (piece->type == CHESS_PIECE_ROOK && piece->color == CHESS_COLOR_WHITE && move->from.x == 7 && move->from.y == 0) {
-            // Rook is being moved.
-            new_ctx->white_state.short_castling_available = 0;
-        }
+    if (move->will_promote) {
+        return chess_move_with_promotion(chess_ctx, move->from, move->to, move->promotion_type);
     }
-    if (chess_ctx->white_state.long_castling_available) {
-        if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_WHITE) {
-            // King is being moved.
-            new_ctx->white_state.long_castling_available = 0;
-        } else if (piece->type == CHESS_PIECE_ROOK && piece->color == CHESS_COLOR_WHITE && move->from.x == 0 && move->from.y == 0) {
-            // Rook is being moved.
-            new_ctx->white_state.long_castling_available = 0;
-        }
+    if (type == CHESS_PIECE_KING && abs(move->to.x - move->from.x) == 2) {
+        return chess_move_special(move->from, move->to, CHESS_MOVE_FLAG_CASTLING);
     }
-    if (chess_ctx->black_state.short_castling_available) {
-        if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_BLACK) {
-            // King is being moved.
-            new_ctx->black_state.short_castling_available = 0;
-        } else if (piece->type == CHESS_PIECE_ROOK && piece->color == CHESS_COLOR_BLACK && move->from.x == 7 && move->from.y == 7) {
-            // Rook is being moved.
-            new_ctx->black_state.short_castling_available = 0;
-        }
+    if (type == CHESS_PIECE_PAWN && abs(move->to.y - move->from.y) == 2) {
+        return chess_move_special(move->from, move->to, CHESS_MOVE_FLAG_DOUBLE_PUSH);
     }
-    if (chess_ctx->black_state.long_castling_available) {
-        if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_BLACK) {
-            // King is being moved.
-            new_ctx->black_state.long_castling_available = 0;
-        } else if (piece->type == CHESS_PIECE_ROOK && piece->color == CHESS_COLOR_BLACK && move->from.x == 0 && move->from.y == 7) {
-            // Rook is being moved.
-            new_ctx->black_state.long_castling_available = 0;
-        }
-    }
-
-    // Update en passant
-    if (piece->type == CHESS_PIECE_PAWN && abs(move->to.y - move->from.y) == 2) {
-        new_ctx->en_passant_info.available = 1;
-        new_ctx->en_passant_info.target = piece->color == CHESS_COLOR_WHITE ? CHESS_POS(move->to.y - 1, move->to.x) : CHESS_POS(move->to.y + 1, move->to.x);
-        new_ctx->en_passant_info.pawn_position = move->to;
-    } else {
-        new_ctx->en_passant_info.available = 0;
-    }
-
-    if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_WHITE && move->from.x == 4 && move->from.y == 0 && move->to.x == 6 && move->to.y == 0) {
-        // Special case: white castles short
-        // We do not check if the rook is there... we trust the GUI.
-
-        // move the king
-        new_ctx->board[0][6] = *piece;
-        new_ctx->board[0][4] = empty_piece();
-
-        // move the rook
-        Chess_Piece* rook = &new_ctx->board[0][7];
-        new_ctx->board[0][5] = *rook;
-        new_ctx->board[0][7] = empty_piece();
-    } else if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_WHITE && move->from.x == 4 && move->from.y == 0 && move->to.x == 2 && move->to.y == 0) {
-        // Special case: white castles long
-        // We do not check if the rook is there... we trust the GUI.
-
-        // move the king
-        new_ctx->board[0][2] = *piece;
-        new_ctx->board[0][4] = empty_piece();
-
-        // move the rook
-        Chess_Piece* rook = &new_ctx->board[0][0];
-        new_ctx->board[0][3] = *rook;
-        new_ctx->board[0][0] = empty_piece();
-    } else if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_BLACK && move->from.x == 4 && move->from.y == 7 && move->to.x == 6 && move->to.y == 7) {
-        // Special case: black castles short
-        // We do not check if the rook is there... we trust the GUI.
-
-        // move the king
-        new_ctx->board[7][6] = *piece;
-        new_ctx->board[7][4] = empty_piece();
-
-        // move the rook
-        Chess_Piece* rook = &new_ctx->board[7][7];
-        new_ctx->board[7][5] = *rook;
-        new_ctx->board[7][7] = empty_piece();
-    } else if (piece->type == CHESS_PIECE_KING && piece->color == CHESS_COLOR_BLACK && move->from.x == 4 && move->from.y == 7 && move->to.x == 2 && move->to.y == 7) {
-        // Special case: black castles long
-        // We do not check if the rook is there... we trust the GUI.
-
-        // move the king
-        new_ctx->board[7][2] = *piece;
-        new_ctx->board[7][4] = empty_piece();
-
-        // move the rook
-        Chess_Piece* rook = &new_ctx->board[7][0];
-        new_ctx->board[7][3] = *rook;
-        new_ctx->board[7][0] = empty_piece();
-    } else if (piece->type == CHESS_PIECE_PAWN && move->to.x != move->from.x && new_ctx->board[move->to.y][move->to.x].type == CHESS_PIECE_EMPTY) {
-        // if we are moving a pawn diagonally to a square that contains no piece, we certainly have an en passant case.
-        Chess_Board_Position eaten_pawn_position = piece->color == CHESS_COLOR_WHITE ? CHESS_POS(move->to.y - 1, move->to.x) : CHESS_POS(move->to.y + 1, move->to.x);
-        assert(new_ctx->board[eaten_pawn_position.y][eaten_pawn_position.x].type == CHESS_PIECE_PAWN && new_ctx->board[eaten_pawn_position.y][eaten_pawn_position.x].color != piece->color);
-        new_ctx->board[eaten_pawn_position.y][eaten_pawn_position.x] = empty_piece();
-        new_ctx->board[move->to.y][move->to.x] = *piece;
-        new_ctx->board[move->from.y][move->from.x] = empty_piece();
-    } else {
-        new_ctx->board[move->to.y][move->to.x] = *piece;
-        new_ctx->board[move->from.y][move->from.x] = empty_piece();
-
-        if (move->will_promote) {
-            new_ctx->board[move->to.y][move->to.x].type = move->promotion_type;
-        }
+    if (type == CHESS_PIECE_PAWN && move->to.x != move->from.x && chess_ctx->board[CHESS_SQUARE(move->to.y, move->to.x)] == CHESS_PIECE_EMPTY) {
+        return chess_move_special(move->from, move->to, CHESS_MOVE_FLAG_EN_PASSANT);
     }
+    return chess_move_no_promotion(chess_ctx, move->from, move->to);
+}
 
-    new_ctx->current_turn = new_ctx->current_turn == CHESS_COLOR_WHITE ? CHESS_COLOR_BLACK : CHESS_COLOR_WHITE;
-    chess_update_context(new_ctx);
+static Chess_Board_Position square_to_position(int square) {
+    return CHESS_POS(square / CHESS_BOARD_WIDTH, square % CHESS_BOARD_WIDTH);
 }
 
-static int chess_position_is_within_bounds(Chess_Board_Position position) {
-    if (position.x >= 0 && position.x < CHESS_BOARD_WIDTH) {
-        if (position.y >= 0 && position.y < CHESS_BOARD_HEIGHT) {
-            return 1;
-        }
-    }
+Chess_Piece chess_piece_get(const Chess_Context* chess_ctx, Chess_Board_Position position) {
+    Chess_Packed_Piece piece = chess_ctx->board[CHESS_SQUARE(position.y, position.x)];
+    return (Chess_Piece){CHESS_PIECE_TYPE(piece), CHESS_PIECE_COLOR(piece)};
+}
 
-    return 0;
+void chess_piece_set(Chess_Context* chess_ctx, Chess_Board_Position position, Chess_Piece piece) {
+    chess_ctx->board[CHESS_SQUARE(position.y, position.x)] = piece.type == CHESS_PIECE_EMPTY ? CHESS_PIECE_EMPTY : CHESS_PIECE_PACK(piece.type, piece.color);
 }
 
-static int is_king_exposed_if_piece_is_moved(const Chess_Context* chess_ctx, const Chess_Move* move) {
-    Chess_Context ctx_without_piece;
-    chess_move_piece(chess_ctx, &ctx_without_piece, move);
-    const Chess_Piece* piece = &ctx_without_piece.board[move->to.y][move->to.x];
-    return piece->color == CHESS_COLOR_WHITE ? ctx_without_piece.white_state.is_king_under_attack : ctx_without_piece.black_state.is_king_under_attack;
+Chess_Board_Position chess_king_position_get(const Chess_Context* chess_ctx, Chess_Color color) {
+    return square_to_position(chess_ctx->king_square[CHESS_COLOR_INDEX(color)]);
 }
 
-static void chess_board_reset(Chess_Context* chess_ctx) {
-    memset(chess_ctx->board, 0, CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH * sizeof(Chess_Piece));
-
-    // White Side
-    chess_ctx->board[0][0].type = CHESS_PIECE_ROOK;
-    chess_ctx->board[0][0].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[0][1].type = CHESS_PIECE_KNIGHT;
-    chess_ctx->board[0][1].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[0][2].type = CHESS_PIECE_BISHOP;
-    chess_ctx->board[0][2].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[0][3].type = CHESS_PIECE_QUEEN;
-    chess_ctx->board[0][3].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[0][4].type = CHESS_PIECE_KING;
-    chess_ctx->board[0][4].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[0][5].type = CHESS_PIECE_BISHOP;
-    chess_ctx->board[0][5].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[0][6].type = CHESS_PIECE_KNIGHT;
-    chess_ctx->board[0][6].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[0][7].type = CHESS_PIECE_ROOK;
-    chess_ctx->board[0][7].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[1][0].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[1][0].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[1][1].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[1][1].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[1][2].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[1][2].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[1][3].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[1][3].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[1][4].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[1][4].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[1][5].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[1][5].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[1][6].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[1][6].color = CHESS_COLOR_WHITE;
-    chess_ctx->board[1][7].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[1][7].color = CHESS_COLOR_WHITE;
-
-    // Black Side
-    chess_ctx->board[7][0].type = CHESS_PIECE_ROOK;
-    chess_ctx->board[7][0].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[7][1].type = CHESS_PIECE_KNIGHT;
-    chess_ctx->board[7][1].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[7][2].type = CHESS_PIECE_BISHOP;
-    chess_ctx->board[7][2].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[7][3].type = CHESS_PIECE_QUEEN;
-    chess_ctx->board[7][3].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[7][4].type = CHESS_PIECE_KING;
-    chess_ctx->board[7][4].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[7][5].type = CHESS_PIECE_BISHOP;
-    chess_ctx->board[7][5].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[7][6].type = CHESS_PIECE_KNIGHT;
-    chess_ctx->board[7][6].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[7][7].type = CHESS_PIECE_ROOK;
-    chess_ctx->board[7][7].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[6][0].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[6][0].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[6][1].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[6][1].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[6][2].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[6][2].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[6][3].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[6][3].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[6][4].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[6][4].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[6][5].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[6][5].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[6][6].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[6][6].color = CHESS_COLOR_BLACK;
-    chess_ctx->board[6][7].type = CHESS_PIECE_PAWN;
-    chess_ctx->board[6][7].color = CHESS_COLOR_BLACK;
+int chess_is_king_under_attack(const Chess_Context* chess_ctx, Chess_Color color) {
+    return (chess_ctx->king_under_attack >> CHESS_COLOR_INDEX(color)) & 1;
 }
 
+int chess_in_check(const Chess_Context* chess_ctx) {
+    return chess_is_king_under_attack(chess_ctx, chess_ctx->current_turn);
+}
 
-void chess_context_from_position_input(Chess_Context* chess_ctx, int argc, const char** argv) {
-    if (strcmp(argv[0], "moves")) {
-        log_debug("Error: moves expected");
-        return;
+int chess_en_passant_target_get(const Chess_Context* chess_ctx, Chess_Board_Position* target) {
+    if (chess_ctx->en_passant_square == CHESS_SQUARE_NONE) {
+        return 0;
     }
+    *target = square_to_position(chess_ctx->en_passant_square);
+    return 1;
+}
 
-    chess_board_reset(chess_ctx);
-
-    chess_ctx->white_state.long_castling_available = 1;
-    chess_ctx->white_state.short_castling_available = 1;
-    chess_ctx->black_state.long_castling_available = 1;
-    chess_ctx->black_state.short_castling_available = 1;
-    chess_ctx->en_passant_info.available = 0;
+// Returns the castling rights whose king and rook are still on their starting squares.
+uint8_t chess_castling_rights_supported(const Chess_Context* chess_ctx) {
+    static const struct {
+        uint8_t right;
+        uint8_t king_square;
+        uint8_t rook_square;
+        Chess_Color color;
+    } castlings[] = {
+        { CHESS_CASTLING_WHITE_SHORT, CHESS_SQUARE(0, 4), CHESS_SQUARE(0, 7), CHESS_COLOR_WHITE },
+        { CHESS_CASTLING_WHITE_LONG, CHESS_SQUARE(0, 4), CHESS_SQUARE(0, 0), CHESS_COLOR_WHITE },
+        { CHESS_CASTLING_BLACK_SHORT, CHESS_SQUARE(7, 4), CHESS_SQUARE(7, 7), CHESS_COLOR_BLACK },
+        { CHESS_CASTLING_BLACK_LONG, CHESS_SQUARE(7, 4), CHESS_SQUARE(7, 0), CHESS_COLOR_BLACK },
+    };
+    uint8_t rights = 0;
+
+    for (int i = 0; i < 4; ++i) {
+        if (chess_ctx->board[castlings[i].king_square] == CHESS_PIECE_PACK(CHESS_PIECE_KING, castlings[i].color) &&
+            chess_ctx->board[castlings[i].rook_square] == CHESS_PIECE_PACK(CHESS_PIECE_ROOK, castlings[i].color)) {
+            rights |= castlings[i].right;
+        }
+    }
+    return rights;
+}
 
-    Chess_Move move;
-    for (int i = 1; i < argc; ++i) {
-        assert(strlen(argv[i]) == 4 || strlen(argv[i]) == 5);
-        io_uci_notation_to_move(argv[i], &move);
-        chess_move_piece(chess_ctx, chess_ctx, &move);
+// The en passant square must be on the third rank from the opponent's side, with the pawn that just moved in
+// front of it and both squares that pawn passed over empty.
+int chess_en_passant_is_valid(const Chess_Context* chess_ctx) {
+    int square = chess_ctx->en_passant_square;
+    if (square == CHESS_SQUARE_NONE) {
+        return 1;
     }
 
-    if ((argc - 1) % 2 == 0) {
-        chess_ctx->current_turn = CHESS_COLOR_WHITE;
-    } else {
-        chess_ctx->current_turn = CHESS_COLOR_BLACK;
+    Chess_Color opponent = CHESS_COLOR_OPPONENT(chess_ctx->current_turn);
+    int forward = chess_ctx->current_turn == CHESS_COLOR_WHITE ? CHESS_BOARD_WIDTH : -CHESS_BOARD_WIDTH;
+    int target_rank = chess_ctx->current_turn == CHESS_COLOR_WHITE ? 5 : 2;
+    if (square >= CHESS_BOARD_WIDTH * CHESS_BOARD_HEIGHT || square / CHESS_BOARD_WIDTH != target_rank) {
+        return 0;
     }
+    return chess_ctx->board[square - forward] == CHESS_PIECE_PACK(CHESS_PIECE_PAWN, opponent) &&
+           chess_ctx->board[square] == CHESS_PIECE_EMPTY &&
+           chess_ctx->board[square + forward] == CHESS_PIECE_EMPTY;
 }
 
-static int available_move_add_to_list_if_valid(const Chess_Context* chess_ctx,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int available_moves_num,
-    int need_to_check_if_king_is_exposed, const Chess_Move* move) {
-    if (need_to_check_if_king_is_exposed) {
-        if (!is_king_exposed_if_piece_is_moved(chess_ctx, move)) {
-            available_moves[available_moves_num++] = *move;
+static void king_squares_fill(Chess_Context* chess_ctx) {
+    int found_white_king = 0, found_black_king = 0;
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        Chess_Packed_Piece piece = chess_ctx->board[square];
+        if (CHESS_PIECE_TYPE(piece) == CHESS_PIECE_KING) {
+            chess_ctx->king_square[CHESS_COLOR_INDEX(CHESS_PIECE_COLOR(piece))] = (uint8_t)square;
+            if (CHESS_PIECE_COLOR(piece) == CHESS_COLOR_WHITE) {
+                found_white_king = 1;
+            } else {
+                found_black_king = 1;
+            }
         }
-    } else {
-        available_moves[available_moves_num++] = *move;
     }
-    return available_moves_num;
+    assert(found_white_king);
+    assert(found_black_king);
 }
 
-static int rook_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int king_can_be_exposed) {
-    const Chess_Piece* current_piece = &chess_ctx->board[position.y][position.x];
-    int available_moves_num = 0;
-    assert(current_piece->type == CHESS_PIECE_ROOK || current_piece->type == CHESS_PIECE_QUEEN);
-    assert(current_piece->color != CHESS_COLOR_COLORLESS);
-
-    int need_to_check_if_king_is_exposed = !king_can_be_exposed;
+// Looks outwards from the square for each kind of attacker, instead of generating the attackers' moves.
+static int is_square_being_attacked(const Chess_Context* chess_ctx, Chess_Board_Position position, Chess_Color by_color) {
+    const Chess_Packed_Piece* board = chess_ctx->board;
+    int square = CHESS_SQUARE(position.y, position.x);
 
-    Chess_Move candidate_move;
-
-    // Left
-    for (int x = position.x - 1; x >= 0; --x) {
-        candidate_move = chess_move_no_promotion(position, CHESS_POS(position.y, x));
-        if (chess_ctx->board[position.y][x].type == CHESS_PIECE_EMPTY) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        } else if (chess_ctx->board[position.y][x].color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-            break;
-        } else {
-            break;
+    // Pawns capture forwards, so an attacking pawn stands where a pawn of the other side would attack.
+    Chess_Bitboard pawns = tables_pawn_attacks[CHESS_COLOR_INDEX(CHESS_COLOR_OPPONENT(by_color))][square];
+    for (; pawns; pawns &= pawns - 1) {
+        if (board[__builtin_ctzll(pawns)] == CHESS_PIECE_PACK(CHESS_PIECE_PAWN, by_color)) {
+            return 1;
         }
     }
-
-    // Right
-    for (int x = position.x + 1; x < CHESS_BOARD_WIDTH; ++x) {
-        candidate_move = chess_move_no_promotion(position, CHESS_POS(position.y, x));
-        if (chess_ctx->board[position.y][x].type == CHESS_PIECE_EMPTY) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        } else if (chess_ctx->board[position.y][x].color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-            break;
-        } else {
-            break;
+    for (Chess_Bitboard knights = tables_knight_attacks[square]; knights; knights &= knights - 1) {
+        if (board[__builtin_ctzll(knights)] == CHESS_PIECE_PACK(CHESS_PIECE_KNIGHT, by_color)) {
+            return 1;
         }
     }
-
-    // Bottom
-    for (int y = position.y - 1; y >= 0; --y) {
-        candidate_move = chess_move_no_promotion(position, CHESS_POS(y, position.x));
-        if (chess_ctx->board[y][position.x].type == CHESS_PIECE_EMPTY) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        } else if (chess_ctx->board[y][position.x].color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-            break;
-        } else {
-            break;
+    for (Chess_Bitboard kings = tables_king_attacks[square]; kings; kings &= kings - 1) {
+        if (board[__builtin_ctzll(kings)] == CHESS_PIECE_PACK(CHESS_PIECE_KING, by_color)) {
+            return 1;
         }
     }
 
-    // Top
-    for (int y = position.y + 1; y < CHESS_BOARD_HEIGHT; ++y) {
-        candidate_move = chess_move_no_promotion(position, CHESS_POS(y, position.x));
-        if (chess_ctx->board[y][position.x].type == CHESS_PIECE_EMPTY) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        } else if (chess_ctx->board[y][position.x].color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-            break;
-        } else {
+    // Sliders: the first piece met along each line decides.
+    for (int direction = 0; direction < TABLES_DIRECTIONS; ++direction) {
+        Chess_Piece_Type slider = direction % 2 ? CHESS_PIECE_BISHOP : CHESS_PIECE_ROOK;
+        for (Chess_Bitboard ray = tables_rays[direction][square]; ray; ) {
+            int ray_square = TABLES_RAY_NEAREST(ray, direction);
+            Chess_Packed_Piece piece = board[ray_square];
+            ray &= ~(1ULL << ray_square);
+            if (piece == CHESS_PIECE_EMPTY) {
+                continue;
+            }
+            if (piece == CHESS_PIECE_PACK(slider, by_color) || piece == CHESS_PIECE_PACK(CHESS_PIECE_QUEEN, by_color)) {
+                return 1;
+            }
             break;
         }
     }
 
-    return available_moves_num;
+    return 0;
 }
 
-static int bishop_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int king_can_be_exposed) {
-    const Chess_Piece* current_piece = &chess_ctx->board[position.y][position.x];
-    int available_moves_num = 0;
-    assert(current_piece->type == CHESS_PIECE_BISHOP || current_piece->type == CHESS_PIECE_QUEEN);
-    assert(current_piece->color != CHESS_COLOR_COLORLESS);
+// Zobrist keys are derived on the fly from their index with splitmix64, so there is no table to initialize.
+#define ZOBRIST_SIDE_INDEX (2 * 7 * CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH)
+#define ZOBRIST_CASTLING_INDEX (ZOBRIST_SIDE_INDEX + 1)
+#define ZOBRIST_EN_PASSANT_INDEX (ZOBRIST_CASTLING_INDEX + 4)
 
-    int need_to_check_if_king_is_exposed = !king_can_be_exposed;
+static uint64_t zobrist_key(uint64_t index) {
+    uint64_t z = (index + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
 
-    Chess_Move candidate_move;
-
-    // Top-Right
-    for (int x = position.x + 1, y = position.y + 1; x < CHESS_BOARD_HEIGHT && y < CHESS_BOARD_HEIGHT; ++x, ++y) {
-        candidate_move = chess_move_no_promotion(position, CHESS_POS(y, x));
-        if (chess_ctx->board[y][x].type == CHESS_PIECE_EMPTY) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        } else if (chess_ctx->board[y][x].color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-            break;
-        } else {
-            break;
-        }
+uint64_t chess_hash_piece_key(Chess_Packed_Piece piece, int square) {
+    int color_index = CHESS_COLOR_INDEX(CHESS_PIECE_COLOR(piece));
+    return zobrist_key((color_index * 7 + CHESS_PIECE_TYPE(piece)) * CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH + square);
+}
+
+// Everything in the hash except the pieces: side to move, castling rights and en passant file.
+uint64_t chess_hash_state_key(const Chess_Context* chess_ctx) {
+    uint64_t hash = 0;
+    if (chess_ctx->current_turn == CHESS_COLOR_BLACK) hash ^= zobrist_key(ZOBRIST_SIDE_INDEX);
+    for (int i = 0; i < 4; ++i) {
+        if (chess_ctx->castling_rights & (1 << i)) hash ^= zobrist_key(ZOBRIST_CASTLING_INDEX + i);
     }
+    if (chess_ctx->en_passant_square != CHESS_SQUARE_NONE) hash ^= zobrist_key(ZOBRIST_EN_PASSANT_INDEX + chess_ctx->en_passant_square % CHESS_BOARD_WIDTH);
+    return hash;
+}
 
-    // Top-Left
-    for (int x = position.x - 1, y = position.y + 1; x >= 0 && y < CHESS_BOARD_HEIGHT; --x, ++y) {
-        candidate_move = chess_move_no_promotion(position, CHESS_POS(y, x));
-        if (chess_ctx->board[y][x].type == CHESS_PIECE_EMPTY) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        } else if (chess_ctx->board[y][x].color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-            break;
-        } else {
-            break;
+uint64_t chess_hash_compute(const Chess_Context* chess_ctx) {
+    uint64_t hash = 0;
+
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        Chess_Packed_Piece piece = chess_ctx->board[square];
+        if (piece != CHESS_PIECE_EMPTY) {
+            hash ^= chess_hash_piece_key(piece, square);
         }
     }
 
-    // Bottom-Right
-    for (int x = position.x + 1, y = position.y - 1; x < CHESS_BOARD_HEIGHT && y >= 0; ++x, --y) {
-        candidate_move = chess_move_no_promotion(position, CHESS_POS(y, x));
-        if (chess_ctx->board[y][x].type == CHESS_PIECE_EMPTY) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        } else if (chess_ctx->board[y][x].color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-            break;
-        } else {
-            break;
+    return hash ^ chess_hash_state_key(chess_ctx);
+}
+
+Chess_Bitboard chess_pieces_get(const Chess_Context* chess_ctx, Chess_Color color, Chess_Piece_Type type) {
+    Chess_Bitboard bitboard = 0;
+    Chess_Packed_Piece wanted = CHESS_PIECE_PACK(type, color);
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        if (chess_ctx->board[square] == wanted) {
+            bitboard |= 1ULL << square;
         }
     }
+    return bitboard;
+}
 
-    // Bottom-Left
-    for (int x = position.x - 1, y = position.y - 1; x >= 0 && y >= 0; --x, --y) {
-        candidate_move = chess_move_no_promotion(position, CHESS_POS(y, x));
-        if (chess_ctx->board[y][x].type == CHESS_PIECE_EMPTY) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        } else if (chess_ctx->board[y][x].color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-            break;
-        } else {
-            break;
+Chess_Bitboard chess_color_pieces_get(const Chess_Context* chess_ctx, Chess_Color color) {
+    Chess_Bitboard bitboard = 0;
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        Chess_Packed_Piece piece = chess_ctx->board[square];
+        if (piece != CHESS_PIECE_EMPTY && CHESS_PIECE_COLOR(piece) == color) {
+            bitboard |= 1ULL << square;
         }
     }
+    return bitboard;
+}
 
-    return available_moves_num;
+// Needs the king squares to be up to date.
+void chess_check_flags_update(Chess_Context* chess_ctx) {
+    chess_ctx->king_under_attack = 0;
+    if (is_square_being_attacked(chess_ctx, chess_king_position_get(chess_ctx, CHESS_COLOR_WHITE), CHESS_COLOR_BLACK)) {
+        chess_ctx->king_under_attack |= 1 << CHESS_COLOR_INDEX(CHESS_COLOR_WHITE);
+    }
+    if (is_square_being_attacked(chess_ctx, chess_king_position_get(chess_ctx, CHESS_COLOR_BLACK), CHESS_COLOR_WHITE)) {
+        chess_ctx->king_under_attack |= 1 << CHESS_COLOR_INDEX(CHESS_COLOR_BLACK);
+    }
 }
 
-static int knight_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int king_can_be_exposed) {
-    const Chess_Piece* current_piece = &chess_ctx->board[position.y][position.x];
-    int available_moves_num = 0;
-    assert(current_piece->type == CHESS_PIECE_KNIGHT);
-    assert(current_piece->color != CHESS_COLOR_COLORLESS);
-    
-    int need_to_check_if_king_is_exposed = !king_can_be_exposed;
+void chess_update_context(Chess_Context* chess_ctx) {
+    chess_ctx->hash = chess_hash_compute(chess_ctx);
+    king_squares_fill(chess_ctx);
+    chess_check_flags_update(chess_ctx);
+}
 
-    Chess_Board_Position candidate_position;
-    Chess_Move candidate_move;
+// Castling rights lost when a move starts or ends on the square. Checking the destination too means a captured rook
+// takes its side's right with it.
+static const uint8_t castling_rights_lost[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH] = {
+    [CHESS_SQUARE(0, 0)] = CHESS_CASTLING_WHITE_LONG,
+    [CHESS_SQUARE(0, 4)] = CHESS_CASTLING_WHITE_SHORT | CHESS_CASTLING_WHITE_LONG,
+    [CHESS_SQUARE(0, 7)] = CHESS_CASTLING_WHITE_SHORT,
+    [CHESS_SQUARE(7, 0)] = CHESS_CASTLING_BLACK_LONG,
+    [CHESS_SQUARE(7, 4)] = CHESS_CASTLING_BLACK_SHORT | CHESS_CASTLING_BLACK_LONG,
+    [CHESS_SQUARE(7, 7)] = CHESS_CASTLING_BLACK_SHORT,
+};
 
-    candidate_position = CHESS_POS(position.y + 2, position.x + 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        }
+// Note: this function MUST support chess_ctx == new_ctx !
+void chess_move_piece(const Chess_Context* chess_ctx, Chess_Context* new_ctx, const Chess_Move* move) {
+    *new_ctx = *chess_ctx;
+    int from = CHESS_SQUARE(move->from.y, move->from.x);
+    int to = CHESS_SQUARE(move->to.y, move->to.x);
+    Chess_Packed_Piece piece = new_ctx->board[from];
+    Chess_Piece_Type type = CHESS_PIECE_TYPE(piece);
+    Chess_Color color = CHESS_PIECE_COLOR(piece);
+
+    // Update castles
+    new_ctx->castling_rights &= ~(castling_rights_lost[from] | castling_rights_lost[to]);
+
+    // Update the fifty-move rule counter: pawn moves and captures reset it.
+    if (type == CHESS_PIECE_PAWN || new_ctx->board[to] != CHESS_PIECE_EMPTY) {
+        new_ctx->halfmove_clock = 0;
+    } else if (new_ctx->halfmove_clock < UINT8_MAX) {
+        ++new_ctx->halfmove_clock;
+    }
+    if (color == CHESS_COLOR_BLACK) {
+        ++new_ctx->fullmove_number;
     }
 
-    candidate_position = CHESS_POS(position.y + 2, position.x - 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        }
+    // Update en passant
+    if (type == CHESS_PIECE_PAWN && abs(move->to.y - move->from.y) == 2) {
+        new_ctx->en_passant_square = (uint8_t)(color == CHESS_COLOR_WHITE ? to - CHESS_BOARD_WIDTH : to + CHESS_BOARD_WIDTH);
+    } else {
+        new_ctx->en_passant_square = CHESS_SQUARE_NONE;
     }
 
-    candidate_position = CHESS_POS(position.y + 1, position.x + 2);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        }
+    if (type == CHESS_PIECE_KING && abs(move->to.x - move->from.x) == 2) {
+        // Special case: castling, the rook jumps to the other side of the king.
+        // We do not check if the rook is there... we trust the GUI.
+        int rook_from = move->to.x == 6 ? to + 1 : to - 2;
+        int rook_to = move->to.x == 6 ? to - 1 : to + 1;
+        new_ctx->board[rook_to] = new_ctx->board[rook_from];
+        new_ctx->board[rook_from] = CHESS_PIECE_EMPTY;
+    } else if (type == CHESS_PIECE_PAWN && move->to.x != move->from.x && new_ctx->board[to] == CHESS_PIECE_EMPTY) {
+        // if we are moving a pawn diagonally to a square that contains no piece, we certainly have an en passant case.
+        int eaten_pawn_square = color == CHESS_COLOR_WHITE ? to - CHESS_BOARD_WIDTH : to + CHESS_BOARD_WIDTH;
+        assert(new_ctx->board[eaten_pawn_square] == CHESS_PIECE_PACK(CHESS_PIECE_PAWN, CHESS_COLOR_OPPONENT(color)));
+        new_ctx->board[eaten_pawn_square] = CHESS_PIECE_EMPTY;
     }
 
-    candidate_position = CHESS_POS(position.y + 1, position.x - 2);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
+    new_ctx->board[to] = move->will_promote ? CHESS_PIECE_PACK(move->promotion_type, color) : piece;
+    new_ctx->board[from] = CHESS_PIECE_EMPTY;
+
+    new_ctx->current_turn = CHESS_COLOR_OPPONENT(new_ctx->current_turn);
+    chess_update_context(new_ctx);
+}
+
+void chess_make_move(const Chess_Context* chess_ctx, Chess_Context* new_ctx, Chess_Packed_Move move) {
+    Chess_Move unpacked_move;
+    chess_move_unpack(move, &unpacked_move);
+    chess_move_piece(chess_ctx, new_ctx, &unpacked_move);
+}
+
+// Whether the squares strictly between two aligned squares are empty, with vacated counted as empty.
+static int ray_is_clear(const Chess_Packed_Piece* board, int from, int to, int vacated) {
+    for (Chess_Bitboard between = tables_between[from][to]; between; between &= between - 1) {
+        int square = __builtin_ctzll(between);
+        if (square != vacated && board[square] != CHESS_PIECE_EMPTY) {
+            return 0;
         }
     }
+    return 1;
+}
 
-    candidate_position = CHESS_POS(position.y - 1, position.x + 2);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        }
+static int piece_attacks_square(const Chess_Packed_Piece* board, Chess_Piece_Type type, Chess_Color color, int from,
+    int target, int vacated) {
+    // Squares on a common rank or file share a straight line, others on a line share a diagonal.
+    int aligned = tables_line[from][target] != 0;
+    int straight = aligned && (from / CHESS_BOARD_WIDTH == target / CHESS_BOARD_WIDTH || from % CHESS_BOARD_WIDTH == target % CHESS_BOARD_WIDTH);
+
+    switch (type) {
+    case CHESS_PIECE_PAWN:
+        return tables_pawn_attacks[CHESS_COLOR_INDEX(color)][from] >> target & 1;
+    case CHESS_PIECE_KNIGHT:
+        return tables_knight_attacks[from] >> target & 1;
+    case CHESS_PIECE_KING:
+        return tables_distance[from][target] == 1;
+    case CHESS_PIECE_BISHOP:
+        return aligned && !straight && ray_is_clear(board, from, target, vacated);
+    case CHESS_PIECE_ROOK:
+        return straight && ray_is_clear(board, from, target, vacated);
+    case CHESS_PIECE_QUEEN:
+        return aligned && ray_is_clear(board, from, target, vacated);
+    default:
+        return 0;
     }
+}
 
-    candidate_position = CHESS_POS(position.y - 1, position.x - 2);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        }
+// Answers from the board alone: either the moved piece attacks the king from its new square, or it leaves a line
+// between the king and a slider of its side. Castling and en passant move a second piece and are played out.
+int chess_move_gives_check(const Chess_Context* chess_ctx, Chess_Packed_Move move) {
+    const Chess_Packed_Piece* board = chess_ctx->board;
+    Chess_Color color = chess_ctx->current_turn;
+    Chess_Color opponent = CHESS_COLOR_OPPONENT(color);
+    int flags = CHESS_MOVE_FLAGS(move);
+
+    if (flags == CHESS_MOVE_FLAG_CASTLING || flags == CHESS_MOVE_FLAG_EN_PASSANT) {
+        Chess_Context new_ctx;
+        chess_make_move(chess_ctx, &new_ctx, move);
+        return chess_is_king_under_attack(&new_ctx, opponent);
     }
 
-    candidate_position = CHESS_POS(position.y - 2, position.x + 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
-        }
+    int from = CHESS_MOVE_FROM(move), to = CHESS_MOVE_TO(move);
+    int king = chess_ctx->king_square[CHESS_COLOR_INDEX(opponent)];
+    Chess_Piece_Type type = CHESS_MOVE_IS_PROMOTION(move) ? chess_move_promotion_type(move) : CHESS_PIECE_TYPE(board[from]);
+    if (piece_attacks_square(board, type, color, to, king, from)) {
+        return 1;
     }
 
-    candidate_position = CHESS_POS(position.y - 2, position.x - 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
+    // The line from the king through the vacated square, beyond it. A piece moving along that line still blocks it.
+    int direction = 0;
+    for (; direction < TABLES_DIRECTIONS && !(tables_rays[direction][king] >> from & 1); ++direction);
+    if (direction == TABLES_DIRECTIONS || (tables_line[king][from] >> to & 1) ||
+        !ray_is_clear(board, king, from, CHESS_SQUARE_NONE)) {
+        return 0;
+    }
+    Chess_Piece_Type slider = direction % 2 ? CHESS_PIECE_BISHOP : CHESS_PIECE_ROOK;
+    for (Chess_Bitboard ray = tables_rays[direction][from]; ray; ) {
+        int square = TABLES_RAY_NEAREST(ray, direction);
+        Chess_Packed_Piece piece = board[square];
+        ray &= ~(1ULL << square);
+        if (piece == CHESS_PIECE_EMPTY) {
+            continue;
         }
+        return piece == CHESS_PIECE_PACK(slider, color) || piece == CHESS_PIECE_PACK(CHESS_PIECE_QUEEN, color);
     }
-
-    return available_moves_num;
+    return 0;
 }
 
-static int queen_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int king_can_be_exposed) {
-    const Chess_Piece* current_piece = &chess_ctx->board[position.y][position.x];
-    int available_moves_num = 0;
-    assert(current_piece->type == CHESS_PIECE_QUEEN);
-    assert(current_piece->color != CHESS_COLOR_COLORLESS);
-
-    available_moves_num += rook_available_moves_get(chess_ctx, position, available_moves, king_can_be_exposed);
-    available_moves_num += bishop_available_moves_get(chess_ctx, position, available_moves + available_moves_num, king_can_be_exposed);
-    return available_moves_num;
+static int is_king_exposed_if_piece_is_moved(const Chess_Context* chess_ctx, Chess_Packed_Move move) {
+    Chess_Context ctx_without_piece;
+    chess_make_move(chess_ctx, &ctx_without_piece, move);
+    Chess_Color color = CHESS_PIECE_COLOR(chess_ctx->board[CHESS_MOVE_FROM(move)]);
+    return chess_is_king_under_attack(&ctx_without_piece, color);
 }
 
-static int king_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int king_can_be_exposed, int discard_non_attacking_moves) {
-    const Chess_Piece* current_piece = &chess_ctx->board[position.y][position.x];
-    int available_moves_num = 0;
-    assert(current_piece->type == CHESS_PIECE_KING);
-    assert(current_piece->color != CHESS_COLOR_COLORLESS);
+static void chess_board_reset(Chess_Context* chess_ctx) {
+    static const Chess_Piece_Type back_rank[CHESS_BOARD_WIDTH] = {
+        CHESS_PIECE_ROOK, CHESS_PIECE_KNIGHT, CHESS_PIECE_BISHOP, CHESS_PIECE_QUEEN,
+        CHESS_PIECE_KING, CHESS_PIECE_BISHOP, CHESS_PIECE_KNIGHT, CHESS_PIECE_ROOK
+    };
 
-    Chess_Move candidate_move;
-    Chess_Board_Position candidate_position;
+    memset(chess_ctx->board, CHESS_PIECE_EMPTY, sizeof(chess_ctx->board));
 
-    candidate_position = CHESS_POS(position.y + 1, position.x + 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            if (king_can_be_exposed || !is_king_exposed_if_piece_is_moved(chess_ctx, &candidate_move)) {
-                available_moves[available_moves_num++] = candidate_move;
-            }
-        }
+    for (int x = 0; x < CHESS_BOARD_WIDTH; ++x) {
+        // White Side
+        chess_ctx->board[CHESS_SQUARE(0, x)] = CHESS_PIECE_PACK(back_rank[x], CHESS_COLOR_WHITE);
+        chess_ctx->board[CHESS_SQUARE(1, x)] = CHESS_PIECE_PACK(CHESS_PIECE_PAWN, CHESS_COLOR_WHITE);
+
+        // Black Side
+        chess_ctx->board[CHESS_SQUARE(7, x)] = CHESS_PIECE_PACK(back_rank[x], CHESS_COLOR_BLACK);
+        chess_ctx->board[CHESS_SQUARE(6, x)] = CHESS_PIECE_PACK(CHESS_PIECE_PAWN, CHESS_COLOR_BLACK);
     }
+}
 
-    candidate_position = CHESS_POS(position.y + 1, position.x);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            if (king_can_be_exposed || !is_king_exposed_if_piece_is_moved(chess_ctx, &candidate_move)) {
-                available_moves[available_moves_num++] = candidate_move;
-            }
-        }
+
+void chess_context_from_position_input(Chess_Context* chess_ctx, int argc, const char** argv) {
+    if (argc > 0 && strcmp(argv[0], "moves")) {
+        log_debug("Error: moves expected");
+        return;
     }
 
-    candidate_position = CHESS_POS(position.y + 1, position.x - 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            if (king_can_be_exposed || !is_king_exposed_if_piece_is_moved(chess_ctx, &candidate_move)) {
-                available_moves[available_moves_num++] = candidate_move;
-            }
-        }
+    chess_board_reset(chess_ctx);
+
+    chess_ctx->castling_rights = CHESS_CASTLING_WHITE_SHORT | CHESS_CASTLING_WHITE_LONG | CHESS_CASTLING_BLACK_SHORT | CHESS_CASTLING_BLACK_LONG;
+    chess_ctx->en_passant_square = CHESS_SQUARE_NONE;
+    chess_ctx->halfmove_clock = 0;
+    chess_ctx->fullmove_number = 1;
+    chess_ctx->current_turn = CHESS_COLOR_WHITE;
+    chess_update_context(chess_ctx);
+
+    Chess_Move move;
+    for (int i = 1; i < argc; ++i) {
+        assert(strlen(argv[i]) == 4 || strlen(argv[i]) == 5);
+        chess_uci_notation_to_move(argv[i], &move);
+        chess_move_piece(chess_ctx, chess_ctx, &move);
     }
+}
 
-    candidate_position = CHESS_POS(position.y, position.x + 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            if (king_can_be_exposed || !is_king_exposed_if_piece_is_moved(chess_ctx, &candidate_move)) {
-                available_moves[available_moves_num++] = candidate_move;
-            }
+static void available_move_add_to_list_if_valid(const Chess_Context* chess_ctx, Chess_Move_List* move_list,
+    int need_to_check_if_king_is_exposed, Chess_Packed_Move move) {
+    if (need_to_check_if_king_is_exposed) {
+        if (!is_king_exposed_if_piece_is_moved(chess_ctx, move)) {
+            move_list->moves[move_list->count++] = move;
         }
+    } else {
+        move_list->moves[move_list->count++] = move;
     }
+}
 
-    candidate_position = CHESS_POS(position.y, position.x - 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            if (king_can_be_exposed || !is_king_exposed_if_piece_is_moved(chess_ctx, &candidate_move)) {
-                available_moves[available_moves_num++] = candidate_move;
-            }
+// Adds the moves to the squares that are empty or hold an enemy piece.
+static void targets_moves_add(const Chess_Context* chess_ctx, Chess_Board_Position position, Chess_Move_List* move_list,
+    int need_to_check_if_king_is_exposed, Chess_Bitboard targets) {
+    Chess_Color color = CHESS_PIECE_COLOR(chess_ctx->board[CHESS_SQUARE(position.y, position.x)]);
+    for (; targets; targets &= targets - 1) {
+        int square = __builtin_ctzll(targets);
+        Chess_Packed_Piece target_piece = chess_ctx->board[square];
+        if (target_piece == CHESS_PIECE_EMPTY || CHESS_PIECE_COLOR(target_piece) != color) {
+            available_move_add_to_list_if_valid(chess_ctx, move_list, need_to_check_if_king_is_exposed,
+                chess_move_no_promotion(chess_ctx, position, square_to_position(square)));
         }
     }
+}
 
-    candidate_position = CHESS_POS(position.y - 1, position.x + 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            if (king_can_be_exposed || !is_king_exposed_if_piece_is_moved(chess_ctx, &candidate_move)) {
-                available_moves[available_moves_num++] = candidate_move;
-            }
+// Walks the ray from its nearest square, stopping at the first piece and taking it if it is an enemy.
+static void ray_moves_add(const Chess_Context* chess_ctx, Chess_Board_Position position, Chess_Move_List* move_list,
+    int need_to_check_if_king_is_exposed, int direction) {
+    int from = CHESS_SQUARE(position.y, position.x);
+    Chess_Color color = CHESS_PIECE_COLOR(chess_ctx->board[from]);
+    for (Chess_Bitboard ray = tables_rays[direction][from]; ray; ) {
+        int square = TABLES_RAY_NEAREST(ray, direction);
+        Chess_Packed_Piece target_piece = chess_ctx->board[square];
+        ray &= ~(1ULL << square);
+        if (target_piece != CHESS_PIECE_EMPTY && CHESS_PIECE_COLOR(target_piece) == color) {
+            break;
+        }
+        available_move_add_to_list_if_valid(chess_ctx, move_list, need_to_check_if_king_is_exposed,
+            chess_move_no_promotion(chess_ctx, position, square_to_position(square)));
+        if (target_piece != CHESS_PIECE_EMPTY) {
+            break;
         }
     }
+}
 
-    candidate_position = CHESS_POS(position.y - 1, position.x);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            if (king_can_be_exposed || !is_king_exposed_if_piece_is_moved(chess_ctx, &candidate_move)) {
-                available_moves[available_moves_num++] = candidate_move;
-            }
-        }
+static void rook_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move_List* move_list, int king_can_be_exposed) {
+    Chess_Packed_Piece current_piece = chess_ctx->board[CHESS_SQUARE(position.y, position.x)];
+    assert(CHESS_PIECE_TYPE(current_piece) == CHESS_PIECE_ROOK || CHESS_PIECE_TYPE(current_piece) == CHESS_PIECE_QUEEN);
+    assert(CHESS_PIECE_COLOR(current_piece) != CHESS_COLOR_COLORLESS);
+
+    // Left, right, bottom and top.
+    static const int directions[] = { 6, 2, 4, 0 };
+    for (int i = 0; i < 4; ++i) {
+        ray_moves_add(chess_ctx, position, move_list, !king_can_be_exposed, directions[i]);
     }
+}
 
-    candidate_position = CHESS_POS(position.y - 1, position.x - 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        candidate_move = chess_move_no_promotion(position, candidate_position);
-        if (candidate_piece->type == CHESS_PIECE_EMPTY || candidate_piece->color != current_piece->color) {
-            if (king_can_be_exposed || !is_king_exposed_if_piece_is_moved(chess_ctx, &candidate_move)) {
-                available_moves[available_moves_num++] = candidate_move;
-            }
-        }
+static void bishop_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move_List* move_list, int king_can_be_exposed) {
+    Chess_Packed_Piece current_piece = chess_ctx->board[CHESS_SQUARE(position.y, position.x)];
+    assert(CHESS_PIECE_TYPE(current_piece) == CHESS_PIECE_BISHOP || CHESS_PIECE_TYPE(current_piece) == CHESS_PIECE_QUEEN);
+    assert(CHESS_PIECE_COLOR(current_piece) != CHESS_COLOR_COLORLESS);
+
+    // Top-right, top-left, bottom-right and bottom-left.
+    static const int directions[] = { 1, 7, 3, 5 };
+    for (int i = 0; i < 4; ++i) {
+        ray_moves_add(chess_ctx, position, move_list, !king_can_be_exposed, directions[i]);
     }
+}
+
+static void knight_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move_List* move_list, int king_can_be_exposed) {
+    Chess_Packed_Piece current_piece = chess_ctx->board[CHESS_SQUARE(position.y, position.x)];
+    assert(CHESS_PIECE_TYPE(current_piece) == CHESS_PIECE_KNIGHT);
+    assert(CHESS_PIECE_COLOR(current_piece) != CHESS_COLOR_COLORLESS);
+
+    targets_moves_add(chess_ctx, position, move_list, !king_can_be_exposed,
+        tables_knight_attacks[CHESS_SQUARE(position.y, position.x)]);
+}
+
+static void queen_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move_List* move_list, int king_can_be_exposed) {
+    Chess_Packed_Piece current_piece = chess_ctx->board[CHESS_SQUARE(position.y, position.x)];
+    assert(CHESS_PIECE_TYPE(current_piece) == CHESS_PIECE_QUEEN);
+    assert(CHESS_PIECE_COLOR(current_piece) != CHESS_COLOR_COLORLESS);
+
+    rook_available_moves_get(chess_ctx, position, move_list, king_can_be_exposed);
+    bishop_available_moves_get(chess_ctx, position, move_list, king_can_be_exposed);
+}
+
+static void king_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move_List* move_list, int king_can_be_exposed, int discard_non_attacking_moves) {
+    Chess_Packed_Piece current_piece = chess_ctx->board[CHESS_SQUARE(position.y, position.x)];
+    assert(CHESS_PIECE_TYPE(current_piece) == CHESS_PIECE_KING);
+    assert(CHESS_PIECE_COLOR(current_piece) != CHESS_COLOR_COLORLESS);
+
+    targets_moves_add(chess_ctx, position, move_list, !king_can_be_exposed,
+        tables_king_attacks[CHESS_SQUARE(position.y, position.x)]);
 
     if (!discard_non_attacking_moves) {
         // Castling moves
-        if (current_piece->color == CHESS_COLOR_WHITE) {
-            if (!chess_ctx->white_state.is_king_under_attack) {
-                if (chess_ctx->white_state.short_castling_available) {
-                    if (chess_ctx->board[0][5].type == CHESS_PIECE_EMPTY && chess_ctx->board[0][6].type == CHESS_PIECE_EMPTY) {
+        if (CHESS_PIECE_COLOR(current_piece) == CHESS_COLOR_WHITE) {
+            if (!chess_is_king_under_attack(chess_ctx, CHESS_COLOR_WHITE)) {
+                if (chess_ctx->castling_rights & CHESS_CASTLING_WHITE_SHORT) {
+                    if (CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(0, 5)]) == CHESS_PIECE_EMPTY && CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(0, 6)]) == CHESS_PIECE_EMPTY) {
                         if (!is_square_being_attacked(chess_ctx, CHESS_POS(0, 5), CHESS_COLOR_BLACK) && !is_square_being_attacked(chess_ctx, CHESS_POS(0, 6), CHESS_COLOR_BLACK)) {
-                            available_moves[available_moves_num++] = chess_move_no_promotion(position, CHESS_POS(0, 6));
+                            move_list->moves[move_list->count++] = chess_move_special(position, CHESS_POS(0, 6), CHESS_MOVE_FLAG_CASTLING);
                         }
                     }
                 }
-                if (chess_ctx->white_state.long_castling_available) {
-                    if (chess_ctx->board[0][3].type == CHESS_PIECE_EMPTY && chess_ctx->board[0][2].type == CHESS_PIECE_EMPTY && chess_ctx->board[0][1].type == CHESS_PIECE_EMPTY) {
+                if (chess_ctx->castling_rights & CHESS_CASTLING_WHITE_LONG) {
+                    if (CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(0, 3)]) == CHESS_PIECE_EMPTY && CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(0, 2)]) == CHESS_PIECE_EMPTY && CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(0, 1)]) == CHESS_PIECE_EMPTY) {
                         if (!is_square_being_attacked(chess_ctx, CHESS_POS(0, 3), CHESS_COLOR_BLACK) && !is_square_being_attacked(chess_ctx, CHESS_POS(0, 2), CHESS_COLOR_BLACK)) {
-                            available_moves[available_moves_num++] = chess_move_no_promotion(position, CHESS_POS(0, 2));
+                            move_list->moves[move_list->count++] = chess_move_special(position, CHESS_POS(0, 2), CHESS_MOVE_FLAG_CASTLING);
                         }
                     }
                 }
             }
         } else {
-            if (!chess_ctx->black_state.is_king_under_attack) {
-                if (chess_ctx->black_state.short_castling_available) {
-                    if (chess_ctx->board[7][5].type == CHESS_PIECE_EMPTY && chess_ctx->board[7][6].type == CHESS_PIECE_EMPTY) {
+            if (!chess_is_king_under_attack(chess_ctx, CHESS_COLOR_BLACK)) {
+                if (chess_ctx->castling_rights & CHESS_CASTLING_BLACK_SHORT) {
+                    if (CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(7, 5)]) == CHESS_PIECE_EMPTY && CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(7, 6)]) == CHESS_PIECE_EMPTY) {
                         if (!is_square_being_attacked(chess_ctx, CHESS_POS(7, 5), CHESS_COLOR_WHITE) && !is_square_being_attacked(chess_ctx, CHESS_POS(7, 6), CHESS_COLOR_WHITE)) {
-                            available_moves[available_moves_num++] = chess_move_no_promotion(position, CHESS_POS(7, 6));
+                            move_list->moves[move_list->count++] = chess_move_special(position, CHESS_POS(7, 6), CHESS_MOVE_FLAG_CASTLING);
                         }
                     }
                 }
-                if (chess_ctx->black_state.long_castling_available) {
-                    if (chess_ctx->board[7][3].type == CHESS_PIECE_EMPTY && chess_ctx->board[7][2].type == CHESS_PIECE_EMPTY && chess_ctx->board[7][1].type == CHESS_PIECE_EMPTY) {
+                if (chess_ctx->castling_rights & CHESS_CASTLING_BLACK_LONG) {
+                    if (CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(7, 3)]) == CHESS_PIECE_EMPTY && CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(7, 2)]) == CHESS_PIECE_EMPTY && CHESS_PIECE_TYPE(chess_ctx->board[CHESS_SQUARE(7, 1)]) == CHESS_PIECE_EMPTY) {
                         if (!is_square_being_attacked(chess_ctx, CHESS_POS(7, 3), CHESS_COLOR_WHITE) && !is_square_being_attacked(chess_ctx, CHESS_POS(7, 2), CHESS_COLOR_WHITE)) {
-                            available_moves[available_moves_num++] = chess_move_no_promotion(position, CHESS_POS(7, 2));
+                            move_list->moves[move_list->count++] = chess_move_special(position, CHESS_POS(7, 2), CHESS_MOVE_FLAG_CASTLING);
                         }
                     }
                 }
             }
         }
     }
+}
 
-    return available_moves_num;
+// Pawns reaching the last rank promote to each piece in turn.
+static void pawn_move_add(const Chess_Context* chess_ctx, Chess_Board_Position position, Chess_Move_List* move_list,
+    int need_to_check_if_king_is_exposed, Chess_Board_Position to) {
+    static const Chess_Piece_Type promotions[] = { CHESS_PIECE_QUEEN, CHESS_PIECE_KNIGHT, CHESS_PIECE_ROOK, CHESS_PIECE_BISHOP };
+    if (to.y != 0 && to.y != CHESS_BOARD_HEIGHT - 1) {
+        available_move_add_to_list_if_valid(chess_ctx, move_list, need_to_check_if_king_is_exposed,
+            chess_move_no_promotion(chess_ctx, position, to));
+        return;
+    }
+    for (int i = 0; i < 4; ++i) {
+        available_move_add_to_list_if_valid(chess_ctx, move_list, need_to_check_if_king_is_exposed,
+            chess_move_with_promotion(chess_ctx, position, to, promotions[i]));
+    }
 }
 
-static int pawn_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int king_can_be_exposed, int discard_non_attacking_moves) {
-    const Chess_Piece* current_piece = &chess_ctx->board[position.y][position.x];
-    int available_moves_num = 0;
-    assert(current_piece->type == CHESS_PIECE_PAWN);
-    assert(current_piece->color != CHESS_COLOR_COLORLESS);
+static void pawn_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move_List* move_list, int king_can_be_exposed, int discard_non_attacking_moves) {
+    Chess_Packed_Piece current_piece = chess_ctx->board[CHESS_SQUARE(position.y, position.x)];
+    assert(CHESS_PIECE_TYPE(current_piece) == CHESS_PIECE_PAWN);
+    assert(CHESS_PIECE_COLOR(current_piece) != CHESS_COLOR_COLORLESS);
 
     int need_to_check_if_king_is_exposed = !king_can_be_exposed;
+    Chess_Color color = CHESS_PIECE_COLOR(current_piece);
+    int forward = color == CHESS_COLOR_WHITE ? 1 : -1;
+
+    int ahead_y = position.y + forward;
+    if (!discard_non_attacking_moves && ahead_y >= 0 && ahead_y < CHESS_BOARD_HEIGHT &&
+        chess_ctx->board[CHESS_SQUARE(ahead_y, position.x)] == CHESS_PIECE_EMPTY) {
+        pawn_move_add(chess_ctx, position, move_list, need_to_check_if_king_is_exposed, CHESS_POS(ahead_y, position.x));
+        int is_pawn_first_move = color == CHESS_COLOR_WHITE ? position.y == 1 : position.y == CHESS_BOARD_HEIGHT - 2;
+        if (is_pawn_first_move && chess_ctx->board[CHESS_SQUARE(position.y + 2 * forward, position.x)] == CHESS_PIECE_EMPTY) {
+            available_move_add_to_list_if_valid(chess_ctx, move_list, need_to_check_if_king_is_exposed,
+                chess_move_special(position, CHESS_POS(position.y + 2 * forward, position.x), CHESS_MOVE_FLAG_DOUBLE_PUSH));
+        }
+    }
+
+    Chess_Bitboard targets = tables_pawn_attacks[CHESS_COLOR_INDEX(color)][CHESS_SQUARE(position.y, position.x)];
+    for (; targets; targets &= targets - 1) {
+        int square = __builtin_ctzll(targets);
+        Chess_Packed_Piece candidate_piece = chess_ctx->board[square];
+        if (discard_non_attacking_moves) {
+            // Only the attacked square matters, so empty squares count too.
+            if (CHESS_PIECE_COLOR(candidate_piece) != color) {
+                available_move_add_to_list_if_valid(chess_ctx, move_list, need_to_check_if_king_is_exposed,
+                    chess_move_no_promotion(chess_ctx, position, square_to_position(square)));
+            }
+        } else if (candidate_piece != CHESS_PIECE_EMPTY && CHESS_PIECE_COLOR(candidate_piece) != color) {
+            pawn_move_add(chess_ctx, position, move_list, need_to_check_if_king_is_exposed, square_to_position(square));
+        } else if (candidate_piece == CHESS_PIECE_EMPTY && chess_ctx->en_passant_square == square) {
+            available_move_add_to_list_if_valid(chess_ctx, move_list, need_to_check_if_king_is_exposed,
+                chess_move_special(position, square_to_position(square), CHESS_MOVE_FLAG_EN_PASSANT));
+        }
+    }
+}
 
-    Chess_Move candidate_move;
-    Chess_Board_Position candidate_position;
+static void available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move_List* move_list, int king_can_be_exposed, int discard_non_attacking_moves) {
+    Chess_Packed_Piece piece = chess_ctx->board[CHESS_SQUARE(position.y, position.x)];
+    assert(CHESS_PIECE_COLOR(piece) != CHESS_COLOR_COLORLESS);
+    assert(CHESS_PIECE_TYPE(piece) != CHESS_PIECE_EMPTY);
+
+    switch(CHESS_PIECE_TYPE(piece)) {
+        case CHESS_PIECE_KING: king_available_moves_get(chess_ctx, position, move_list, king_can_be_exposed, discard_non_attacking_moves); break;
+        case CHESS_PIECE_QUEEN: queen_available_moves_get(chess_ctx, position, move_list, king_can_be_exposed); break;
+        case CHESS_PIECE_ROOK: rook_available_moves_get(chess_ctx, position, move_list, king_can_be_exposed); break;
+        case CHESS_PIECE_BISHOP: bishop_available_moves_get(chess_ctx, position, move_list, king_can_be_exposed); break;
+        case CHESS_PIECE_KNIGHT: knight_available_moves_get(chess_ctx, position, move_list, king_can_be_exposed); break;
+        case CHESS_PIECE_PAWN: pawn_available_moves_get(chess_ctx, position, move_list, king_can_be_exposed, discard_non_attacking_moves); break;
+        default: assert(0);
+    }
+}
 
-    if (!discard_non_attacking_moves) {
-        candidate_position = current_piece->color == CHESS_COLOR_WHITE ? CHESS_POS(position.y + 1, position.x) : CHESS_POS(position.y - 1, position.x);
-        if (chess_position_is_within_bounds(candidate_position)) {
-            const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-            if (candidate_piece->type == CHESS_PIECE_EMPTY) {
-                if ((current_piece->color == CHESS_COLOR_WHITE && candidate_position.y == 7) || (current_piece->color == CHESS_COLOR_BLACK && candidate_position.y == 0)) {
-                    // If the pawn is moving to the last rank, we need to promote it!
-                    candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_QUEEN);
-                    available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                        need_to_check_if_king_is_exposed, &candidate_move);
-                    candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_KNIGHT);
-                    available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                        need_to_check_if_king_is_exposed, &candidate_move);
-                    candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_ROOK);
-                    available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                        need_to_check_if_king_is_exposed, &candidate_move);
-                    candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_BISHOP);
-                    available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                        need_to_check_if_king_is_exposed, &candidate_move);
+int chess_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
+    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH]) {
+    Chess_Move_List move_list;
+    move_list.count = 0;
+    available_moves_get(chess_ctx, position, &move_list, 0, 0);
+    for (int i = 0; i < move_list.count; ++i) {
+        chess_move_unpack(move_list.moves[i], &available_moves[i]);
+    }
+    return move_list.count;
+}
+
+// Straight directions are even and diagonal ones odd. A ray ends at its first occupied square, which it still
+// attacks; the transparent square is left out of the occupancy.
+static Chess_Bitboard slider_attacks(int square, Chess_Bitboard occupied, int straight, int diagonal) {
+    Chess_Bitboard attacks = 0;
+    for (int direction = 0; direction < TABLES_DIRECTIONS; ++direction) {
+        if (!(direction % 2 ? diagonal : straight)) {
+            continue;
+        }
+        Chess_Bitboard ray = tables_rays[direction][square];
+        Chess_Bitboard blockers = ray & occupied;
+        if (blockers) {
+            ray &= ~tables_rays[direction][TABLES_RAY_NEAREST(blockers, direction)];
+        }
+        attacks |= ray;
+    }
+    return attacks;
+}
+
+static Chess_Bitboard piece_attacks(int square, Chess_Packed_Piece piece, Chess_Bitboard occupied) {
+    switch (CHESS_PIECE_TYPE(piece)) {
+    case CHESS_PIECE_PAWN:
+        return tables_pawn_attacks[CHESS_COLOR_INDEX(CHESS_PIECE_COLOR(piece))][square];
+    case CHESS_PIECE_KNIGHT:
+        return tables_knight_attacks[square];
+    case CHESS_PIECE_KING:
+        return tables_king_attacks[square];
+    case CHESS_PIECE_BISHOP:
+        return slider_attacks(square, occupied, 0, 1);
+    case CHESS_PIECE_ROOK:
+        return slider_attacks(square, occupied, 1, 0);
+    case CHESS_PIECE_QUEEN:
+        return slider_attacks(square, occupied, 1, 1);
+    default:
+        return 0;
+    }
+}
+
+// Pins and checks are found by walking out from the king of the side to move.
+static void king_lines_fill(const Chess_Context* chess_ctx, Chess_Attack_Map* attack_map) {
+    const Chess_Packed_Piece* board = chess_ctx->board;
+    Chess_Color color = chess_ctx->current_turn, opponent = CHESS_COLOR_OPPONENT(color);
+    int king = chess_ctx->king_square[CHESS_COLOR_INDEX(color)];
+    Chess_Bitboard leapers = tables_pawn_attacks[CHESS_COLOR_INDEX(color)][king] | tables_knight_attacks[king];
+
+    attack_map->pinned = 0;
+    attack_map->checkers = 0;
+    for (leapers &= attack_map->pieces[CHESS_COLOR_INDEX(opponent)]; leapers; leapers &= leapers - 1) {
+        int square = __builtin_ctzll(leapers);
+        Chess_Piece_Type type = CHESS_PIECE_TYPE(board[square]);
+        if ((type == CHESS_PIECE_PAWN || type == CHESS_PIECE_KNIGHT) &&
+            (piece_attacks(square, board[square], 0) >> king & 1)) {
+            attack_map->checkers |= 1ULL << square;
+        }
+    }
+
+    for (int direction = 0; direction < TABLES_DIRECTIONS; ++direction) {
+        Chess_Piece_Type slider = direction % 2 ? CHESS_PIECE_BISHOP : CHESS_PIECE_ROOK;
+        int own = CHESS_SQUARE_NONE;
+        for (Chess_Bitboard ray = tables_rays[direction][king]; ray; ) {
+            int square = TABLES_RAY_NEAREST(ray, direction);
+            Chess_Packed_Piece piece = board[square];
+            ray &= ~(1ULL << square);
+            if (piece == CHESS_PIECE_EMPTY) {
+                continue;
+            }
+            if (CHESS_PIECE_COLOR(piece) == color) {
+                if (own != CHESS_SQUARE_NONE) {
+                    break;
+                }
+                own = square;
+                continue;
+            }
+            if (piece == CHESS_PIECE_PACK(slider, opponent) || piece == CHESS_PIECE_PACK(CHESS_PIECE_QUEEN, opponent)) {
+                if (own == CHESS_SQUARE_NONE) {
+                    attack_map->checkers |= 1ULL << square;
                 } else {
-                    candidate_move = chess_move_no_promotion(position, candidate_position);
-                    available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                        need_to_check_if_king_is_exposed, &candidate_move);
-
-                    // Check if we can also advance two squares
-                    candidate_position = current_piece->color == CHESS_COLOR_WHITE ? CHESS_POS(position.y + 2, position.x) : CHESS_POS(position.y - 2, position.x);
-                    int is_pawn_first_move = current_piece->color == CHESS_COLOR_WHITE ? position.y == 1 : position.y == CHESS_BOARD_HEIGHT - 2;
-                    if (is_pawn_first_move) {
-                        candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-                        candidate_move = chess_move_no_promotion(position, candidate_position);
-                        if (candidate_piece->type == CHESS_PIECE_EMPTY) {
-                            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                                need_to_check_if_king_is_exposed, &candidate_move);
-                        }
-                    }
+                    attack_map->pinned |= 1ULL << own;
                 }
             }
+            break;
         }
     }
+}
 
-    candidate_position = current_piece->color == CHESS_COLOR_WHITE ? CHESS_POS(position.y + 1, position.x + 1) : CHESS_POS(position.y - 1, position.x + 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        if (candidate_piece->type != CHESS_PIECE_EMPTY && candidate_piece->color != current_piece->color) {
-            if ((current_piece->color == CHESS_COLOR_WHITE && candidate_position.y == 7) || (current_piece->color == CHESS_COLOR_BLACK && candidate_position.y == 0)) {
-                candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_QUEEN);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
-                candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_KNIGHT);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
-                candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_ROOK);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
-                candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_BISHOP);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
-            } else {
-                candidate_move = chess_move_no_promotion(position, candidate_position);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
+void chess_attack_map_compute(const Chess_Context* chess_ctx, Chess_Attack_Map* attack_map) {
+    const Chess_Packed_Piece* board = chess_ctx->board;
+
+    memset(attack_map, 0, sizeof(Chess_Attack_Map));
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        if (board[square] != CHESS_PIECE_EMPTY) {
+            attack_map->pieces[CHESS_COLOR_INDEX(CHESS_PIECE_COLOR(board[square]))] |= 1ULL << square;
+        }
+    }
+    Chess_Bitboard occupied = attack_map->pieces[0] | attack_map->pieces[1];
+    for (int c = 0; c < 2; ++c) {
+        attack_map->king_zone[c] = tables_king_attacks[chess_ctx->king_square[c]] | 1ULL << chess_ctx->king_square[c];
+    }
+    for (int c = 0; c < 2; ++c) {
+        // Sliders see through the enemy king, so that it can't step back along their line.
+        Chess_Bitboard transparent_occupied = occupied & ~(1ULL << chess_ctx->king_square[1 - c]);
+        for (Chess_Bitboard pieces = attack_map->pieces[c]; pieces; pieces &= pieces - 1) {
+            int square = __builtin_ctzll(pieces);
+            Chess_Packed_Piece piece = board[square];
+            Chess_Bitboard attacks = piece_attacks(square, piece, transparent_occupied);
+            attack_map->double_attacks[c] |= attack_map->by_type[c][CHESS_PIECE_EMPTY] & attacks;
+            attack_map->by_type[c][CHESS_PIECE_EMPTY] |= attacks;
+            attack_map->by_type[c][CHESS_PIECE_TYPE(piece)] |= attacks;
+            attack_map->king_zone_attacks[c] += __builtin_popcountll(attacks & attack_map->king_zone[1 - c]);
+        }
+    }
+    king_lines_fill(chess_ctx, attack_map);
+}
+
+// King steps only need their square to be safe, and other moves can only be illegal in check, for pinned pieces
+// or with en passant, which are played out.
+static int move_is_legal(const Chess_Context* chess_ctx, const Chess_Attack_Map* attack_map, Chess_Packed_Move move) {
+    Chess_Color color = chess_ctx->current_turn;
+    Chess_Bitboard enemy_attacks = attack_map->by_type[CHESS_COLOR_INDEX(CHESS_COLOR_OPPONENT(color))][CHESS_PIECE_EMPTY];
+    int from = CHESS_MOVE_FROM(move), flags = CHESS_MOVE_FLAGS(move);
+
+    if (from == chess_ctx->king_square[CHESS_COLOR_INDEX(color)]) {
+        return flags == CHESS_MOVE_FLAG_CASTLING || !(enemy_attacks >> CHESS_MOVE_TO(move) & 1);
+    }
+    if (attack_map->checkers || (attack_map->pinned >> from & 1) || flags == CHESS_MOVE_FLAG_EN_PASSANT) {
+        return !is_king_exposed_if_piece_is_moved(chess_ctx, move);
+    }
+    return 1;
+}
+
+// Pseudo-legal moves filtered with the map.
+void chess_generate_moves_with_attacks(const Chess_Context* chess_ctx, const Chess_Attack_Map* attack_map,
+    Chess_Move_List* move_list) {
+    Chess_Color color = chess_ctx->current_turn;
+
+    move_list->count = 0;
+    for (int y = 0; y < CHESS_BOARD_HEIGHT; ++y) {
+        for (int x = 0; x < CHESS_BOARD_WIDTH; ++x) {
+            Chess_Packed_Piece piece = chess_ctx->board[CHESS_SQUARE(y, x)];
+            if (CHESS_PIECE_TYPE(piece) != CHESS_PIECE_EMPTY && CHESS_PIECE_COLOR(piece) == color) {
+                available_moves_get(chess_ctx, CHESS_POS(y, x), move_list, 1, 0);
             }
-        } else if (candidate_piece->type == CHESS_PIECE_EMPTY && chess_ctx->en_passant_info.available &&
-            chess_ctx->en_passant_info.target.y == candidate_position.y && chess_ctx->en_passant_info.target.x == candidate_position.x){
-            // EN PASSANT
-            candidate_move = chess_move_no_promotion(position, candidate_position);
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
         }
     }
-    
-    candidate_position = current_piece->color == CHESS_COLOR_WHITE ? CHESS_POS(position.y + 1, position.x - 1) : CHESS_POS(position.y - 1, position.x - 1);
-    if (chess_position_is_within_bounds(candidate_position)) {
-        const Chess_Piece* candidate_piece = &chess_ctx->board[candidate_position.y][candidate_position.x];
-        if (candidate_piece->type != CHESS_PIECE_EMPTY && candidate_piece->color != current_piece->color) {
-            if ((current_piece->color == CHESS_COLOR_WHITE && candidate_position.y == 7) || (current_piece->color == CHESS_COLOR_BLACK && candidate_position.y == 0)) {
-                candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_QUEEN);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
-                candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_KNIGHT);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
-                candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_ROOK);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
-                candidate_move = chess_move_with_promotion(position, candidate_position, CHESS_PIECE_BISHOP);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
-            } else {
-                candidate_move = chess_move_no_promotion(position, candidate_position);
-                available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                    need_to_check_if_king_is_exposed, &candidate_move);
+
+    int kept = 0;
+    for (int i = 0; i < move_list->count; ++i) {
+        if (move_is_legal(chess_ctx, attack_map, move_list->moves[i])) {
+            move_list->moves[kept++] = move_list->moves[i];
+        }
+    }
+    move_list->count = kept;
+}
+
+// Most positions have a move the map alone proves legal: a safe king step or, out of check, any pseudo-legal move
+// of a piece that is not pinned. En passant is left to the full test.
+static int has_unpinned_move(const Chess_Context* chess_ctx, const Chess_Attack_Map* attack_map) {
+    int color_index = CHESS_COLOR_INDEX(chess_ctx->current_turn);
+    Chess_Bitboard own = attack_map->pieces[color_index], enemies = attack_map->pieces[1 - color_index];
+    int king = chess_ctx->king_square[color_index];
+    int forward = chess_ctx->current_turn == CHESS_COLOR_WHITE ? CHESS_BOARD_WIDTH : -CHESS_BOARD_WIDTH;
+
+    if (tables_king_attacks[king] & ~own & ~attack_map->by_type[1 - color_index][CHESS_PIECE_EMPTY]) {
+        return 1;
+    }
+    if (attack_map->checkers) {
+        return 0;
+    }
+    for (Chess_Bitboard pieces = own & ~attack_map->pinned & ~(1ULL << king); pieces; pieces &= pieces - 1) {
+        int square = __builtin_ctzll(pieces);
+        Chess_Packed_Piece piece = chess_ctx->board[square];
+        if (CHESS_PIECE_TYPE(piece) == CHESS_PIECE_PAWN) {
+            if (chess_ctx->board[square + forward] == CHESS_PIECE_EMPTY ||
+                (tables_pawn_attacks[color_index][square] & enemies)) {
+                return 1;
             }
-        } else if (candidate_piece->type == CHESS_PIECE_EMPTY && chess_ctx->en_passant_info.available &&
-            chess_ctx->en_passant_info.target.y == candidate_position.y && chess_ctx->en_passant_info.target.x == candidate_position.x){
-            // EN PASSANT
-            candidate_move = chess_move_no_promotion(position, candidate_position);
-            available_moves_num = available_move_add_to_list_if_valid(chess_ctx, available_moves, available_moves_num,
-                need_to_check_if_king_is_exposed, &candidate_move);
+        } else if (piece_attacks(square, piece, own | enemies) & ~own) {
+            return 1;
         }
     }
+    return 0;
+}
+
+// Piece by piece, so that a position the map can't settle usually costs the moves of one piece.
+int chess_has_legal_move_with_attacks(const Chess_Context* chess_ctx, const Chess_Attack_Map* attack_map) {
+    Chess_Move_List move_list;
 
-    return available_moves_num;
+    if (has_unpinned_move(chess_ctx, attack_map)) {
+        return 1;
+    }
+    for (Chess_Bitboard pieces = attack_map->pieces[CHESS_COLOR_INDEX(chess_ctx->current_turn)]; pieces;
+        pieces &= pieces - 1) {
+        move_list.count = 0;
+        available_moves_get(chess_ctx, square_to_position(__builtin_ctzll(pieces)), &move_list, 1, 0);
+        for (int i = 0; i < move_list.count; ++i) {
+            if (move_is_legal(chess_ctx, attack_map, move_list.moves[i])) {
+                return 1;
+            }
+        }
+    }
+    return 0;
 }
 
-static int available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH], int king_can_be_exposed, int discard_non_attacking_moves) {
-    const Chess_Piece* piece = &chess_ctx->board[position.y][position.x];
-    assert(piece->color != CHESS_COLOR_COLORLESS);
-    assert(piece->type != CHESS_PIECE_EMPTY);
+int chess_has_legal_move(const Chess_Context* chess_ctx) {
+    Chess_Attack_Map attack_map;
+    chess_attack_map_compute(chess_ctx, &attack_map);
+    return chess_has_legal_move_with_attacks(chess_ctx, &attack_map);
+}
 
-    switch(piece->type) {
-        case CHESS_PIECE_KING: return king_available_moves_get(chess_ctx, position, available_moves, king_can_be_exposed, discard_non_attacking_moves);
-        case CHESS_PIECE_QUEEN: return queen_available_moves_get(chess_ctx, position, available_moves, king_can_be_exposed);
-        case CHESS_PIECE_ROOK: return rook_available_moves_get(chess_ctx, position, available_moves, king_can_be_exposed);
-        case CHESS_PIECE_BISHOP: return bishop_available_moves_get(chess_ctx, position, available_moves, king_can_be_exposed);
-        case CHESS_PIECE_KNIGHT: return knight_available_moves_get(chess_ctx, position, available_moves, king_can_be_exposed);
-        case CHESS_PIECE_PAWN: return pawn_available_moves_get(chess_ctx, position, available_moves, king_can_be_exposed, discard_non_attacking_moves);
-        default: assert(0);
+void chess_generate_moves(const Chess_Context* chess_ctx, Chess_Move_List* move_list) {
+    Chess_Attack_Map attack_map;
+    chess_attack_map_compute(chess_ctx, &attack_map);
+    chess_generate_moves_with_attacks(chess_ctx, &attack_map, move_list);
+}
+
+void chess_move_to_uci_notation(const Chess_Move* move, char* uci_str) {
+    uci_str[0] = move->from.x + 'a';
+    uci_str[1] = move->from.y + '0' + 1;
+    uci_str[2] = move->to.x + 'a';
+    uci_str[3] = move->to.y + '0' + 1;
+
+    if (move->will_promote) {
+        switch (move->promotion_type) {
+            case CHESS_PIECE_QUEEN: {
+                uci_str[4] = 'q';
+            } break;
+            case CHESS_PIECE_ROOK: {
+                uci_str[4] = 'r';
+            } break;
+            case CHESS_PIECE_BISHOP: {
+                uci_str[4] = 'b';
+            } break;
+            case CHESS_PIECE_KNIGHT: {
+                uci_str[4] = 'n';
+            } break;
+            default: {
+                assert(0);
+            } break;
+        }
+        uci_str[5] = '\0';
+    } else {
+        uci_str[4] = '\0';
     }
 }
 
-int chess_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
-    Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH]) {
-    return available_moves_get(chess_ctx, position, available_moves, 0, 0);
-}
\ No newline at end of file
+void chess_uci_notation_to_move(const char* uci_str, Chess_Move* move) {
+    int uci_str_len = strlen(uci_str);
+    move->from = CHESS_POS(uci_str[1] - '0' - 1, uci_str[0] - 'a');
+    move->to = CHESS_POS(uci_str[3] - '0' - 1, uci_str[2] - 'a');
+
+    // Pawn reached last rank.
+    if (uci_str_len == 5) {
+        switch(uci_str[4]) {
+            case 'b': move->promotion_type = CHESS_PIECE_BISHOP; break;
+            case 'n': move->promotion_type = CHESS_PIECE_KNIGHT; break;
+            case 'q': move->promotion_type = CHESS_PIECE_QUEEN; break;
+            case 'r': move->promotion_type = CHESS_PIECE_ROOK; break;
+            default: assert(0);
+        }
+        move->will_promote = 1;
+    } else {
+        move->will_promote = 0;
+    }
+}
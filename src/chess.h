@@ -1,11 +1,17 @@
 #ifndef GOLDENPAWN_CHESS_H
 #define GOLDENPAWN_CHESS_H
+#include <stdint.h>
 
 #define CHESS_BOARD_HEIGHT 8
 #define CHESS_BOARD_WIDTH 8
 
 #define CHESS_POS(y,x) (Chess_Board_Position){y,x}
 
+// Squares are indexed as y * 8 + x, so a1 = 0, h1 = 7 and h8 = 63.
+#define CHESS_SQUARE(y,x) ((y) * CHESS_BOARD_WIDTH + (x))
+
+typedef uint64_t Chess_Bitboard;
+
 typedef struct {
     int y;
     int x;
@@ -34,35 +40,118 @@ typedef struct {
     Chess_Piece_Type promotion_type;
 } Chess_Move;
 
+// Packed moves keep the from square in bits 0-5, the to square in bits 6-11 and the flags in bits 12-15.
+typedef uint16_t Chess_Packed_Move;
+
+#define CHESS_MOVE_FLAG_QUIET 0x0
+#define CHESS_MOVE_FLAG_DOUBLE_PUSH 0x1
+#define CHESS_MOVE_FLAG_CASTLING 0x2
+#define CHESS_MOVE_FLAG_CAPTURE 0x4
+#define CHESS_MOVE_FLAG_EN_PASSANT 0x5
+// Promotions set this bit and keep the promoted piece in the two lowest flag bits (knight, bishop, rook, queen).
+#define CHESS_MOVE_FLAG_PROMOTION 0x8
+
+#define CHESS_MOVE_NONE ((Chess_Packed_Move)0)
+#define CHESS_MOVE_MAKE(from,to,flags) ((Chess_Packed_Move)((from) | ((to) << 6) | ((flags) << 12)))
+#define CHESS_MOVE_FROM(move) ((move) & 0x3F)
+#define CHESS_MOVE_TO(move) (((move) >> 6) & 0x3F)
+#define CHESS_MOVE_FLAGS(move) ((move) >> 12)
+#define CHESS_MOVE_IS_CAPTURE(move) (CHESS_MOVE_FLAGS(move) & CHESS_MOVE_FLAG_CAPTURE)
+#define CHESS_MOVE_IS_PROMOTION(move) (CHESS_MOVE_FLAGS(move) & CHESS_MOVE_FLAG_PROMOTION)
+
+#define CHESS_MAX_MOVES 256
+
+typedef struct {
+    Chess_Packed_Move moves[CHESS_MAX_MOVES];
+    int16_t scores[CHESS_MAX_MOVES];
+    int count;
+} Chess_Move_List;
+
 typedef struct {
     Chess_Piece_Type type;
     Chess_Color color;
 } Chess_Piece;
 
-typedef struct {
-    Chess_Board_Position king_position;
-    int is_king_under_attack;
-    int short_castling_available;
-    int long_castling_available;
-} Chess_Color_State;
+// Pieces are stored in a single byte: the type in bits 0-2 and the color in bits 3-4. An empty square is 0.
+typedef uint8_t Chess_Packed_Piece;
 
-typedef struct {
-    int available;
-    Chess_Board_Position target;
-    Chess_Board_Position pawn_position;
-} Chess_En_Passant_Information;
+#define CHESS_PIECE_PACK(type,color) ((Chess_Packed_Piece)((type) | ((color) << 3)))
+#define CHESS_PIECE_TYPE(piece) ((Chess_Piece_Type)((piece) & 0x7))
+#define CHESS_PIECE_COLOR(piece) ((Chess_Color)((piece) >> 3))
+
+#define CHESS_COLOR_INDEX(color) ((color) - 1)
+#define CHESS_COLOR_OPPONENT(color) ((color) == CHESS_COLOR_WHITE ? CHESS_COLOR_BLACK : CHESS_COLOR_WHITE)
+
+#define CHESS_SQUARE_NONE 64
 
+#define CHESS_CASTLING_WHITE_SHORT 0x1
+#define CHESS_CASTLING_WHITE_LONG 0x2
+#define CHESS_CASTLING_BLACK_SHORT 0x4
+#define CHESS_CASTLING_BLACK_LONG 0x8
+
+// Contexts are copied on every move, so everything is kept in bytes (88 bytes in total).
 typedef struct {
-    Chess_Piece board[CHESS_BOARD_HEIGHT][CHESS_BOARD_WIDTH];
-    Chess_Color current_turn;
-    Chess_Color_State white_state;
-    Chess_Color_State black_state;
-    Chess_En_Passant_Information en_passant_info;
+    uint64_t hash;
+    Chess_Packed_Piece board[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH];
+    uint8_t king_square[2];
+    uint8_t current_turn;
+    uint8_t castling_rights;
+    uint8_t en_passant_square;
+    uint8_t king_under_attack;
+    uint8_t halfmove_clock;
+    uint16_t fullmove_number;
 } Chess_Context;
 
+// Squares attacked by each side, computed once per position and shared by move generation and evaluation. Indexed
+// by color index, and by_type also by the attacking piece type (CHESS_PIECE_EMPTY for every type at once). Sliders
+// see through the enemy king, so that a king can't step back along the line of the check it is escaping.
+typedef struct {
+    Chess_Bitboard pieces[2];
+    Chess_Bitboard by_type[2][CHESS_PIECE_PAWN + 1];
+    // Squares attacked at least twice.
+    Chess_Bitboard double_attacks[2];
+    // The king square and its neighbours, and the attacks a side makes on the other side's zone.
+    Chess_Bitboard king_zone[2];
+    int king_zone_attacks[2];
+    // For the side to move: its pieces pinned to its king, and the enemy pieces giving check.
+    Chess_Bitboard pinned;
+    Chess_Bitboard checkers;
+} Chess_Attack_Map;
+
 void chess_context_from_position_input(Chess_Context* chess_ctx, int argc, const char** argv);
 void chess_move_piece(const Chess_Context* chess_ctx, Chess_Context* new_ctx, const Chess_Move* move);
 int chess_available_moves_get(const Chess_Context* chess_ctx, Chess_Board_Position position,
     Chess_Move available_moves[CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH]);
 void chess_update_context(Chess_Context* chess_ctx);
+void chess_check_flags_update(Chess_Context* chess_ctx);
+void chess_generate_moves(const Chess_Context* chess_ctx, Chess_Move_List* move_list);
+void chess_attack_map_compute(const Chess_Context* chess_ctx, Chess_Attack_Map* attack_map);
+// Legal moves, for callers that keep the attack map of the position for other uses.
+void chess_generate_moves_with_attacks(const Chess_Context* chess_ctx, const Chess_Attack_Map* attack_map,
+    Chess_Move_List* move_list);
+int chess_has_legal_move_with_attacks(const Chess_Context* chess_ctx, const Chess_Attack_Map* attack_map);
+void chess_make_move(const Chess_Context* chess_ctx, Chess_Context* new_ctx, Chess_Packed_Move move);
+// For legal moves of the side to move, without making them.
+int chess_move_gives_check(const Chess_Context* chess_ctx, Chess_Packed_Move move);
+Chess_Packed_Move chess_move_pack(const Chess_Context* chess_ctx, const Chess_Move* move);
+void chess_move_unpack(Chess_Packed_Move packed_move, Chess_Move* move);
+Chess_Piece_Type chess_move_promotion_type(Chess_Packed_Move move);
+Chess_Bitboard chess_pieces_get(const Chess_Context* chess_ctx, Chess_Color color, Chess_Piece_Type type);
+Chess_Bitboard chess_color_pieces_get(const Chess_Context* chess_ctx, Chess_Color color);
+uint64_t chess_hash_compute(const Chess_Context* chess_ctx);
+uint64_t chess_hash_piece_key(Chess_Packed_Piece piece, int square);
+uint64_t chess_hash_state_key(const Chess_Context* chess_ctx);
+Chess_Piece chess_piece_get(const Chess_Context* chess_ctx, Chess_Board_Position position);
+void chess_piece_set(Chess_Context* chess_ctx, Chess_Board_Position position, Chess_Piece piece);
+Chess_Board_Position chess_king_position_get(const Chess_Context* chess_ctx, Chess_Color color);
+int chess_is_king_under_attack(const Chess_Context* chess_ctx, Chess_Color color);
+// Whether the side to move is in check.
+int chess_in_check(const Chess_Context* chess_ctx);
+// Stops at the first legal move, for telling mates and stalemates apart from other positions cheaply.
+int chess_has_legal_move(const Chess_Context* chess_ctx);
+int chess_en_passant_target_get(const Chess_Context* chess_ctx, Chess_Board_Position* target);
+int chess_en_passant_is_valid(const Chess_Context* chess_ctx);
+uint8_t chess_castling_rights_supported(const Chess_Context* chess_ctx);
+void chess_move_to_uci_notation(const Chess_Move* move, char* uci_str);
+void chess_uci_notation_to_move(const char* uci_str, Chess_Move* move);
 #endif
\ No newline at end of file
@@ -1,10 +1,6 @@
 #include "fen.h"
-#include "io.h"
 #include <string.h>
-#include <memory.h>
-#include <stdlib.h>
-
-#define FEN_PARSER_BUFFER_SIZE 64 * 1024
+#include <stdio.h>
 
 typedef enum {
     FEN_BOARD,
@@ -13,197 +9,313 @@ typedef enum {
     FEN_EN_PASSANT,
     FEN_HALFMOVE,
     FEN_FULLMOVE,
-    FEN_END,
-} Fen_Format;
+    FEN_FIELDS
+} Fen_Field;
 
-static int is_number(char c) {
-    if (c >= '0' && c <= '9')
-        return 1;
-    return 0;
-}
+static const Chess_Packed_Piece fen_pieces[128] = {
+    ['K'] = CHESS_PIECE_PACK(CHESS_PIECE_KING, CHESS_COLOR_WHITE),
+    ['Q'] = CHESS_PIECE_PACK(CHESS_PIECE_QUEEN, CHESS_COLOR_WHITE),
+    ['R'] = CHESS_PIECE_PACK(CHESS_PIECE_ROOK, CHESS_COLOR_WHITE),
+    ['B'] = CHESS_PIECE_PACK(CHESS_PIECE_BISHOP, CHESS_COLOR_WHITE),
+    ['N'] = CHESS_PIECE_PACK(CHESS_PIECE_KNIGHT, CHESS_COLOR_WHITE),
+    ['P'] = CHESS_PIECE_PACK(CHESS_PIECE_PAWN, CHESS_COLOR_WHITE),
+    ['k'] = CHESS_PIECE_PACK(CHESS_PIECE_KING, CHESS_COLOR_BLACK),
+    ['q'] = CHESS_PIECE_PACK(CHESS_PIECE_QUEEN, CHESS_COLOR_BLACK),
+    ['r'] = CHESS_PIECE_PACK(CHESS_PIECE_ROOK, CHESS_COLOR_BLACK),
+    ['b'] = CHESS_PIECE_PACK(CHESS_PIECE_BISHOP, CHESS_COLOR_BLACK),
+    ['n'] = CHESS_PIECE_PACK(CHESS_PIECE_KNIGHT, CHESS_COLOR_BLACK),
+    ['p'] = CHESS_PIECE_PACK(CHESS_PIECE_PAWN, CHESS_COLOR_BLACK),
+};
+
+static const char fen_piece_chars[] = " KQNBRP";
 
 static int is_whitespace(char c) {
     return (c == ' ' || c == '\n' || c == '\v' || c == '\t' || c == '\r');
 }
 
-static int str_to_s32(char* text, int length) {
-    int result = 0;
-    int tenths = 1;
-    for (int i = length - 1; i >= 0; --i, tenths *= 10)
-        result += (text[i] - 0x30) * tenths;
-    return result;
+static int is_number(char c) {
+    return c >= '0' && c <= '9';
 }
 
-static int build_fen_input(int argc, const char** argv, char* out) {
-    char* aux = out;
-    int moves_position = -1;
-    int i = 0;
-    for (; i < argc; ++i) {
-        // We need to stop when 'moves' is found. (UCI)
-        if (strcmp(argv[i], "moves") == 0) {
-            moves_position = i;
-            break;
-        }
-        int len = strlen(argv[i]);
-        memcpy(aux, argv[i], len);
-        aux += len;
-        *aux = ' ';
-        aux++;
-    }
-    aux--;
-    *aux = 0;
-    return moves_position;
+static int is_field_end(const char* s, const char* end) {
+    return s == end || is_whitespace(*s);
 }
 
-static int fen_to_chess_ctx(Chess_Context* chess_ctx, char* fen_input) {
-    memset(chess_ctx, 0, sizeof(Chess_Context));
+// Fills the board, the king squares and the piece part of the hash. Every rank must add up to eight files,
+// each side needs exactly one king and pawns can't stand on the first or last rank.
+static const char* board_parse(Chess_Context* chess_ctx, const char* s, const char* end) {
+    int rank = CHESS_BOARD_HEIGHT - 1;
+    int file = 0;
+    int kings[3] = { 0 };
 
-    Fen_Format parsing_state = FEN_BOARD;
+    for (; !is_field_end(s, end); ++s) {
+        unsigned char c = *s;
+        if (c == '/') {
+            if (file != CHESS_BOARD_WIDTH || rank == 0) {
+                return NULL;
+            }
+            --rank;
+            file = 0;
+        } else if (c >= '1' && c <= '8') {
+            file += c - '0';
+            if (file > CHESS_BOARD_WIDTH) {
+                return NULL;
+            }
+        } else {
+            Chess_Packed_Piece piece = c < 128 ? fen_pieces[c] : CHESS_PIECE_EMPTY;
+            if (piece == CHESS_PIECE_EMPTY || file >= CHESS_BOARD_WIDTH) {
+                return NULL;
+            }
+            if (CHESS_PIECE_TYPE(piece) == CHESS_PIECE_PAWN && (rank == 0 || rank == CHESS_BOARD_HEIGHT - 1)) {
+                return NULL;
+            }
 
-    int rank = 7;
-    int file = 0;
+            int square = CHESS_SQUARE(rank, file);
+            if (CHESS_PIECE_TYPE(piece) == CHESS_PIECE_KING) {
+                if (kings[CHESS_PIECE_COLOR(piece)]++) {
+                    return NULL;
+                }
+                chess_ctx->king_square[CHESS_COLOR_INDEX(CHESS_PIECE_COLOR(piece))] = square;
+            }
+            chess_ctx->board[square] = piece;
+            chess_ctx->hash ^= chess_hash_piece_key(piece, square);
+            ++file;
+        }
+    }
+
+    if (rank != 0 || file != CHESS_BOARD_WIDTH || !kings[CHESS_COLOR_WHITE] || !kings[CHESS_COLOR_BLACK]) {
+        return NULL;
+    }
+    return s;
+}
+
+static const char* to_move_parse(Chess_Context* chess_ctx, const char* s, const char* end) {
+    if (*s == 'w') {
+        chess_ctx->current_turn = CHESS_COLOR_WHITE;
+    } else if (*s == 'b') {
+        chess_ctx->current_turn = CHESS_COLOR_BLACK;
+    } else {
+        return NULL;
+    }
+    ++s;
+    return is_field_end(s, end) ? s : NULL;
+}
+
+static const char* castling_parse(Chess_Context* chess_ctx, const char* s, const char* end) {
+    if (*s == '-') {
+        ++s;
+        return is_field_end(s, end) ? s : NULL;
+    }
 
-    while (*fen_input != 0) {
-        char c = *fen_input;
-        if (is_whitespace(c)) {
-            fen_input++;
-            continue;
+    for (; !is_field_end(s, end); ++s) {
+        uint8_t right;
+        switch (*s) {
+            case 'K': right = CHESS_CASTLING_WHITE_SHORT; break;
+            case 'Q': right = CHESS_CASTLING_WHITE_LONG; break;
+            case 'k': right = CHESS_CASTLING_BLACK_SHORT; break;
+            case 'q': right = CHESS_CASTLING_BLACK_LONG; break;
+            default: return NULL;
+        }
+        if (chess_ctx->castling_rights & right) {
+            return NULL;
         }
+        chess_ctx->castling_rights |= right;
+    }
+    return s;
+}
 
-        switch (parsing_state) 
-        {
-            case FEN_BOARD: {
-                switch (c) 
-                {
-                    case 'r': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_ROOK, CHESS_COLOR_BLACK}; break;
-                    case 'n': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_KNIGHT, CHESS_COLOR_BLACK}; break;
-                    case 'b': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_BISHOP, CHESS_COLOR_BLACK}; break;
-                    case 'q': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_QUEEN, CHESS_COLOR_BLACK}; break;
-                    case 'k': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_KING, CHESS_COLOR_BLACK}; break;
-                    case 'p': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_PAWN, CHESS_COLOR_BLACK}; break;
-
-                    case 'R': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_ROOK, CHESS_COLOR_WHITE}; break;
-                    case 'N': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_KNIGHT, CHESS_COLOR_WHITE}; break;
-                    case 'B': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_BISHOP, CHESS_COLOR_WHITE}; break;
-                    case 'Q': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_QUEEN, CHESS_COLOR_WHITE}; break;
-                    case 'K': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_KING, CHESS_COLOR_WHITE}; break;
-                    case 'P': chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_PAWN, CHESS_COLOR_WHITE}; break;
-
-                    case '/': {
-                        rank -= 1;
-                        file = -1;
-                    } break;
-
-                    default: {
-                        if (is_number(c)) {
-                            int start = 0;
-                            while (start < (c - 0x30) - 1) {
-                                chess_ctx->board[rank][file] = (Chess_Piece){CHESS_PIECE_EMPTY, CHESS_COLOR_COLORLESS};
-                                start++;
-                                file++;
-                            }
-                        }
-                    } break;
-                }
+// The target square is behind the pawn that just moved: rank 6 if white is to move, rank 3 otherwise.
+static const char* en_passant_parse(Chess_Context* chess_ctx, const char* s, const char* end) {
+    if (*s == '-') {
+        ++s;
+        return is_field_end(s, end) ? s : NULL;
+    }
 
-                if (file >= 7 && rank == 0) {
-                    parsing_state = FEN_TO_MOVE;
-                } else {
-                    file += 1;
-                }
-            } break;
-
-            case FEN_TO_MOVE: {
-                if (c == 'w')
-                    chess_ctx->current_turn = CHESS_COLOR_WHITE;
-                else if (c == 'b')
-                    chess_ctx->current_turn = CHESS_COLOR_BLACK;
-                else
-                    return -1;
-                parsing_state = FEN_CASTLING;
-            } break;
-
-            case FEN_CASTLING: {
-                while (!is_whitespace(*fen_input)) {
-                    char c = *fen_input;
-                    if (c == '-')
-                        break;
-                    
-                    switch (c) {
-                        case 'K': chess_ctx->white_state.short_castling_available = 1;; break;
-                        case 'Q': chess_ctx->white_state.long_castling_available = 1; break;
-                        case 'k': chess_ctx->black_state.short_castling_available = 1; break;
-                        case 'q': chess_ctx->black_state.long_castling_available = 1; break;
-                        default: return -1;
-                    }
-                    ++fen_input;
-                }
-                parsing_state = FEN_EN_PASSANT;
-            } break;
-
-            case FEN_EN_PASSANT: {
-                if (c == '-') {
-                    chess_ctx->en_passant_info.available = 0;
-                    parsing_state = FEN_HALFMOVE;
-                } else {
-                    if (c >= 'a' && c <= 'h') {
-                        chess_ctx->en_passant_info.available = 1;
-                        if (chess_ctx->current_turn == CHESS_COLOR_WHITE) {
-                            chess_ctx->en_passant_info.pawn_position.y = 5;
-                            chess_ctx->en_passant_info.target.y = 6;
-                        } else {
-                            chess_ctx->en_passant_info.pawn_position.y = 3;
-                            chess_ctx->en_passant_info.target.y = 2;
-                        }
-                        chess_ctx->en_passant_info.pawn_position.x = c - 0x61;
-                        chess_ctx->en_passant_info.target.x = c - 0x61;
-                    }
-                    fen_input++;	// skip rank
-                    parsing_state = FEN_HALFMOVE;
-                }
-            } break;
-
-            case FEN_HALFMOVE: {
-                int length = 0;
-                while (!is_whitespace(*(fen_input + length))) length++;
-                char half_move_clock = (char)str_to_s32(fen_input, length);
-                parsing_state = FEN_FULLMOVE;
-            } break;
-
-            case FEN_FULLMOVE: {
-                int length = 0;
-                while (!is_whitespace(*(fen_input + length)) && *(fen_input + length)) length++;
-                char full_move_count = (char)str_to_s32(fen_input, length);
-                parsing_state = FEN_END;
-            } break;
-
-            case FEN_END: return 0;
+    char target_rank = chess_ctx->current_turn == CHESS_COLOR_WHITE ? '6' : '3';
+    if (end - s < 2 || s[0] < 'a' || s[0] > 'h' || s[1] != target_rank || !is_field_end(s + 2, end)) {
+        return NULL;
+    }
+    chess_ctx->en_passant_square = CHESS_SQUARE(target_rank - '1', s[0] - 'a');
+    return s + 2;
+}
+
+static const char* number_parse(const char* s, const char* end, unsigned max, unsigned* value) {
+    *value = 0;
+    for (; !is_field_end(s, end); ++s) {
+        if (!is_number(*s)) {
+            return NULL;
+        }
+        *value = *value * 10 + (*s - '0');
+        if (*value > max) {
+            *value = max;
+        }
+    }
+    return s;
+}
+
+static const char* field_parse(Chess_Context* chess_ctx, Fen_Field field, const char* s, const char* end) {
+    unsigned value;
+    switch (field) {
+        case FEN_BOARD: return board_parse(chess_ctx, s, end);
+        case FEN_TO_MOVE: return to_move_parse(chess_ctx, s, end);
+        case FEN_CASTLING: return castling_parse(chess_ctx, s, end);
+        case FEN_EN_PASSANT: return en_passant_parse(chess_ctx, s, end);
+        case FEN_HALFMOVE: {
+            s = number_parse(s, end, UINT8_MAX, &value);
+            chess_ctx->halfmove_clock = value;
+            return s;
+        }
+        case FEN_FULLMOVE: {
+            s = number_parse(s, end, UINT16_MAX, &value);
+            chess_ctx->fullmove_number = value ? value : 1;
+            return s;
         }
-        
-        ++fen_input;
+        default: return NULL;
     }
+}
 
+static void context_reset(Chess_Context* chess_ctx) {
+    memset(chess_ctx, 0, sizeof(Chess_Context));
+    chess_ctx->en_passant_square = CHESS_SQUARE_NONE;
+    chess_ctx->fullmove_number = 1;
+}
+
+// Runs once all the fields are in. Castling rights whose king or rook is not on its square are dropped, and an en
+// passant square without the pawn that just moved or a position where the side that just moved is in check is
+// refused.
+static int context_finish(Chess_Context* chess_ctx, int fields_num) {
+    if (fields_num < FEN_HALFMOVE) {
+        return -1;
+    }
+
+    chess_ctx->castling_rights &= chess_castling_rights_supported(chess_ctx);
+    if (!chess_en_passant_is_valid(chess_ctx)) {
+        return -1;
+    }
+
+    chess_ctx->hash ^= chess_hash_state_key(chess_ctx);
+    chess_check_flags_update(chess_ctx);
+    if (chess_is_king_under_attack(chess_ctx, CHESS_COLOR_OPPONENT(chess_ctx->current_turn))) {
+        return -1;
+    }
     return 0;
 }
 
+// Parses the FEN at the start of the view in a single pass. The halfmove and fullmove fields are optional, and
+// parsing stops before anything that can't start them (such as EPD operations). Returns the number of characters
+// used or -1 if the FEN is invalid.
+int fen_chess_context_parse_view(Chess_Context* chess_ctx, const char* fen, size_t length) {
+    const char* s = fen;
+    const char* end = fen + length;
+    int field = FEN_BOARD;
+
+    context_reset(chess_ctx);
+    for (; field < FEN_FIELDS; ++field) {
+        while (s < end && is_whitespace(*s)) {
+            ++s;
+        }
+        if (s == end || (field >= FEN_HALFMOVE && !is_number(*s))) {
+            break;
+        }
+        s = field_parse(chess_ctx, field, s, end);
+        if (!s) {
+            return -1;
+        }
+    }
+
+    if (context_finish(chess_ctx, field)) {
+        return -1;
+    }
+    return (int)(s - fen);
+}
+
+int fen_chess_context_parse(Chess_Context* chess_ctx, const char* fen) {
+    return fen_chess_context_parse_view(chess_ctx, fen, strlen(fen)) < 0 ? -1 : 0;
+}
+
+// UCI hands the FEN over as separate arguments, optionally followed by "moves" and a move list.
+// The context is left untouched when the FEN is invalid.
 int fen_chess_context_get(Chess_Context* chess_ctx, int argc, const char** argv) {
-    char* fen_input = malloc(FEN_PARSER_BUFFER_SIZE);
-    int moves_arg_position = build_fen_input(argc, argv, fen_input);
+    Chess_Context parsed;
+    int field = FEN_BOARD;
 
-    if (fen_to_chess_ctx(chess_ctx, fen_input)) {
-        free(fen_input);
+    context_reset(&parsed);
+    for (; field < argc && field < FEN_FIELDS && strcmp(argv[field], "moves"); ++field) {
+        const char* end = argv[field] + strlen(argv[field]);
+        if (field_parse(&parsed, field, argv[field], end) != end) {
+            return -1;
+        }
+    }
+    if (context_finish(&parsed, field)) {
         return -1;
     }
+    *chess_ctx = parsed;
 
-    if (moves_arg_position != -1) {
-        for (int i = moves_arg_position + 1; i < argc; ++i) {
-            const char* move = argv[i];
+    if (field < argc && !strcmp(argv[field], "moves")) {
+        for (int i = field + 1; i < argc; ++i) {
             Chess_Move chess_move = {0};
-            io_uci_notation_to_move(move, &chess_move);
+            chess_uci_notation_to_move(argv[i], &chess_move);
             chess_move_piece(chess_ctx, chess_ctx, &chess_move);
         }
+    } else if (field < argc) {
+        return -1;
     }
 
-    free(fen_input);
     return 0;
-}
\ No newline at end of file
+}
+
+// Writes the FEN with its terminator. Returns its length, or -1 if it does not fit in size bytes.
+int fen_from_context(const Chess_Context* chess_ctx, char* fen, size_t size) {
+    char buffer[FEN_MAX_SIZE];
+    char* out = buffer;
+
+    for (int rank = CHESS_BOARD_HEIGHT - 1; rank >= 0; --rank) {
+        int empty = 0;
+        for (int file = 0; file < CHESS_BOARD_WIDTH; ++file) {
+            Chess_Packed_Piece piece = chess_ctx->board[CHESS_SQUARE(rank, file)];
+            if (piece == CHESS_PIECE_EMPTY) {
+                ++empty;
+                continue;
+            }
+            if (empty) {
+                *out++ = '0' + empty;
+                empty = 0;
+            }
+            char c = fen_piece_chars[CHESS_PIECE_TYPE(piece)];
+            *out++ = CHESS_PIECE_COLOR(piece) == CHESS_COLOR_BLACK ? c - 'A' + 'a' : c;
+        }
+        if (empty) {
+            *out++ = '0' + empty;
+        }
+        *out++ = rank ? '/' : ' ';
+    }
+
+    *out++ = chess_ctx->current_turn == CHESS_COLOR_BLACK ? 'b' : 'w';
+    *out++ = ' ';
+
+    if (!chess_ctx->castling_rights) {
+        *out++ = '-';
+    }
+    if (chess_ctx->castling_rights & CHESS_CASTLING_WHITE_SHORT) *out++ = 'K';
+    if (chess_ctx->castling_rights & CHESS_CASTLING_WHITE_LONG) *out++ = 'Q';
+    if (chess_ctx->castling_rights & CHESS_CASTLING_BLACK_SHORT) *out++ = 'k';
+    if (chess_ctx->castling_rights & CHESS_CASTLING_BLACK_LONG) *out++ = 'q';
+    *out++ = ' ';
+
+    if (chess_ctx->en_passant_square == CHESS_SQUARE_NONE) {
+        *out++ = '-';
+    } else {
+        *out++ = 'a' + chess_ctx->en_passant_square % CHESS_BOARD_WIDTH;
+        *out++ = '1' + chess_ctx->en_passant_square / CHESS_BOARD_WIDTH;
+    }
+
+    out += snprintf(out, buffer + sizeof(buffer) - out, " %u %u", (unsigned)chess_ctx->halfmove_clock,
+        (unsigned)chess_ctx->fullmove_number);
+
+    int length = out - buffer;
+    if ((size_t)length + 1 > size) {
+        return -1;
+    }
+    memcpy(fen, buffer, length + 1);
+    return length;
+}
@@ -1,6 +1,13 @@
 #ifndef GOLDENPAWN_FEN_H
 #define GOLDENPAWN_FEN_H
 #include "chess.h"
+#include <stddef.h>
+
+// Longest FEN fen_from_context can write, terminator included.
+#define FEN_MAX_SIZE 96
 
 int fen_chess_context_get(Chess_Context* chess_ctx, int argc, const char** argv);
-#endif
\ No newline at end of file
+int fen_chess_context_parse(Chess_Context* chess_ctx, const char* fen);
+int fen_chess_context_parse_view(Chess_Context* chess_ctx, const char* fen, size_t length);
+int fen_from_context(const Chess_Context* chess_ctx, char* fen, size_t size);
+#endif
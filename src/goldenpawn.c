@@ -0,0 +1,306 @@
+#include "goldenpawn.h"
+#include "chess.h"
+#include "fen.h"
+#include "packed.h"
+#include "ai.h"
+#include "syzygy.h"
+#include "bitbase.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// All engine state lives here; the only static data behind it are lookup tables built once under pthread_once.
+struct Goldenpawn_Engine {
+    Chess_Context chess_ctx;
+    Syzygy_Context syzygy_ctx;
+    AI_Context ai_ctx;
+};
+
+typedef struct {
+    Goldenpawn_Search_Callback callback;
+    void* user_data;
+} Search_Callback_Data;
+
+typedef int (*Position_Load)(const void* positions, size_t index, Chess_Context* chess_ctx);
+
+typedef struct {
+    const void* positions;
+    Position_Load load;
+    size_t count;
+    int flags;
+    Goldenpawn_Evaluation* results;
+} Evaluation_Slice;
+
+_Static_assert(GOLDENPAWN_MAX_PV == AI_MAX_DEPTH, "the principal variation must fit the public result");
+
+Goldenpawn_Engine* goldenpawn_engine_create(size_t hash_size_mb) {
+    Goldenpawn_Engine* engine = malloc(sizeof(Goldenpawn_Engine));
+    if (!engine) {
+        return NULL;
+    }
+
+    bitbase_init();
+    syzygy_init(&engine->syzygy_ctx);
+    if (ai_init(&engine->ai_ctx, &engine->syzygy_ctx, hash_size_mb ? hash_size_mb : TT_DEFAULT_SIZE_MB, NULL)) {
+        syzygy_release(&engine->syzygy_ctx);
+        free(engine);
+        return NULL;
+    }
+    chess_context_from_position_input(&engine->chess_ctx, 0, NULL);
+    return engine;
+}
+
+void goldenpawn_engine_destroy(Goldenpawn_Engine* engine) {
+    if (!engine) {
+        return;
+    }
+    ai_release(&engine->ai_ctx);
+    syzygy_release(&engine->syzygy_ctx);
+    free(engine);
+}
+
+int goldenpawn_hash_size_set(Goldenpawn_Engine* engine, size_t hash_size_mb) {
+    if (hash_size_mb < 1 || hash_size_mb > TT_MAX_SIZE_MB) {
+        return -1;
+    }
+    return ai_hash_size_set(&engine->ai_ctx, hash_size_mb);
+}
+
+void goldenpawn_syzygy_path_set(Goldenpawn_Engine* engine, const char* path) {
+    syzygy_path_set(&engine->syzygy_ctx, path);
+}
+
+void goldenpawn_new_game(Goldenpawn_Engine* engine) {
+    ai_new_game(&engine->ai_ctx);
+}
+
+// The whole string must be the FEN; anything left after it, such as a move list, is an error.
+static int fen_parse(const char* fen, Chess_Context* chess_ctx) {
+    size_t length = strlen(fen);
+    int used = fen_chess_context_parse_view(chess_ctx, fen, length);
+    if (used < 0) {
+        return -1;
+    }
+    return strspn(fen + used, " \t\r\n") == length - used ? 0 : -1;
+}
+
+// Checks the notation before converting it, since the converter assumes well-formed input.
+static int move_parse(const Chess_Context* chess_ctx, const char* move_str, Chess_Packed_Move* packed_move) {
+    size_t length = strlen(move_str);
+    if (length != 4 && length != 5) {
+        return -1;
+    }
+    for (int i = 0; i < 4; i += 2) {
+        if (move_str[i] < 'a' || move_str[i] > 'h' || move_str[i + 1] < '1' || move_str[i + 1] > '8') {
+            return -1;
+        }
+    }
+    if (length == 5 && !strchr("qrbn", move_str[4])) {
+        return -1;
+    }
+
+    Chess_Move move;
+    Chess_Move_List move_list;
+    chess_uci_notation_to_move(move_str, &move);
+    *packed_move = chess_move_pack(chess_ctx, &move);
+    chess_generate_moves(chess_ctx, &move_list);
+    for (int i = 0; i < move_list.count; ++i) {
+        if (move_list.moves[i] == *packed_move) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int goldenpawn_position_set(Goldenpawn_Engine* engine, const char* fen, const char* const* moves, int moves_num) {
+    Chess_Context chess_ctx;
+    if (fen) {
+        if (fen_parse(fen, &chess_ctx)) {
+            return -1;
+        }
+    } else {
+        chess_context_from_position_input(&chess_ctx, 0, NULL);
+    }
+
+    for (int i = 0; i < moves_num; ++i) {
+        Chess_Packed_Move move;
+        if (move_parse(&chess_ctx, moves[i], &move)) {
+            return -1;
+        }
+        chess_make_move(&chess_ctx, &chess_ctx, move);
+    }
+
+    engine->chess_ctx = chess_ctx;
+    return 0;
+}
+
+int goldenpawn_position_set_fen(Goldenpawn_Engine* engine, const char* fen) {
+    return goldenpawn_position_set(engine, fen, NULL, 0);
+}
+
+static void result_convert(const AI_Result* ai_result, Goldenpawn_Result* result) {
+    Chess_Move move;
+
+    memset(result, 0, sizeof(Goldenpawn_Result));
+    if (ai_result->best_move != CHESS_MOVE_NONE) {
+        chess_move_unpack(ai_result->best_move, &move);
+        chess_move_to_uci_notation(&move, result->best_move);
+    }
+    result->score = ai_score_to_centipawns(ai_result->score);
+    result->depth = ai_result->depth;
+    result->nodes = ai_result->nodes;
+    result->pv_length = ai_result->pv_length;
+    for (int i = 0; i < ai_result->pv_length; ++i) {
+        chess_move_unpack(ai_result->pv[i], &move);
+        chess_move_to_uci_notation(&move, result->pv[i]);
+    }
+}
+
+static int search_callback(const AI_Result* ai_result, void* user_data) {
+    Search_Callback_Data* callback_data = user_data;
+    Goldenpawn_Result result;
+    result_convert(ai_result, &result);
+    return callback_data->callback(&result, callback_data->user_data);
+}
+
+int goldenpawn_search(Goldenpawn_Engine* engine, const Goldenpawn_Limits* limits, Goldenpawn_Search_Callback callback,
+    void* user_data, Goldenpawn_Result* result) {
+    Search_Callback_Data callback_data = { callback, user_data };
+    AI_Limits ai_limits;
+    AI_Result ai_result;
+
+    memset(&ai_limits, 0, sizeof(AI_Limits));
+    if (limits) {
+        if (limits->depth < 0 || limits->depth > AI_MAX_DEPTH) {
+            return -1;
+        }
+        ai_limits.depth = limits->depth;
+        ai_limits.nodes = limits->nodes;
+    }
+    if (callback) {
+        ai_limits.iteration_callback = search_callback;
+        ai_limits.user_data = &callback_data;
+    }
+
+    ai_search(&engine->ai_ctx, &engine->chess_ctx, &ai_limits, &ai_result);
+    result_convert(&ai_result, result);
+    return 0;
+}
+
+static uint64_t perft(const Chess_Context* chess_ctx, int depth) {
+    Chess_Move_List move_list;
+    Chess_Context child_ctx;
+
+    chess_generate_moves(chess_ctx, &move_list);
+    if (depth == 1) {
+        return move_list.count;
+    }
+
+    uint64_t nodes = 0;
+    for (int i = 0; i < move_list.count; ++i) {
+        chess_make_move(chess_ctx, &child_ctx, move_list.moves[i]);
+        nodes += perft(&child_ctx, depth - 1);
+    }
+    return nodes;
+}
+
+uint64_t goldenpawn_perft(Goldenpawn_Engine* engine, int depth) {
+    return depth > 0 ? perft(&engine->chess_ctx, depth) : 1;
+}
+
+int goldenpawn_evaluate(Goldenpawn_Engine* engine) {
+    return ai_score_to_centipawns(ai_evaluate(&engine->chess_ctx));
+}
+
+static int16_t score_to_int16(float score) {
+    int centipawns = ai_score_to_centipawns(score);
+    return centipawns > INT16_MAX ? INT16_MAX : centipawns <= INT16_MIN ? INT16_MIN + 1 : centipawns;
+}
+
+static void* evaluation_slice_run(void* arg) {
+    Evaluation_Slice* slice = arg;
+    Chess_Context chess_ctx;
+
+    for (size_t i = 0; i < slice->count; ++i) {
+        Goldenpawn_Evaluation* result = &slice->results[i];
+        result->static_score = GOLDENPAWN_EVALUATION_INVALID;
+        result->quiescence_score = GOLDENPAWN_EVALUATION_INVALID;
+        if (slice->load(slice->positions, i, &chess_ctx)) {
+            continue;
+        }
+        result->static_score = score_to_int16(ai_evaluate(&chess_ctx));
+        if (slice->flags & GOLDENPAWN_EVALUATE_QUIESCENCE) {
+            result->quiescence_score = score_to_int16(ai_quiescence(&chess_ctx));
+        }
+    }
+    return NULL;
+}
+
+static int fen_load(const void* positions, size_t index, Chess_Context* chess_ctx) {
+    return fen_chess_context_parse(chess_ctx, ((const char* const*)positions)[index]);
+}
+
+static int packed_load(const void* positions, size_t index, Chess_Context* chess_ctx) {
+    return packed_position_unpack(&((const Packed_Position*)positions)[index], chess_ctx);
+}
+
+// The positions are split in contiguous slices, one per thread; the calling thread takes the first one.
+static int evaluate_batch(const void* positions, size_t position_size, Position_Load load, size_t count, int flags,
+    int jobs, Goldenpawn_Evaluation* results) {
+    Evaluation_Slice* slices;
+    pthread_t* threads;
+
+    if (jobs < 1) {
+        return -1;
+    }
+    if ((size_t)jobs > count) {
+        jobs = count ? (int)count : 1;
+    }
+    bitbase_init();
+
+    slices = malloc(jobs * sizeof(Evaluation_Slice));
+    threads = malloc(jobs * sizeof(pthread_t));
+    if (!slices || !threads) {
+        free(slices);
+        free(threads);
+        return -1;
+    }
+
+    size_t start = 0;
+    for (int i = 0; i < jobs; ++i) {
+        size_t slice_count = count / jobs + ((size_t)i < count % jobs);
+        slices[i] = (Evaluation_Slice){ (const char*)positions + start * position_size, load, slice_count, flags,
+            results + start };
+        start += slice_count;
+    }
+
+    int started = 1;
+    for (; started < jobs; ++started) {
+        if (pthread_create(&threads[started], NULL, evaluation_slice_run, &slices[started])) {
+            break;
+        }
+    }
+    evaluation_slice_run(&slices[0]);
+    // Slices whose thread could not be started are run here.
+    for (int i = started; i < jobs; ++i) {
+        evaluation_slice_run(&slices[i]);
+    }
+    for (int i = 1; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(slices);
+    free(threads);
+    return 0;
+}
+
+int goldenpawn_evaluate_batch(const char* const* fens, size_t count, int flags, int jobs, Goldenpawn_Evaluation* results) {
+    return evaluate_batch(fens, sizeof(const char*), fen_load, count, flags, jobs, results);
+}
+
+_Static_assert(GOLDENPAWN_PACKED_POSITION_SIZE == sizeof(Packed_Position), "the public record size must match");
+
+int goldenpawn_evaluate_packed_batch(const void* positions, size_t count, int flags, int jobs,
+    Goldenpawn_Evaluation* results) {
+    return evaluate_batch(positions, sizeof(Packed_Position), packed_load, count, flags, jobs, results);
+}
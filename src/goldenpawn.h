@@ -0,0 +1,70 @@
+#ifndef GOLDENPAWN_H
+#define GOLDENPAWN_H
+#include <stddef.h>
+#include <stdint.h>
+
+// Embedding API, built into libgoldenpawn.a. Every call works on its own engine, so separate engines can be used
+// from separate threads at the same time; a single engine must not be called from two threads at once.
+// Functions returning int give 0 on success and -1 on error.
+
+#define GOLDENPAWN_MOVE_SIZE 6
+#define GOLDENPAWN_MAX_PV 64
+#define GOLDENPAWN_PACKED_POSITION_SIZE 32
+
+typedef struct Goldenpawn_Engine Goldenpawn_Engine;
+
+// A zero field means no limit; with neither set the search uses the engine's default depth.
+typedef struct {
+    int depth;
+    uint64_t nodes;
+} Goldenpawn_Limits;
+
+// Moves are in UCI notation and the score is in centipawns from the point of view of the side to move.
+// best_move is empty when the side to move has no legal move.
+typedef struct {
+    char best_move[GOLDENPAWN_MOVE_SIZE];
+    int score;
+    int depth;
+    uint64_t nodes;
+    int pv_length;
+    char pv[GOLDENPAWN_MAX_PV][GOLDENPAWN_MOVE_SIZE];
+} Goldenpawn_Result;
+
+// Scores of one position in centipawns from the point of view of the side to move. A batch output file is an
+// array of these records in host byte order.
+typedef struct {
+    int16_t static_score;
+    int16_t quiescence_score;
+} Goldenpawn_Evaluation;
+
+#define GOLDENPAWN_EVALUATION_INVALID INT16_MIN
+// Without this flag quiescence_score is left at GOLDENPAWN_EVALUATION_INVALID.
+#define GOLDENPAWN_EVALUATE_QUIESCENCE 0x1
+
+// Called after every completed iteration; returning non-zero ends the search with that iteration's result.
+typedef int (*Goldenpawn_Search_Callback)(const Goldenpawn_Result* result, void* user_data);
+
+Goldenpawn_Engine* goldenpawn_engine_create(size_t hash_size_mb);
+void goldenpawn_engine_destroy(Goldenpawn_Engine* engine);
+int goldenpawn_hash_size_set(Goldenpawn_Engine* engine, size_t hash_size_mb);
+void goldenpawn_syzygy_path_set(Goldenpawn_Engine* engine, const char* path);
+void goldenpawn_new_game(Goldenpawn_Engine* engine);
+
+// A NULL fen means the starting position. Illegal moves are rejected and leave the position unchanged.
+int goldenpawn_position_set(Goldenpawn_Engine* engine, const char* fen, const char* const* moves, int moves_num);
+int goldenpawn_position_set_fen(Goldenpawn_Engine* engine, const char* fen);
+
+int goldenpawn_search(Goldenpawn_Engine* engine, const Goldenpawn_Limits* limits, Goldenpawn_Search_Callback callback,
+    void* user_data, Goldenpawn_Result* result);
+uint64_t goldenpawn_perft(Goldenpawn_Engine* engine, int depth);
+int goldenpawn_evaluate(Goldenpawn_Engine* engine);
+
+// Evaluates count FENs on up to jobs threads, without an engine and without allocating per position. Positions
+// that fail to parse get GOLDENPAWN_EVALUATION_INVALID in both scores.
+int goldenpawn_evaluate_batch(const char* const* fens, size_t count, int flags, int jobs, Goldenpawn_Evaluation* results);
+// Same for packed position records, as stored after the header of a packed file (see `goldenpawn pack`). The
+// scores and results stored in the records are ignored.
+int goldenpawn_evaluate_packed_batch(const void* positions, size_t count, int flags, int jobs,
+    Goldenpawn_Evaluation* results);
+
+#endif
@@ -2,130 +2,763 @@
 #include "logger.h"
 #include "ai.h"
 #include "fen.h"
+#include "bitbase.h"
+#include "memory.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
-#define IO_BUFFER_SIZE 4096
+#define IO_BUFFER_SIZE (256 * 1024)
+#define IO_READ_SIZE (64 * 1024)
 #define IO_ARGV_SIZE 256
 
+#define IO_FETCH_END -1
+#define IO_FETCH_AGAIN -2
 
-static int command_fetch(char* buffer, char** argv) {
-    gets(buffer);
-    log_debug("received '%s' command", buffer);
-    size_t len = strlen(buffer);
+// Kept off every move for the time the move takes to reach the GUI.
+#define IO_MOVE_OVERHEAD_MS 30
+// Assumed number of moves left when the GUI sends no movestogo.
+#define IO_DEFAULT_MOVES_TO_GO 30
 
-    if (len == 0) {
-        return 0;
+
+// Returns the next line without its terminator, or NULL at end of input. The line stays valid until the next call.
+// Input is read in large chunks and the buffer grows as needed, so there is no limit on the line length.
+// On a nonblocking context NULL is also returned when no complete line is available yet, with *again set.
+static char* line_read(IO_Context* io_ctx, int* again) {
+    *again = 0;
+    if (io_ctx->line_length) {
+        io_ctx->buffer_length -= io_ctx->line_length;
+        memmove(io_ctx->buffer, io_ctx->buffer + io_ctx->line_length, io_ctx->buffer_length);
+        io_ctx->line_length = 0;
     }
 
-    argv[0] = buffer;
-    int argc = 1;
-    int last_was_space = 0;
-    for (size_t i = 0; i < len; ++i) {
-        if (last_was_space) {
-            if (buffer[i] != ' ') {
-                last_was_space = 0;
-                argv[argc++] = buffer + i;
+    size_t scanned = 0;
+    for (;;) {
+        char* newline = memchr(io_ctx->buffer + scanned, '\n', io_ctx->buffer_length - scanned);
+        if (newline) {
+            *newline = '\0';
+            io_ctx->line_length = newline - io_ctx->buffer + 1;
+            return io_ctx->buffer;
+        }
+        scanned = io_ctx->buffer_length;
+
+        if (io_ctx->buffer_capacity - io_ctx->buffer_length < IO_READ_SIZE + 1) {
+            size_t capacity = io_ctx->buffer_capacity * 2;
+            char* buffer = realloc(io_ctx->buffer, capacity);
+            if (!buffer) {
+                log_debug("Error: could not grow the input buffer to %zu bytes", capacity);
+                return NULL;
             }
-        } else {
-            if (buffer[i] == ' ') {
-                buffer[i] = '\0';
-                last_was_space = 1;
+            io_ctx->buffer = buffer;
+            io_ctx->buffer_capacity = capacity;
+        }
+
+        char* target = io_ctx->buffer + io_ctx->buffer_length;
+        size_t space = io_ctx->buffer_capacity - io_ctx->buffer_length - 1;
+        ssize_t read_bytes = io_ctx->nonblocking ? recv(io_ctx->input_fd, target, space, MSG_DONTWAIT) : read(io_ctx->input_fd, target, space);
+        if (read_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (read_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            *again = 1;
+            return NULL;
+        }
+        if (read_bytes <= 0) {
+            // End of input: hand out what is left as a last line.
+            if (!io_ctx->buffer_length) {
+                return NULL;
             }
+            io_ctx->buffer[io_ctx->buffer_length] = '\0';
+            io_ctx->line_length = io_ctx->buffer_length;
+            return io_ctx->buffer;
+        }
+        io_ctx->buffer_length += read_bytes;
+    }
+}
+
+static int is_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Splits the next line in place. Returns the number of arguments, 0 for a blank line, IO_FETCH_END at end of input
+// or IO_FETCH_AGAIN when a nonblocking context has no complete line yet.
+static int command_fetch(IO_Context* io_ctx) {
+    int again;
+    char* line = line_read(io_ctx, &again);
+    if (!line) {
+        return again ? IO_FETCH_AGAIN : IO_FETCH_END;
+    }
+    log_debug("received '%s' command", line);
+
+    int argc = 0;
+    while (*line) {
+        while (is_separator(*line)) {
+            *line++ = '\0';
+        }
+        if (!*line) {
+            break;
+        }
+
+        if (argc == io_ctx->argv_capacity) {
+            char** argv = realloc(io_ctx->argv, sizeof(char*) * io_ctx->argv_capacity * 2);
+            if (!argv) {
+                log_debug("Error: could not grow the argument list to %d entries", io_ctx->argv_capacity * 2);
+                return 0;
+            }
+            io_ctx->argv = argv;
+            io_ctx->argv_capacity *= 2;
+        }
+        io_ctx->argv[argc++] = line;
+
+        while (*line && !is_separator(*line)) {
+            ++line;
         }
     }
 
     return argc;
 }
 
-static void command_send(char* command) {
-    printf("%s\n", command);
-    fflush(stdout);
-};
+static void command_send(IO_Context* io_ctx, const char* command) {
+    char buffer[512];
+    size_t length = strlen(command);
+    if (length > sizeof(buffer) - 1) {
+        length = sizeof(buffer) - 1;
+    }
+    memcpy(buffer, command, length);
+    buffer[length++] = '\n';
 
-void io_init(IO_Context* io_ctx) {
-    io_ctx->buffer = malloc(sizeof(char) * IO_BUFFER_SIZE);
-    io_ctx->argv = malloc(sizeof(char*) * IO_ARGV_SIZE);
+    for (size_t written = 0; written < length;) {
+        ssize_t written_bytes = write(io_ctx->output_fd, buffer + written, length - written);
+        if (written_bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written_bytes <= 0) {
+            log_debug("Error: could not send '%s'", command);
+            return;
+        }
+        written += written_bytes;
+    }
 }
 
-void io_start(IO_Context* io_ctx) {
-    log_debug("Initializing goldenpawn engine");
+static void hash_info_send(IO_Context* io_ctx) {
+    const TT_Context* tt_ctx = &io_ctx->ai_ctx.tt_ctx;
+    char buffer[256];
+    int length = snprintf(buffer, sizeof(buffer), "info string hash %zu MB on %s%s", tt_ctx->size_mb,
+        memory_pages_name(tt_ctx->memory.pages), tt_ctx->memory.interleaved ? ", interleaved over the NUMA nodes" : "");
+    if (tt_ctx->shared) {
+        snprintf(buffer + length, sizeof(buffer) - length, " %s, attached by %u processes", tt_ctx->shared_name,
+            __atomic_load_n(&tt_ctx->shared->attached, __ATOMIC_RELAXED));
+    }
+    command_send(io_ctx, buffer);
+}
 
-    for (;;) {
-        int argc = command_fetch(io_ctx->buffer, io_ctx->argv);
-        if (!strcmp("quit", io_ctx->argv[0])) {
-            log_debug("Exiting goldenpawn engine");
+// Values such as paths run to the end of the line; the separators cut out of them are put back as spaces.
+static char* option_value_join(int argc, char** argv) {
+    for (char* c = argv[4]; c < argv[argc - 1]; ++c) {
+        if (!*c) {
+            *c = ' ';
+        }
+    }
+    return argv[4];
+}
+
+static void option_set(IO_Context* io_ctx, int argc, char** argv) {
+    // setoption name <name> value <value>
+    if (argc < 5 || strcmp(argv[1], "name") || strcmp(argv[3], "value")) {
+        log_debug("Error: malformed setoption command");
+        return;
+    }
+
+    if (!strcmp(argv[2], "SyzygyPath")) {
+        syzygy_path_set(&io_ctx->syzygy_ctx, option_value_join(argc, argv));
+    } else if (!strcmp(argv[2], "SyzygyProbeDepth")) {
+        io_ctx->syzygy_ctx.probe_depth = atoi(argv[4]);
+    } else if (!strcmp(argv[2], "SyzygyProbeLimit")) {
+        io_ctx->syzygy_ctx.probe_limit = atoi(argv[4]);
+    } else if (!strcmp(argv[2], "Hash")) {
+        int size_mb = atoi(argv[4]);
+        if (size_mb < 1 || size_mb > TT_MAX_SIZE_MB || ai_hash_size_set(&io_ctx->ai_ctx, size_mb)) {
+            log_debug("Error: invalid hash size %s", argv[4]);
+        }
+        hash_info_send(io_ctx);
+    } else if (!strcmp(argv[2], "EvalCache")) {
+        int size_mb = atoi(argv[4]);
+        if (size_mb < 0 || size_mb > AI_EVAL_CACHE_MAX_SIZE_MB || ai_eval_cache_size_set(&io_ctx->ai_ctx, size_mb)) {
+            log_debug("Error: invalid eval cache size %s", argv[4]);
+        }
+    } else if (!strcmp(argv[2], "SaveHash")) {
+        if (tt_save(&io_ctx->ai_ctx.tt_ctx, option_value_join(argc, argv))) {
+            command_send(io_ctx, "info string could not save the hash");
+        }
+    } else if (!strcmp(argv[2], "LoadHash")) {
+        if (tt_load(&io_ctx->ai_ctx.tt_ctx, option_value_join(argc, argv))) {
+            command_send(io_ctx, "info string could not load the hash");
+        }
+        hash_info_send(io_ctx);
+    } else if (!strcmp(argv[2], "SharedHash")) {
+        // <empty> goes back to a table of this process alone.
+        const char* name = option_value_join(argc, argv);
+        size_t size_mb = io_ctx->ai_ctx.tt_ctx.size_mb;
+        int failed = !strcmp(name, "<empty>") ? ai_hash_size_set(&io_ctx->ai_ctx, size_mb) :
+            tt_share(&io_ctx->ai_ctx.tt_ctx, name, size_mb);
+        if (failed) {
+            command_send(io_ctx, "info string could not set up the shared hash");
+        }
+        hash_info_send(io_ctx);
+    } else if (!strcmp(argv[2], "MultiPV")) {
+        int multi_pv = atoi(argv[4]);
+        if (multi_pv < 1 || multi_pv > AI_MAX_MULTI_PV) {
+            log_debug("Error: invalid MultiPV %s", argv[4]);
+        } else {
+            io_ctx->multi_pv = multi_pv;
+        }
+    } else if (!strcmp(argv[2], "LogFile")) {
+        log_file_set(option_value_join(argc, argv));
+    } else {
+        log_debug("Error: unknown option %s", argv[2]);
+    }
+}
+
+static void position_forget(IO_Context* io_ctx) {
+    io_ctx->position_base[0] = '\0';
+    io_ctx->position_moves_num = 0;
+}
+
+static int position_moves_reserve(IO_Context* io_ctx, int moves_num) {
+    if (moves_num <= io_ctx->position_moves_capacity) {
+        return 0;
+    }
+    int capacity = io_ctx->position_moves_capacity ? io_ctx->position_moves_capacity : 256;
+    while (capacity < moves_num) {
+        capacity *= 2;
+    }
+    char (*moves)[IO_MOVE_SIZE] = realloc(io_ctx->position_moves, capacity * IO_MOVE_SIZE);
+    if (!moves) {
+        return -1;
+    }
+    io_ctx->position_moves = moves;
+    io_ctx->position_moves_capacity = capacity;
+    return 0;
+}
+
+// Everything between "position" and "moves", which identifies the starting position.
+static int position_base_build(int moves_index, char** argv, char* base) {
+    int length = 0;
+    base[0] = '\0';
+    for (int i = 1; i < moves_index; ++i) {
+        int arg_length = strlen(argv[i]);
+        if (length + arg_length + 2 > IO_POSITION_BASE_SIZE) {
+            base[0] = '\0';
+            return -1;
+        }
+        if (length) {
+            base[length++] = ' ';
+        }
+        memcpy(base + length, argv[i], arg_length + 1);
+        length += arg_length;
+    }
+    return 0;
+}
+
+static void position_set(IO_Context* io_ctx, int argc, char** argv) {
+    // position [startpos | fen <fen>] [moves <move1> ... <moveN>]
+    if (argc < 2) {
+        log_debug("Error: malformed position command");
+        return;
+    }
+
+    int moves_index = argc;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "moves")) {
+            moves_index = i;
+            break;
+        }
+    }
+    int moves_num = moves_index < argc ? argc - moves_index - 1 : 0;
+    char** moves = argv + moves_index + 1;
+
+    char base[IO_POSITION_BASE_SIZE];
+    int incremental = !position_base_build(moves_index, argv, base) && !strcmp(base, io_ctx->position_base) &&
+        moves_num >= io_ctx->position_moves_num;
+    for (int i = 0; incremental && i < io_ctx->position_moves_num; ++i) {
+        incremental = !strcmp(moves[i], io_ctx->position_moves[i]);
+    }
+
+    int applied_moves_num = 0;
+    if (incremental) {
+        Chess_Move move;
+        for (int i = io_ctx->position_moves_num; i < moves_num; ++i) {
+            chess_uci_notation_to_move(moves[i], &move);
+            chess_move_piece(&io_ctx->chess_ctx, &io_ctx->chess_ctx, &move);
+        }
+        applied_moves_num = io_ctx->position_moves_num;
+    } else if (!strcmp(argv[1], "fen")) {
+        if (fen_chess_context_get(&io_ctx->chess_ctx, argc - 2, (const char**)argv + 2)) {
+            log_debug("Error: invalid fen");
+            position_forget(io_ctx);
             return;
-        } else if (!strcmp(io_ctx->argv[0], "uci")) {
-            command_send("id name Goldenpawn");
-            command_send("id author Felipe Kersting");
-            command_send("uciok");
-        } else if (!strcmp(io_ctx->argv[0], "isready")) {
-            command_send("readyok");
-        } else if (!strcmp(io_ctx->argv[0], "ucinewgame")) {
-        } else if (!strcmp(io_ctx->argv[0], "position")) {
-            if (!strcmp(io_ctx->argv[1], "fen")) {
-                fen_chess_context_get(&io_ctx->chess_ctx, argc - 2, io_ctx->argv + 2);
-            } else if (!strcmp(io_ctx->argv[1], "startpos")) {
-                chess_context_from_position_input(&io_ctx->chess_ctx, argc - 2, io_ctx->argv + 2);
-            }
-        } else if (!strcmp(io_ctx->argv[0], "go")) {
-            char buffer[256];
-            strcpy(buffer, "bestmove ");
-            ai_get_best_move(&io_ctx->chess_ctx, buffer + strlen(buffer));
-            command_send(buffer);
-        }
-    }
-}
-
-void io_move_to_uci_notation(const Chess_Move* move, char* uci_str) {
-    uci_str[0] = move->from.x + 'a';
-    uci_str[1] = move->from.y + '0' + 1;
-    uci_str[2] = move->to.x + 'a';
-    uci_str[3] = move->to.y + '0' + 1;
-
-    if (move->will_promote) {
-        switch (move->promotion_type) {
-            case CHESS_PIECE_QUEEN: {
-                uci_str[4] = 'q';
-            } break;
-            case CHESS_PIECE_ROOK: {
-                uci_str[4] = 'r';
-            } break;
-            case CHESS_PIECE_BISHOP: {
-                uci_str[4] = 'b';
-            } break;
-            case CHESS_PIECE_KNIGHT: {
-                uci_str[4] = 'n';
-            } break;
-            default: {
-                assert(0);
-            } break;
-        }
-        uci_str[5] = '\0';
+        }
+    } else if (!strcmp(argv[1], "startpos")) {
+        chess_context_from_position_input(&io_ctx->chess_ctx, argc - 2, (const char**)argv + 2);
+    } else {
+        log_debug("Error: unknown position %s", argv[1]);
+        position_forget(io_ctx);
+        return;
+    }
+
+    if (!base[0] || position_moves_reserve(io_ctx, moves_num)) {
+        position_forget(io_ctx);
+        return;
+    }
+    strcpy(io_ctx->position_base, base);
+    for (int i = applied_moves_num; i < moves_num; ++i) {
+        strncpy(io_ctx->position_moves[i], moves[i], IO_MOVE_SIZE - 1);
+        io_ctx->position_moves[i][IO_MOVE_SIZE - 1] = '\0';
+    }
+    io_ctx->position_moves_num = moves_num;
+}
+
+static void move_to_str(Chess_Packed_Move packed_move, char* move_str) {
+    Chess_Move move;
+    if (packed_move == CHESS_MOVE_NONE) {
+        strcpy(move_str, "0000");
+        return;
+    }
+    chess_move_unpack(packed_move, &move);
+    chess_move_to_uci_notation(&move, move_str);
+}
+
+static void search_line_send(IO_Context* io_ctx, const AI_Result* result, int line_index, uint64_t elapsed_ms) {
+    const AI_Line* line = &result->lines[line_index];
+    char buffer[512];
+    int length = snprintf(buffer, sizeof(buffer), "info depth %d", result->depth);
+
+    if (io_ctx->search_limits.multi_pv > 1) {
+        length += snprintf(buffer + length, sizeof(buffer) - length, " multipv %d", line_index + 1);
+    }
+    int mate = ai_score_to_mate(line->score);
+    length += snprintf(buffer + length, sizeof(buffer) - length, " score %s %d nodes %llu time %llu nps %llu pv",
+        mate ? "mate" : "cp", mate ? mate : ai_score_to_centipawns(line->score), (unsigned long long)result->nodes,
+        (unsigned long long)elapsed_ms, (unsigned long long)(result->nodes * 1000 / (elapsed_ms + 1)));
+    for (int i = 0; i < line->pv_length && length + IO_MOVE_SIZE + 1 < (int)sizeof(buffer); ++i) {
+        buffer[length++] = ' ';
+        move_to_str(line->pv[i], buffer + length);
+        length += strlen(buffer + length);
+    }
+    command_send(io_ctx, buffer);
+}
+
+static int search_info_send(const AI_Result* result, void* user_data) {
+    IO_Context* io_ctx = user_data;
+    uint64_t elapsed_ms = (ai_time_now_ns() - io_ctx->search_started_ns) / 1000000;
+
+    for (int i = 0; i < result->lines_num; ++i) {
+        search_line_send(io_ctx, result, i, elapsed_ms);
+    }
+    return 0;
+}
+
+// Fills the result with the mating line when there is one. Otherwise the normal search picks the move to play.
+static int mate_run(IO_Context* io_ctx, AI_Result* result) {
+    Mate_Result mate_result;
+    char buffer[512];
+
+    if (!io_ctx->mate_ctx.entries && mate_init(&io_ctx->mate_ctx, MATE_HASH_SIZE_MB)) {
+        command_send(io_ctx, "info string could not allocate the mate search table");
+        return 0;
+    }
+    if (io_ctx->search_limits.time_ms) {
+        ai_deadline_set(&io_ctx->ai_ctx, io_ctx->search_limits.time_ms);
+    }
+    Mate_Limits limits = { io_ctx->search_mate, io_ctx->search_limits.nodes, &io_ctx->ai_ctx.stop_requested,
+        &io_ctx->ai_ctx.deadline_ns };
+    uint64_t mate_started_ns = ai_time_now_ns();
+    mate_search(&io_ctx->mate_ctx, &io_ctx->search_ctx, &limits, &mate_result);
+
+    uint64_t elapsed_ms = (ai_time_now_ns() - io_ctx->search_started_ns) / 1000000;
+    if (mate_result.status != MATE_STATUS_FOUND) {
+        snprintf(buffer, sizeof(buffer), mate_result.status == MATE_STATUS_NONE ? "info string no mate in %d, %llu nodes" :
+            "info string mate in %d not decided after %llu nodes", io_ctx->search_mate, (unsigned long long)mate_result.nodes);
+        command_send(io_ctx, buffer);
+
+        // The regular search that follows only gets what the mate search left of the limits.
+        uint64_t mate_ms = (ai_time_now_ns() - mate_started_ns) / 1000000;
+        if (io_ctx->search_limits.time_ms) {
+            io_ctx->search_limits.time_ms = io_ctx->search_limits.time_ms > mate_ms ?
+                io_ctx->search_limits.time_ms - mate_ms : 1;
+        }
+        if (io_ctx->search_limits.nodes) {
+            io_ctx->search_limits.nodes = io_ctx->search_limits.nodes > mate_result.nodes ?
+                io_ctx->search_limits.nodes - mate_result.nodes : 1;
+        }
+        return 0;
+    }
+
+    int length = snprintf(buffer, sizeof(buffer), "info depth %d score mate %d nodes %llu time %llu nps %llu pv",
+        2 * mate_result.moves - 1, mate_result.moves, (unsigned long long)mate_result.nodes, (unsigned long long)elapsed_ms,
+        (unsigned long long)(mate_result.nodes * 1000 / (elapsed_ms + 1)));
+    for (int i = 0; i < mate_result.pv_length && length + IO_MOVE_SIZE + 1 < (int)sizeof(buffer); ++i) {
+        buffer[length++] = ' ';
+        move_to_str(mate_result.pv[i], buffer + length);
+        length += strlen(buffer + length);
+    }
+    command_send(io_ctx, buffer);
+
+    memset(result, 0, sizeof(AI_Result));
+    result->best_move = mate_result.pv[0];
+    result->depth = 2 * mate_result.moves - 1;
+    result->nodes = mate_result.nodes;
+    result->pv_length = mate_result.pv_length < AI_MAX_DEPTH ? mate_result.pv_length : AI_MAX_DEPTH;
+    memcpy(result->pv, mate_result.pv, result->pv_length * sizeof(Chess_Packed_Move));
+    return 1;
+}
+
+void io_search_slots_init(IO_Search_Slots* search_slots, int slots_num) {
+    pthread_mutex_init(&search_slots->mutex, NULL);
+    pthread_cond_init(&search_slots->released, NULL);
+    search_slots->available = slots_num;
+}
+
+void io_search_slots_release(IO_Search_Slots* search_slots) {
+    pthread_cond_destroy(&search_slots->released);
+    pthread_mutex_destroy(&search_slots->mutex);
+}
+
+// Returns 0 when the search was stopped before it got a slot.
+static int search_slot_acquire(IO_Context* io_ctx) {
+    IO_Search_Slots* search_slots = io_ctx->search_slots;
+    if (!search_slots) {
+        return 1;
+    }
+    pthread_mutex_lock(&search_slots->mutex);
+    while (!search_slots->available && !atomic_load(&io_ctx->ai_ctx.stop_requested)) {
+        pthread_cond_wait(&search_slots->released, &search_slots->mutex);
+    }
+    int acquired = search_slots->available > 0 && !atomic_load(&io_ctx->ai_ctx.stop_requested);
+    search_slots->available -= acquired;
+    pthread_mutex_unlock(&search_slots->mutex);
+    return acquired;
+}
+
+static void search_slot_release(IO_Context* io_ctx) {
+    IO_Search_Slots* search_slots = io_ctx->search_slots;
+    if (search_slots) {
+        pthread_mutex_lock(&search_slots->mutex);
+        ++search_slots->available;
+        pthread_cond_broadcast(&search_slots->released);
+        pthread_mutex_unlock(&search_slots->mutex);
+    }
+}
+
+static void* search_run(void* arg) {
+    IO_Context* io_ctx = arg;
+    AI_Result result;
+    char buffer[64];
+
+    memset(&result, 0, sizeof(AI_Result));
+    if (search_slot_acquire(io_ctx)) {
+        // The clock kept running while the search waited for its slot.
+        uint64_t waited_ms = (ai_time_now_ns() - io_ctx->search_started_ns) / 1000000;
+        if (io_ctx->search_limits.time_ms) {
+            io_ctx->search_limits.time_ms = io_ctx->search_limits.time_ms > waited_ms ?
+                io_ctx->search_limits.time_ms - waited_ms : 1;
+        }
+        if (!io_ctx->search_mate || !mate_run(io_ctx, &result)) {
+            ai_search(&io_ctx->ai_ctx, &io_ctx->search_ctx, &io_ctx->search_limits, &result);
+        }
+        search_slot_release(io_ctx);
+    }
+    if (result.best_move == CHESS_MOVE_NONE) {
+        // Stopped while waiting for a slot or during the mate search, which leaves no time to settle on a move.
+        Chess_Move_List move_list;
+        chess_generate_moves(&io_ctx->search_ctx, &move_list);
+        result.best_move = move_list.count ? move_list.moves[0] : CHESS_MOVE_NONE;
+        result.pv_length = 0;
+    }
+    if (result.eval_probes) {
+        char stats[128];
+        snprintf(stats, sizeof(stats), "info string eval cache hits %llu of %llu probes (%.1f%%)",
+            (unsigned long long)result.eval_hits, (unsigned long long)result.eval_probes,
+            100.0 * result.eval_hits / result.eval_probes);
+        command_send(io_ctx, stats);
+    }
+
+    pthread_mutex_lock(&io_ctx->search_mutex);
+    while (io_ctx->search_held && !atomic_load(&io_ctx->ai_ctx.stop_requested)) {
+        pthread_cond_wait(&io_ctx->search_cond, &io_ctx->search_mutex);
+    }
+    pthread_mutex_unlock(&io_ctx->search_mutex);
+
+    strcpy(buffer, "bestmove ");
+    move_to_str(result.best_move, buffer + strlen(buffer));
+    if (result.pv_length > 1) {
+        strcat(buffer, " ponder ");
+        move_to_str(result.pv[1], buffer + strlen(buffer));
+    }
+    command_send(io_ctx, buffer);
+    log_debug("best move sent after %llu nodes, with evaluation of %.3f", (unsigned long long)result.nodes, result.score);
+    return NULL;
+}
+
+static void search_join(IO_Context* io_ctx) {
+    if (io_ctx->searching) {
+        pthread_join(io_ctx->search_thread, NULL);
+        io_ctx->searching = 0;
+    }
+}
+
+// Ends the running search early; its best move is sent before this returns.
+static void search_stop(IO_Context* io_ctx) {
+    if (!io_ctx->searching) {
+        return;
+    }
+    pthread_mutex_lock(&io_ctx->search_mutex);
+    ai_stop(&io_ctx->ai_ctx);
+    pthread_cond_signal(&io_ctx->search_cond);
+    pthread_mutex_unlock(&io_ctx->search_mutex);
+    if (io_ctx->search_slots) {
+        pthread_mutex_lock(&io_ctx->search_slots->mutex);
+        pthread_cond_broadcast(&io_ctx->search_slots->released);
+        pthread_mutex_unlock(&io_ctx->search_slots->mutex);
+    }
+    search_join(io_ctx);
+}
+
+// Lets a bounded search finish before the next command touches the engine; a held one would never end, so it is
+// stopped instead.
+static void search_finish(IO_Context* io_ctx) {
+    if (!io_ctx->searching) {
+        return;
+    }
+    pthread_mutex_lock(&io_ctx->search_mutex);
+    int held = io_ctx->search_held;
+    pthread_mutex_unlock(&io_ctx->search_mutex);
+    if (held) {
+        search_stop(io_ctx);
     } else {
-        uci_str[4] = '\0';
+        search_join(io_ctx);
     }
 }
 
-void io_uci_notation_to_move(const char* uci_str, Chess_Move* move) {
-    int uci_str_len = strlen(uci_str);
-    move->from = CHESS_POS(uci_str[1] - '0' - 1, uci_str[0] - 'a');
-    move->to = CHESS_POS(uci_str[3] - '0' - 1, uci_str[2] - 'a');
+// A slice of the remaining time, keeping a margin for the move to reach the GUI.
+static uint64_t time_budget(uint64_t time_left, uint64_t increment, int moves_to_go) {
+    uint64_t budget = time_left / (moves_to_go > 0 ? moves_to_go : IO_DEFAULT_MOVES_TO_GO) + increment * 3 / 4;
+    uint64_t limit = time_left > 2 * IO_MOVE_OVERHEAD_MS ? time_left - IO_MOVE_OVERHEAD_MS : time_left / 2;
+    budget = budget < limit ? budget : limit;
+    return budget ? budget : 1;
+}
+
+static void go_start(IO_Context* io_ctx, int argc, char** argv) {
+    // go [ponder] [infinite] [wtime <ms>] [btime <ms>] [winc <ms>] [binc <ms>] [movestogo <n>] [movetime <ms>]
+    //    [depth <n>] [nodes <n>] [mate <n>]
+    AI_Limits limits;
+    uint64_t times[2] = { 0 }, increments[2] = { 0 }, move_time = 0;
+    int moves_to_go = 0, ponder = 0, timed = 0, mate = 0;
 
-    // Pawn reached last rank.
-    if (uci_str_len == 5) {
-        switch(uci_str[4]) {
-            case 'b': move->promotion_type = CHESS_PIECE_BISHOP; break;
-            case 'n': move->promotion_type = CHESS_PIECE_KNIGHT; break;
-            case 'q': move->promotion_type = CHESS_PIECE_QUEEN; break;
-            case 'r': move->promotion_type = CHESS_PIECE_ROOK; break;
-            default: assert(0);
+    memset(&limits, 0, sizeof(AI_Limits));
+    for (int i = 1; i < argc; ++i) {
+        const char* value = i + 1 < argc ? argv[i + 1] : "0";
+        if (!strcmp(argv[i], "ponder")) {
+            ponder = 1;
+        } else if (!strcmp(argv[i], "infinite")) {
+            limits.infinite = 1;
+        } else if (!strcmp(argv[i], "wtime") || !strcmp(argv[i], "btime")) {
+            times[argv[i][0] == 'b'] = strtoull(value, NULL, 10);
+            timed = 1;
+            ++i;
+        } else if (!strcmp(argv[i], "winc") || !strcmp(argv[i], "binc")) {
+            increments[argv[i][0] == 'b'] = strtoull(value, NULL, 10);
+            ++i;
+        } else if (!strcmp(argv[i], "movestogo")) {
+            moves_to_go = atoi(value);
+            ++i;
+        } else if (!strcmp(argv[i], "movetime")) {
+            move_time = strtoull(value, NULL, 10);
+            ++i;
+        } else if (!strcmp(argv[i], "depth")) {
+            limits.depth = atoi(value);
+            ++i;
+        } else if (!strcmp(argv[i], "nodes")) {
+            limits.nodes = strtoull(value, NULL, 10);
+            ++i;
+        } else if (!strcmp(argv[i], "mate")) {
+            mate = atoi(value);
+            ++i;
+        } else {
+            log_debug("Error: unknown go parameter %s", argv[i]);
         }
-        move->will_promote = 1;
+    }
+    if (limits.depth < 0 || limits.depth > AI_MAX_DEPTH) {
+        limits.depth = AI_MAX_DEPTH;
+    }
+    if (mate > MATE_MAX_MOVES) {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "info string mate %d is beyond the mate search, searching mate %d", mate,
+            MATE_MAX_MOVES);
+        command_send(io_ctx, buffer);
+        mate = MATE_MAX_MOVES;
+    }
+
+    int side = io_ctx->chess_ctx.current_turn == CHESS_COLOR_BLACK;
+    uint64_t time_ms = move_time ? (move_time > IO_MOVE_OVERHEAD_MS ? move_time - IO_MOVE_OVERHEAD_MS : 1) :
+        timed ? time_budget(times[side], increments[side], moves_to_go) : 0;
+
+    search_finish(io_ctx);
+
+    // A ponder search runs without a clock until ponderhit grants it the time computed here.
+    io_ctx->search_infinite = limits.infinite;
+    io_ctx->search_held = ponder || limits.infinite;
+    io_ctx->search_time_ms = time_ms;
+    if (ponder) {
+        limits.infinite = 1;
     } else {
-        move->will_promote = 0;
+        limits.time_ms = time_ms;
+    }
+    limits.multi_pv = io_ctx->multi_pv;
+    limits.iteration_callback = search_info_send;
+    limits.user_data = io_ctx;
+
+    io_ctx->search_ctx = io_ctx->chess_ctx;
+    io_ctx->search_limits = limits;
+    io_ctx->search_mate = mate < 0 ? 0 : mate;
+    io_ctx->search_started_ns = ai_time_now_ns();
+    atomic_store(&io_ctx->ai_ctx.stop_requested, 0);
+    atomic_store(&io_ctx->ai_ctx.deadline_ns, 0);
+    if (pthread_create(&io_ctx->search_thread, NULL, search_run, io_ctx)) {
+        log_debug("Error: could not start the search thread, searching in place");
+        io_ctx->search_held = 0;
+        search_run(io_ctx);
+        return;
+    }
+    io_ctx->searching = 1;
+}
+
+static void ponder_hit(IO_Context* io_ctx) {
+    if (!io_ctx->searching) {
+        return;
+    }
+    pthread_mutex_lock(&io_ctx->search_mutex);
+    if (io_ctx->search_time_ms) {
+        ai_deadline_set(&io_ctx->ai_ctx, io_ctx->search_time_ms);
     }
-}
\ No newline at end of file
+    io_ctx->search_held = io_ctx->search_infinite;
+    pthread_cond_signal(&io_ctx->search_cond);
+    pthread_mutex_unlock(&io_ctx->search_mutex);
+}
+
+int io_init(IO_Context* io_ctx, int input_fd, int output_fd, int nonblocking, TT_Budget* tt_budget,
+    IO_Search_Slots* search_slots) {
+    io_ctx->input_fd = input_fd;
+    io_ctx->output_fd = output_fd;
+    io_ctx->nonblocking = nonblocking;
+    io_ctx->buffer = malloc(sizeof(char) * IO_BUFFER_SIZE);
+    io_ctx->buffer_capacity = IO_BUFFER_SIZE;
+    io_ctx->buffer_length = 0;
+    io_ctx->line_length = 0;
+    io_ctx->argv = malloc(sizeof(char*) * IO_ARGV_SIZE);
+    io_ctx->argv_capacity = IO_ARGV_SIZE;
+    io_ctx->position_moves = NULL;
+    io_ctx->position_moves_capacity = 0;
+    io_ctx->searching = 0;
+    io_ctx->multi_pv = 1;
+    io_ctx->search_mate = 0;
+    memset(&io_ctx->mate_ctx, 0, sizeof(Mate_Context));
+    io_ctx->search_slots = search_slots;
+    position_forget(io_ctx);
+    chess_context_from_position_input(&io_ctx->chess_ctx, 0, NULL);
+    syzygy_init(&io_ctx->syzygy_ctx);
+    bitbase_init();
+    if (!io_ctx->buffer || !io_ctx->argv || ai_init(&io_ctx->ai_ctx, &io_ctx->syzygy_ctx, TT_DEFAULT_SIZE_MB, tt_budget)) {
+        syzygy_release(&io_ctx->syzygy_ctx);
+        free(io_ctx->buffer);
+        free(io_ctx->argv);
+        return -1;
+    }
+    pthread_mutex_init(&io_ctx->search_mutex, NULL);
+    pthread_cond_init(&io_ctx->search_cond, NULL);
+    return 0;
+}
+
+void io_release(IO_Context* io_ctx) {
+    search_stop(io_ctx);
+    pthread_cond_destroy(&io_ctx->search_cond);
+    pthread_mutex_destroy(&io_ctx->search_mutex);
+    ai_release(&io_ctx->ai_ctx);
+    mate_release(&io_ctx->mate_ctx);
+    syzygy_release(&io_ctx->syzygy_ctx);
+    free(io_ctx->position_moves);
+    free(io_ctx->buffer);
+    free(io_ctx->argv);
+}
+
+// Returns 1 when the session asked to quit.
+static int command_execute(IO_Context* io_ctx, int argc) {
+    char** argv = io_ctx->argv;
+    if (!strcmp("quit", argv[0])) {
+        search_stop(io_ctx);
+        return 1;
+    } else if (!strcmp(argv[0], "stop")) {
+        search_stop(io_ctx);
+    } else if (!strcmp(argv[0], "ponderhit")) {
+        ponder_hit(io_ctx);
+    } else if (!strcmp(argv[0], "uci")) {
+        command_send(io_ctx, "id name Goldenpawn");
+        command_send(io_ctx, "id author Felipe Kersting");
+        command_send(io_ctx, "option name Hash type spin default 16 min 1 max 4096");
+        command_send(io_ctx, "option name SyzygyPath type string default <empty>");
+        command_send(io_ctx, "option name SyzygyProbeDepth type spin default 1 min 1 max 100");
+        command_send(io_ctx, "option name SyzygyProbeLimit type spin default 7 min 0 max 7");
+        command_send(io_ctx, "option name LogFile type string default <empty>");
+        command_send(io_ctx, "option name Ponder type check default false");
+        command_send(io_ctx, "option name MultiPV type spin default 1 min 1 max 32");
+        command_send(io_ctx, "option name SaveHash type string default <empty>");
+        command_send(io_ctx, "option name LoadHash type string default <empty>");
+        command_send(io_ctx, "option name SharedHash type string default <empty>");
+        command_send(io_ctx, "option name EvalCache type spin default 4 min 0 max 1024");
+        hash_info_send(io_ctx);
+        command_send(io_ctx, "uciok");
+    } else if (!strcmp(argv[0], "isready")) {
+        command_send(io_ctx, "readyok");
+    } else if (!strcmp(argv[0], "setoption")) {
+        search_finish(io_ctx);
+        option_set(io_ctx, argc, argv);
+    } else if (!strcmp(argv[0], "ucinewgame")) {
+        search_finish(io_ctx);
+        ai_new_game(&io_ctx->ai_ctx);
+        position_forget(io_ctx);
+    } else if (!strcmp(argv[0], "position")) {
+        position_set(io_ctx, argc, argv);
+    } else if (!strcmp(argv[0], "go")) {
+        go_start(io_ctx, argc, argv);
+    }
+    return 0;
+}
+
+// Executes commands until the input runs dry. Returns 1 once the session is over (quit or end of input), or 0
+// when a nonblocking context is waiting for more input.
+int io_process(IO_Context* io_ctx) {
+    for (;;) {
+        int argc = command_fetch(io_ctx);
+        if (argc == IO_FETCH_AGAIN) {
+            return 0;
+        }
+        if (argc == IO_FETCH_END) {
+            search_finish(io_ctx);
+            return 1;
+        }
+        if (argc > 0 && command_execute(io_ctx, argc)) {
+            return 1;
+        }
+    }
+}
+
+void io_start(IO_Context* io_ctx) {
+    log_debug("Initializing goldenpawn engine");
+    while (!io_process(io_ctx));
+    log_debug("Exiting goldenpawn engine");
+    io_release(io_ctx);
+}
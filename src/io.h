@@ -1,17 +1,68 @@
 #ifndef GOLDENPAWN_IO_H
 #define GOLDENPAWN_IO_H
 #include "chess.h"
+#include "syzygy.h"
+#include "ai.h"
+#include "mate.h"
+#include <pthread.h>
+
+#define IO_POSITION_BASE_SIZE 128
+#define IO_MOVE_SIZE 6
+
+// Searches allowed to run at once over the sessions sharing the slots, e.g. the workers of a server. A search
+// waits for a slot before it starts, and a stop ends the wait.
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t released;
+    int available;
+} IO_Search_Slots;
 
 typedef struct {
+    int input_fd;
+    int output_fd;
+    // Set for server sessions: reads never block and io_process returns once the input is drained.
+    int nonblocking;
     char* buffer;
+    size_t buffer_capacity;
+    size_t buffer_length;
+    size_t line_length;
     char** argv;
+    int argv_capacity;
     Chess_Context chess_ctx;
+    Syzygy_Context syzygy_ctx;
+    AI_Context ai_ctx;
+    // Last position received, so a move list extending it only costs the new moves.
+    char position_base[IO_POSITION_BASE_SIZE];
+    char (*position_moves)[IO_MOVE_SIZE];
+    int position_moves_num;
+    int position_moves_capacity;
+    // Searches run on their own thread so that stop and ponderhit are read while they run. Under go ponder and
+    // go infinite the best move is held back until ponderhit or stop.
+    pthread_t search_thread;
+    int searching;
+    pthread_mutex_t search_mutex;
+    pthread_cond_t search_cond;
+    int search_held;
+    int search_infinite;
+    uint64_t search_time_ms;
+    uint64_t search_started_ns;
+    Chess_Context search_ctx;
+    AI_Limits search_limits;
+    // Moves of a go mate search, 0 for a normal one. Its table is allocated by the first such search.
+    int search_mate;
+    Mate_Context mate_ctx;
+    // NULL when searches are not capped.
+    IO_Search_Slots* search_slots;
+    int multi_pv;
 } IO_Context;
 
-void io_init(IO_Context* io_ctx);
+void io_search_slots_init(IO_Search_Slots* search_slots, int slots_num);
+void io_search_slots_release(IO_Search_Slots* search_slots);
+int  io_init(IO_Context* io_ctx, int input_fd, int output_fd, int nonblocking, TT_Budget* tt_budget,
+    IO_Search_Slots* search_slots);
+void io_release(IO_Context* io_ctx);
+int  io_process(IO_Context* io_ctx);
 void io_start(IO_Context* io_ctx);
-void io_move_to_uci_notation(const Chess_Move* move, char* uci_str);
-void io_uci_notation_to_move(const char* uci_str, Chess_Move* move);
 int  io_parse_fen(char* fen, Chess_Context* ctx);
 
 #endif
\ No newline at end of file
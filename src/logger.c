@@ -2,17 +2,162 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define LOG_RING_SLOTS 256
+#define LOG_LINE_SIZE 512
+
+// Each thread formats into its own ring; the flusher thread is the only reader.
+// When a ring is full the message is dropped and counted, so logging never waits on I/O.
+// Rings are never freed while logging runs: a thread that exits gives its ring back and the next new thread
+// takes it over, so the list only grows with the number of threads alive at once.
+typedef struct Log_Ring {
+  struct Log_Ring* next;
+  atomic_int owned;
+  atomic_uint_fast64_t head;
+  atomic_uint_fast64_t tail;
+  atomic_uint dropped;
+  struct {
+    int length;
+    char text[LOG_LINE_SIZE];
+  } slots[LOG_RING_SLOTS];
+} Log_Ring;
 
 static enum Log_Level log_level = LOG_LEVEL_INFO;
+static _Atomic(Log_Ring*) log_rings;
+static _Thread_local Log_Ring* log_thread_ring;
+static pthread_key_t log_ring_key;
+static atomic_int log_running;
+static sem_t log_wakeup;
+static pthread_t log_flusher;
+static pthread_mutex_t log_output_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Lines go out whole with write(2), on the same descriptor as the UCI output when no file is set, so that they
+// never land in the middle of a command.
+static int log_output = -1;
+
+static int
+log_format(char* buf, const char* format, va_list argptr)
+{
+  int length = snprintf(buf, LOG_LINE_SIZE, "info string ");
+  int written = vsnprintf(buf + length, LOG_LINE_SIZE - length - 1, format, argptr);
+  if (written > 0)
+    length += written < LOG_LINE_SIZE - length - 1 ? written : LOG_LINE_SIZE - length - 2;
+  buf[length++] = '\n';
+  return length;
+}
+
+static void
+log_line_write(const char* text, int length)
+{
+  int fd = log_output >= 0 ? log_output : STDOUT_FILENO;
+  while (length > 0) {
+    ssize_t written = write(fd, text, length);
+    if (written <= 0)
+      return;
+    text += written;
+    length -= written;
+  }
+}
+
+static void
+log_ring_unregister(void* ring)
+{
+  atomic_store(&((Log_Ring*)ring)->owned, 0);
+}
+
+static Log_Ring*
+log_ring_register()
+{
+  Log_Ring* ring;
+  for (ring = atomic_load(&log_rings); ring; ring = ring->next) {
+    int owned = 0;
+    if (atomic_compare_exchange_strong(&ring->owned, &owned, 1))
+      break;
+  }
+  if (!ring) {
+    ring = calloc(1, sizeof(Log_Ring));
+    if (!ring)
+      return NULL;
+    atomic_store(&ring->owned, 1);
+    Log_Ring* head = atomic_load(&log_rings);
+    do {
+      ring->next = head;
+    } while (!atomic_compare_exchange_weak(&log_rings, &head, ring));
+  }
+  pthread_setspecific(log_ring_key, ring);
+  log_thread_ring = ring;
+  return ring;
+}
 
 static void
-log_out(FILE* target, const char* level, const char* format, va_list argptr)
+log_drain()
+{
+  pthread_mutex_lock(&log_output_mutex);
+  for (Log_Ring* ring = atomic_load(&log_rings); ring; ring = ring->next) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    for (; tail != head; ++tail)
+      log_line_write(ring->slots[tail % LOG_RING_SLOTS].text, ring->slots[tail % LOG_RING_SLOTS].length);
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    unsigned dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+    if (dropped) {
+      char buf[LOG_LINE_SIZE];
+      log_line_write(buf, snprintf(buf, sizeof(buf), "info string logger dropped %u messages\n", dropped));
+    }
+  }
+  pthread_mutex_unlock(&log_output_mutex);
+}
+
+static void*
+log_flusher_run(void* arg)
 {
-  size_t needed = snprintf(NULL, 0, "info %s %s\n", level, format) + 1;
-  char *buf = malloc(needed);
-  sprintf(buf, "info %s %s\n", level, format);
-  vfprintf(target, buf, argptr);
-  free(buf);
+  for (;;) {
+    sem_wait(&log_wakeup);
+    int running = atomic_load(&log_running);
+    log_drain();
+    if (!running)
+      return NULL;
+  }
+}
+
+void
+log_init()
+{
+  sem_init(&log_wakeup, 0, 0);
+  if (pthread_key_create(&log_ring_key, log_ring_unregister))
+    return;
+  atomic_store(&log_running, 1);
+  if (pthread_create(&log_flusher, NULL, log_flusher_run, NULL)) {
+    atomic_store(&log_running, 0);
+    pthread_key_delete(log_ring_key);
+  }
+}
+
+void
+log_release()
+{
+  if (!atomic_exchange(&log_running, 0))
+    return;
+  sem_post(&log_wakeup);
+  pthread_join(log_flusher, NULL);
+  sem_destroy(&log_wakeup);
+  pthread_key_delete(log_ring_key);
+
+  Log_Ring* ring = atomic_exchange(&log_rings, NULL);
+  while (ring) {
+    Log_Ring* next = ring->next;
+    free(ring);
+    ring = next;
+  }
+  log_thread_ring = NULL;
+  log_file_set(NULL);
 }
 
 void
@@ -21,13 +166,50 @@ log_level_set(enum Log_Level level)
   log_level = level;
 }
 
+// NULL or "<empty>" goes back to stdout.
+void
+log_file_set(const char* path)
+{
+  int fd = -1;
+  if (path && strcmp(path, "<empty>")) {
+    fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (fd < 0)
+      return;
+  }
+  pthread_mutex_lock(&log_output_mutex);
+  if (log_output >= 0)
+    close(log_output);
+  log_output = fd;
+  pthread_mutex_unlock(&log_output_mutex);
+}
+
 void
-log_debug(const char* format, ...)
+log_write(enum Log_Level level, const char* format, ...)
 {
-  if (log_level > LOG_LEVEL_DEBUG)
+  if (level < log_level)
     return;
   va_list argptr;
   va_start(argptr, format);
-  log_out(stdout, "string", format, argptr);
+
+  // Before log_init (or after log_release) there is no flusher, so write synchronously.
+  Log_Ring* ring = log_thread_ring;
+  if (!atomic_load_explicit(&log_running, memory_order_relaxed) || (!ring && !(ring = log_ring_register()))) {
+    char buf[LOG_LINE_SIZE];
+    int length = log_format(buf, format, argptr);
+    pthread_mutex_lock(&log_output_mutex);
+    log_line_write(buf, length);
+    pthread_mutex_unlock(&log_output_mutex);
+    va_end(argptr);
+    return;
+  }
+
+  uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= LOG_RING_SLOTS) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+  } else {
+    ring->slots[head % LOG_RING_SLOTS].length = log_format(ring->slots[head % LOG_RING_SLOTS].text, format, argptr);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    sem_post(&log_wakeup);
+  }
   va_end(argptr);
-}
\ No newline at end of file
+}
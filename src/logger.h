@@ -6,9 +6,29 @@ enum Log_Level {
   LOG_LEVEL_INFO = 1
 };
 
+// Calls below LOG_COMPILE_LEVEL become dead code: arguments are still type-checked but never evaluated.
+// 0 keeps everything, 1 strips debug logs, 2 strips all logs (see LOG_LEVEL in the Makefile).
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
 // core functions
+void log_init();
+void log_release();
 void log_level_set(enum Log_Level level);
-void log_debug(const char* format, ...);
-void log_info(const char* format, ...);
+void log_file_set(const char* path);
+void log_write(enum Log_Level level, const char* format, ...);
+
+#if LOG_COMPILE_LEVEL <= 0
+#define log_debug(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) do { if (0) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+#endif
+
+#if LOG_COMPILE_LEVEL <= 1
+#define log_info(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define log_info(...) do { if (0) log_write(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#endif
 
-#endif
\ No newline at end of file
+#endif
@@ -1,12 +1,58 @@
 #include "io.h"
 #include "logger.h"
 #include "chess.h"
+#include "analyze.h"
+#include "server.h"
+#include "batch.h"
+#include "selfplay.h"
+#include "tune.h"
+#include "params.h"
+#include "ai.h"
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
-int main() {
-    IO_Context io_ctx;
-    log_level_set(LOG_LEVEL_DEBUG);
-    io_init(&io_ctx);
-    io_start(&io_ctx);
-    return 0;
+int main(int argc, char** argv) {
+    int result = 0;
+
+    // Evaluation parameters written by the tuner apply to every mode, so they are loaded before anything runs.
+    if (argc > 2 && !strcmp(argv[1], "--params")) {
+        AI_Eval_Params params;
+        ai_eval_params_get(&params);
+        if (params_load(argv[2], &params)) {
+            fprintf(stderr, "could not load the evaluation parameters from %s\n", argv[2]);
+            return 1;
+        }
+        ai_eval_params_set(&params);
+        argv[2] = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+
+    log_init();
+    if (argc > 1 && !strcmp(argv[1], "analyze")) {
+        result = analyze_main(argc - 2, argv + 2);
+    } else if (argc > 1 && !strcmp(argv[1], "eval-batch")) {
+        result = batch_main(argc - 2, argv + 2);
+    } else if (argc > 1 && !strcmp(argv[1], "pack")) {
+        result = pack_main(argc - 2, argv + 2);
+    } else if (argc > 1 && !strcmp(argv[1], "unpack")) {
+        result = unpack_main(argc - 2, argv + 2);
+    } else if (argc > 1 && !strcmp(argv[1], "selfplay")) {
+        result = selfplay_main(argc - 2, argv + 2);
+    } else if (argc > 1 && !strcmp(argv[1], "tune")) {
+        result = tune_main(argc - 2, argv + 2);
+    } else if (argc > 1 && !strcmp(argv[1], "server")) {
+        result = server_main(argc - 2, argv + 2);
+    } else {
+        IO_Context io_ctx;
+        log_level_set(LOG_LEVEL_DEBUG);
+        if (io_init(&io_ctx, STDIN_FILENO, STDOUT_FILENO, 0, NULL, NULL)) {
+            result = 1;
+        } else {
+            io_start(&io_ctx);
+        }
+    }
+    log_release();
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,274 @@
+#include "mate.h"
+#include "ai.h"
+#include <string.h>
+
+#define MATE_INFINITY 1000000000u
+#define MATE_CONTROL_CHECK_NODES 1024
+
+// The moves of a node with the proof and disproof numbers of their positions, kept on the stack for the whole time
+// the node is searched so that progress in a child is never lost to the table.
+typedef struct {
+    Chess_Packed_Move moves[CHESS_MAX_MOVES];
+    uint32_t proofs[CHESS_MAX_MOVES];
+    uint32_t disproofs[CHESS_MAX_MOVES];
+    int count;
+} Mate_Children;
+
+_Static_assert(sizeof(Mate_Entry) == 16, "Mate_Entry must stay 16 bytes");
+
+int mate_init(Mate_Context* mate_ctx, size_t size_mb) {
+    size_t entries_num = 1;
+    while (entries_num * 2 * sizeof(Mate_Entry) <= size_mb * 1024 * 1024) {
+        entries_num *= 2;
+    }
+    memset(mate_ctx, 0, sizeof(Mate_Context));
+    if (memory_block_alloc(&mate_ctx->memory, entries_num * sizeof(Mate_Entry), 0)) {
+        return -1;
+    }
+    mate_ctx->entries = mate_ctx->memory.data;
+    mate_ctx->mask = entries_num - 1;
+    return 0;
+}
+
+void mate_release(Mate_Context* mate_ctx) {
+    memory_block_free(&mate_ctx->memory);
+    mate_ctx->entries = NULL;
+}
+
+static uint64_t entry_key(uint64_t hash, int plies) {
+    return hash ^ (uint64_t)(plies + 1) * 0x9E3779B97F4A7C15ULL;
+}
+
+static int entry_get(const Mate_Context* mate_ctx, uint64_t hash, int plies, uint32_t* proof, uint32_t* disproof) {
+    uint64_t key = entry_key(hash, plies);
+    const Mate_Entry* entry = &mate_ctx->entries[key & mate_ctx->mask];
+    if (entry->key != key) {
+        return 0;
+    }
+    *proof = entry->proof;
+    *disproof = entry->disproof;
+    return 1;
+}
+
+static void entry_put(Mate_Context* mate_ctx, uint64_t hash, int plies, uint32_t proof, uint32_t disproof) {
+    uint64_t key = entry_key(hash, plies);
+    Mate_Entry* entry = &mate_ctx->entries[key & mate_ctx->mask];
+    entry->key = key;
+    entry->proof = proof;
+    entry->disproof = disproof;
+}
+
+static uint32_t saturate(uint64_t value) {
+    return value < MATE_INFINITY ? (uint32_t)value : MATE_INFINITY;
+}
+
+static int control_stops(Mate_Context* mate_ctx, const Mate_Limits* limits) {
+    if (mate_ctx->nodes % MATE_CONTROL_CHECK_NODES) {
+        return mate_ctx->stop;
+    }
+    uint64_t deadline_ns = limits->deadline_ns ? atomic_load_explicit(limits->deadline_ns, memory_order_relaxed) : 0;
+    if ((limits->nodes && mate_ctx->nodes >= limits->nodes) ||
+        (limits->stop_requested && atomic_load_explicit(limits->stop_requested, memory_order_relaxed)) ||
+        (deadline_ns && ai_time_now_ns() >= deadline_ns)) {
+        mate_ctx->stop = 1;
+    }
+    return mate_ctx->stop;
+}
+
+// The attacker is to move when an odd number of plies is left, and only checks can mate with the last one.
+static void moves_generate(const Chess_Context* chess_ctx, int plies, Chess_Move_List* move_list) {
+    chess_generate_moves(chess_ctx, move_list);
+    if (plies != 1) {
+        return;
+    }
+    int kept = 0;
+    for (int i = 0; i < move_list->count; ++i) {
+        if (chess_move_gives_check(chess_ctx, move_list->moves[i])) {
+            move_list->moves[kept++] = move_list->moves[i];
+        }
+    }
+    move_list->count = kept;
+}
+
+// Numbers of a position not searched yet. Defender positions start from their number of replies, since each one
+// has to be refuted, and attacker positions with one move left from their number of checks.
+static void numbers_estimate(const Chess_Context* chess_ctx, int plies, uint32_t* proof, uint32_t* disproof) {
+    Chess_Move_List move_list;
+
+    if (!plies) {
+        int mated = chess_in_check(chess_ctx) && !chess_has_legal_move(chess_ctx);
+        *proof = mated ? 0 : MATE_INFINITY;
+        *disproof = mated ? MATE_INFINITY : 0;
+    } else if (plies % 2 == 0) {
+        chess_generate_moves(chess_ctx, &move_list);
+        int mated = !move_list.count && chess_in_check(chess_ctx);
+        *proof = mated ? 0 : !move_list.count ? MATE_INFINITY : (uint32_t)move_list.count;
+        *disproof = mated ? MATE_INFINITY : !move_list.count ? 0 : 1;
+    } else if (plies == 1) {
+        moves_generate(chess_ctx, plies, &move_list);
+        *proof = move_list.count ? 1 : MATE_INFINITY;
+        *disproof = move_list.count ? (uint32_t)move_list.count : 0;
+    } else {
+        *proof = 1;
+        *disproof = 1;
+    }
+}
+
+// Depth-first proof-number search: the node is searched until its numbers reach the thresholds, always going down
+// the most proving child and handing it the thresholds under which it stays the most proving one.
+static void node_search(Mate_Context* mate_ctx, const Mate_Limits* limits, const Chess_Context* chess_ctx, int plies,
+    uint32_t proof_threshold, uint32_t disproof_threshold, uint32_t* proof, uint32_t* disproof) {
+    Chess_Context child_ctx;
+    Chess_Move_List move_list;
+    Mate_Children children;
+    int attacker = plies % 2;
+
+    ++mate_ctx->nodes;
+    moves_generate(chess_ctx, plies, &move_list);
+    if (!move_list.count || !plies) {
+        if (attacker) {
+            *proof = MATE_INFINITY;
+            *disproof = 0;
+        } else {
+            numbers_estimate(chess_ctx, plies, proof, disproof);
+        }
+        entry_put(mate_ctx, chess_ctx->hash, plies, *proof, *disproof);
+        return;
+    }
+
+    children.count = move_list.count;
+    for (int i = 0; i < move_list.count; ++i) {
+        children.moves[i] = move_list.moves[i];
+        chess_make_move(chess_ctx, &child_ctx, children.moves[i]);
+        if (!entry_get(mate_ctx, child_ctx.hash, plies - 1, &children.proofs[i], &children.disproofs[i])) {
+            numbers_estimate(&child_ctx, plies - 1, &children.proofs[i], &children.disproofs[i]);
+        }
+    }
+
+    for (;;) {
+        // At attacker nodes one proven child proves the node and all must be disproven; defender nodes the reverse.
+        uint64_t sum = 0;
+        uint32_t best = MATE_INFINITY, second = MATE_INFINITY;
+        int best_index = 0;
+        for (int i = 0; i < children.count; ++i) {
+            uint32_t value = attacker ? children.proofs[i] : children.disproofs[i];
+            sum += attacker ? children.disproofs[i] : children.proofs[i];
+            if (value < best) {
+                second = best;
+                best = value;
+                best_index = i;
+            } else if (value < second) {
+                second = value;
+            }
+        }
+        *proof = attacker ? best : saturate(sum);
+        *disproof = attacker ? saturate(sum) : best;
+        if (*proof >= proof_threshold || *disproof >= disproof_threshold || control_stops(mate_ctx, limits)) {
+            break;
+        }
+
+        uint32_t* child_proof = &children.proofs[best_index];
+        uint32_t* child_disproof = &children.disproofs[best_index];
+        uint32_t child_proof_threshold, child_disproof_threshold;
+        if (attacker) {
+            child_proof_threshold = proof_threshold < saturate((uint64_t)second + 1) ? proof_threshold : saturate((uint64_t)second + 1);
+            child_disproof_threshold = saturate((uint64_t)disproof_threshold - *disproof + *child_disproof);
+        } else {
+            child_disproof_threshold = disproof_threshold < saturate((uint64_t)second + 1) ? disproof_threshold : saturate((uint64_t)second + 1);
+            child_proof_threshold = saturate((uint64_t)proof_threshold - *proof + *child_proof);
+        }
+        chess_make_move(chess_ctx, &child_ctx, children.moves[best_index]);
+        node_search(mate_ctx, limits, &child_ctx, plies - 1, child_proof_threshold, child_disproof_threshold,
+            child_proof, child_disproof);
+    }
+
+    entry_put(mate_ctx, chess_ctx->hash, plies, *proof, *disproof);
+}
+
+// Children are only estimated until they are searched, and mated positions are never searched at all.
+static int entry_proven(const Mate_Context* mate_ctx, const Chess_Context* chess_ctx, int plies) {
+    uint32_t proof, disproof;
+    if (!entry_get(mate_ctx, chess_ctx->hash, plies, &proof, &disproof)) {
+        numbers_estimate(chess_ctx, plies, &proof, &disproof);
+    }
+    return !proof;
+}
+
+// Plays out a proven position from the table, searching again wherever the entries were overwritten. The defender
+// picks the reply that is not proven with fewer plies for as long as possible.
+static void pv_build(Mate_Context* mate_ctx, const Mate_Limits* limits, const Chess_Context* chess_ctx, int plies,
+    Mate_Result* result) {
+    Chess_Context position = *chess_ctx, child_ctx;
+    Chess_Move_List move_list;
+    uint32_t proof, disproof;
+
+    result->pv_length = 0;
+    for (; plies >= 0 && !mate_ctx->stop; --plies) {
+        Chess_Packed_Move chosen = CHESS_MOVE_NONE;
+        int chosen_plies = -1;
+
+        moves_generate(&position, plies, &move_list);
+        for (int attempt = 0; plies % 2 && chosen == CHESS_MOVE_NONE && attempt < 2; ++attempt) {
+            if (attempt) {
+                node_search(mate_ctx, limits, &position, plies, MATE_INFINITY, MATE_INFINITY, &proof, &disproof);
+            }
+            for (int i = 0; i < move_list.count && chosen == CHESS_MOVE_NONE; ++i) {
+                chess_make_move(&position, &child_ctx, move_list.moves[i]);
+                if (entry_proven(mate_ctx, &child_ctx, plies - 1)) {
+                    chosen = move_list.moves[i];
+                }
+            }
+        }
+        for (int i = 0; !(plies % 2) && i < move_list.count; ++i) {
+            chess_make_move(&position, &child_ctx, move_list.moves[i]);
+            if (!entry_proven(mate_ctx, &child_ctx, plies - 1)) {
+                node_search(mate_ctx, limits, &child_ctx, plies - 1, MATE_INFINITY, MATE_INFINITY, &proof, &disproof);
+            }
+            int shortest = plies - 1;
+            for (int shorter = 1; shorter < plies - 1; shorter += 2) {
+                if (entry_proven(mate_ctx, &child_ctx, shorter)) {
+                    shortest = shorter;
+                    break;
+                }
+            }
+            if (shortest > chosen_plies) {
+                chosen = move_list.moves[i];
+                chosen_plies = shortest;
+            }
+        }
+        if (chosen == CHESS_MOVE_NONE) {
+            break;
+        }
+        result->pv[result->pv_length++] = chosen;
+        chess_make_move(&position, &position, chosen);
+    }
+}
+
+// Iterative deepening over the number of moves, so that the first proof is the shortest mate. Proofs with fewer
+// plies left also hold with more, so a disproof at the last depth rules out every mate within the moves.
+void mate_search(Mate_Context* mate_ctx, const Chess_Context* chess_ctx, const Mate_Limits* limits, Mate_Result* result) {
+    int max_moves = limits->moves < MATE_MAX_MOVES ? limits->moves : MATE_MAX_MOVES;
+    uint32_t proof = MATE_INFINITY, disproof = 0;
+
+    memset(result, 0, sizeof(Mate_Result));
+    result->status = MATE_STATUS_UNKNOWN;
+    mate_ctx->nodes = 0;
+    mate_ctx->stop = 0;
+
+    for (int moves = 1; moves <= max_moves; ++moves) {
+        node_search(mate_ctx, limits, chess_ctx, 2 * moves - 1, MATE_INFINITY, MATE_INFINITY, &proof, &disproof);
+        if (mate_ctx->stop) {
+            break;
+        }
+        if (!proof) {
+            result->status = MATE_STATUS_FOUND;
+            result->moves = moves;
+            pv_build(mate_ctx, limits, chess_ctx, 2 * moves - 1, result);
+            break;
+        }
+    }
+    if (result->status == MATE_STATUS_UNKNOWN && !mate_ctx->stop && max_moves > 0) {
+        result->status = MATE_STATUS_NONE;
+    }
+    result->nodes = mate_ctx->nodes;
+}
@@ -0,0 +1,56 @@
+#ifndef GOLDENPAWN_MATE_H
+#define GOLDENPAWN_MATE_H
+#include "chess.h"
+#include "memory.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define MATE_MAX_MOVES 32
+#define MATE_HASH_SIZE_MB 32
+
+// Proof and disproof numbers of a position with a number of plies left, under a key mixing both.
+typedef struct {
+    uint64_t key;
+    uint32_t proof;
+    uint32_t disproof;
+} Mate_Entry;
+
+typedef struct {
+    Memory_Block memory;
+    Mate_Entry* entries;
+    uint64_t mask;
+    uint64_t nodes;
+    int stop;
+} Mate_Context;
+
+// A zero nodes means no limit. The stop request and the deadline are read while the search runs, so that another
+// thread can end it (see AI_Context).
+typedef struct {
+    int moves;
+    uint64_t nodes;
+    const atomic_int* stop_requested;
+    const _Atomic uint64_t* deadline_ns;
+} Mate_Limits;
+
+typedef enum {
+    MATE_STATUS_FOUND,
+    MATE_STATUS_NONE,
+    MATE_STATUS_UNKNOWN
+} Mate_Status;
+
+// A found mate is the shortest one and pv plays it out, the defender taking the longest defence the table knows.
+// MATE_STATUS_NONE proves there is no mate within the moves; MATE_STATUS_UNKNOWN means the search was cut short.
+typedef struct {
+    Mate_Status status;
+    int moves;
+    uint64_t nodes;
+    Chess_Packed_Move pv[2 * MATE_MAX_MOVES];
+    int pv_length;
+} Mate_Result;
+
+int mate_init(Mate_Context* mate_ctx, size_t size_mb);
+void mate_release(Mate_Context* mate_ctx);
+// Depth-first proof-number search for a mate by the side to move.
+void mate_search(Mate_Context* mate_ctx, const Chess_Context* chess_ctx, const Mate_Limits* limits, Mate_Result* result);
+
+#endif
@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include "memory.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#define MEMORY_MAX_NODES 64
+#define MEMORY_NODE_PATH "/sys/devices/system/node"
+
+typedef struct {
+    int nodes_num;
+    int nodes[MEMORY_MAX_NODES];
+    cpu_set_t node_cpus[MEMORY_MAX_NODES];
+    unsigned long memory_nodes_mask;
+    int memory_nodes_num;
+    int transparent_enabled;
+} Memory_Topology;
+
+static Memory_Topology topology;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+static atomic_int next_pinned_node;
+
+static int file_read(const char* path, char* buffer, size_t size) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    size_t length = fread(buffer, 1, size - 1, file);
+    fclose(file);
+    buffer[length] = '\0';
+    return 0;
+}
+
+// Kernel lists such as "0-3,8-11"; calls add for every number in them.
+static void list_parse(const char* list, void (*add)(int, void*), void* user_data) {
+    while (*list) {
+        char* end;
+        long first = strtol(list, &end, 10);
+        if (end == list) {
+            break;
+        }
+        long last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+        }
+        for (long i = first; i <= last && i < CPU_SETSIZE; ++i) {
+            add((int)i, user_data);
+        }
+        list = *end == ',' ? end + 1 : end + (*end != '\0');
+    }
+}
+
+static void node_add(int node, void* user_data) {
+    (void)user_data;
+    if (node < MEMORY_MAX_NODES && topology.nodes_num < MEMORY_MAX_NODES) {
+        topology.nodes[topology.nodes_num++] = node;
+    }
+}
+
+static void memory_node_add(int node, void* user_data) {
+    (void)user_data;
+    if (node < MEMORY_MAX_NODES) {
+        topology.memory_nodes_mask |= 1UL << node;
+        ++topology.memory_nodes_num;
+    }
+}
+
+static void cpu_add(int cpu, void* user_data) {
+    CPU_SET(cpu, (cpu_set_t*)user_data);
+}
+
+// Falls back to a single node, and so to doing nothing, whenever a part of the topology is missing.
+static void topology_read() {
+    char buffer[4096];
+    char path[128];
+
+    if (!file_read("/sys/kernel/mm/transparent_hugepage/enabled", buffer, sizeof(buffer))) {
+        topology.transparent_enabled = !strstr(buffer, "[never]");
+    }
+
+    if (file_read(MEMORY_NODE_PATH "/has_cpu", buffer, sizeof(buffer)) &&
+        file_read(MEMORY_NODE_PATH "/online", buffer, sizeof(buffer))) {
+        topology.nodes_num = 1;
+        return;
+    }
+    list_parse(buffer, node_add, NULL);
+    for (int i = 0; i < topology.nodes_num; ++i) {
+        CPU_ZERO(&topology.node_cpus[i]);
+        snprintf(path, sizeof(path), MEMORY_NODE_PATH "/node%d/cpulist", topology.nodes[i]);
+        if (file_read(path, buffer, sizeof(buffer))) {
+            topology.nodes_num = 1;
+            return;
+        }
+        list_parse(buffer, cpu_add, &topology.node_cpus[i]);
+    }
+    if (!file_read(MEMORY_NODE_PATH "/has_memory", buffer, sizeof(buffer)) ||
+        !file_read(MEMORY_NODE_PATH "/online", buffer, sizeof(buffer))) {
+        list_parse(buffer, memory_node_add, NULL);
+    }
+    if (topology.nodes_num < 1) {
+        topology.nodes_num = 1;
+    }
+}
+
+int memory_numa_nodes_num() {
+    pthread_once(&topology_once, topology_read);
+    return topology.nodes_num;
+}
+
+int memory_thread_pin() {
+    if (memory_numa_nodes_num() < 2) {
+        return -1;
+    }
+    int index = atomic_fetch_add(&next_pinned_node, 1) % topology.nodes_num;
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &topology.node_cpus[index])) {
+        return -1;
+    }
+    return topology.nodes[index];
+}
+
+// The pages are only placed when first touched, so the policy has to be set before the block is used.
+static int interleave(void* data, size_t size) {
+    if (topology.memory_nodes_num < 2) {
+        return 0;
+    }
+    unsigned long mask = topology.memory_nodes_mask;
+    return !syscall(SYS_mbind, data, size, MPOL_INTERLEAVE, &mask, sizeof(mask) * 8 + 1, 0);
+}
+
+int memory_block_alloc(Memory_Block* block, size_t size, int flags) {
+    size_t rounded = (size + MEMORY_HUGE_PAGE_SIZE - 1) & ~((size_t)MEMORY_HUGE_PAGE_SIZE - 1);
+    void* data = MAP_FAILED;
+
+    pthread_once(&topology_once, topology_read);
+    memset(block, 0, sizeof(Memory_Block));
+    if (!size) {
+        return -1;
+    }
+
+    if (size >= MEMORY_HUGE_PAGE_SIZE) {
+        data = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        block->pages = MEMORY_PAGES_HUGE;
+    }
+    if (data == MAP_FAILED && size >= MEMORY_HUGE_PAGE_SIZE) {
+        // Transparent huge pages only cover aligned ranges: map one page more and trim the ends.
+        char* mapping = mmap(NULL, rounded + MEMORY_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            return -1;
+        }
+        char* aligned = (char*)(((uintptr_t)mapping + MEMORY_HUGE_PAGE_SIZE - 1) & ~((uintptr_t)MEMORY_HUGE_PAGE_SIZE - 1));
+        if (aligned > mapping) {
+            munmap(mapping, aligned - mapping);
+        }
+        munmap(aligned + rounded, mapping + MEMORY_HUGE_PAGE_SIZE - aligned);
+        data = aligned;
+        block->pages = topology.transparent_enabled && !madvise(data, rounded, MADV_HUGEPAGE) ?
+            MEMORY_PAGES_TRANSPARENT : MEMORY_PAGES_SMALL;
+    }
+    if (data == MAP_FAILED) {
+        rounded = size;
+        data = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        block->pages = MEMORY_PAGES_SMALL;
+        if (data == MAP_FAILED) {
+            return -1;
+        }
+    }
+
+    block->data = data;
+    block->size = rounded;
+    block->interleaved = flags & MEMORY_INTERLEAVE ? interleave(data, rounded) : 0;
+    return 0;
+}
+
+int memory_block_map(Memory_Block* block, int fd, size_t size, int flags) {
+    memset(block, 0, sizeof(Memory_Block));
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags & MEMORY_SHARED ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+    block->data = data;
+    block->size = size;
+    block->pages = flags & MEMORY_SHARED ? MEMORY_PAGES_SHARED : MEMORY_PAGES_FILE;
+    return 0;
+}
+
+void memory_block_free(Memory_Block* block) {
+    if (block->data) {
+        munmap(block->data, block->size);
+    }
+    memset(block, 0, sizeof(Memory_Block));
+}
+
+const char* memory_pages_name(Memory_Pages pages) {
+    switch (pages) {
+    case MEMORY_PAGES_HUGE:
+        return "huge pages";
+    case MEMORY_PAGES_TRANSPARENT:
+        return "transparent huge pages";
+    case MEMORY_PAGES_FILE:
+        return "pages mapped from a file";
+    case MEMORY_PAGES_SHARED:
+        return "shared memory";
+    default:
+        return "small pages";
+    }
+}
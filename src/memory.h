@@ -0,0 +1,44 @@
+#ifndef GOLDENPAWN_MEMORY_H
+#define GOLDENPAWN_MEMORY_H
+#include <stddef.h>
+
+#define MEMORY_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Spread the pages over the NUMA nodes, for tables that several threads use.
+#define MEMORY_INTERLEAVE 0x1
+// Map files shared with the other processes mapping them, instead of privately.
+#define MEMORY_SHARED 0x2
+
+typedef enum {
+    MEMORY_PAGES_SMALL,
+    MEMORY_PAGES_TRANSPARENT,
+    MEMORY_PAGES_HUGE,
+    MEMORY_PAGES_FILE,
+    MEMORY_PAGES_SHARED
+} Memory_Pages;
+
+// Large tables on their own mapping. Blocks of at least one huge page get reserved huge pages when the system has
+// some left, transparent huge pages otherwise, and small pages when neither is available.
+typedef struct {
+    void* data;
+    size_t size;
+    Memory_Pages pages;
+    int interleaved;
+} Memory_Block;
+
+// The memory is zero filled. Without MEMORY_INTERLEAVE pages are placed on the node of the thread that touches
+// them first.
+int memory_block_alloc(Memory_Block* block, size_t size, int flags);
+// Writable mapping of a whole file. Pages are read in as they are touched; writes stay in memory unless the
+// mapping is MEMORY_SHARED.
+int memory_block_map(Memory_Block* block, int fd, size_t size, int flags);
+void memory_block_free(Memory_Block* block);
+const char* memory_pages_name(Memory_Pages pages);
+
+// Nodes with CPUs; 1 on machines that are not NUMA or where the topology can't be read.
+int memory_numa_nodes_num();
+// Pins the calling thread to the CPUs of a node, going round the nodes from call to call, so that the tables the
+// thread allocates and touches afterwards stay local. Returns the node, or -1 when there is only one.
+int memory_thread_pin();
+
+#endif
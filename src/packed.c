@@ -0,0 +1,217 @@
+#include "packed.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+_Static_assert(sizeof(Packed_Position) == 32, "packed positions must stay 32 bytes");
+_Static_assert(sizeof(Packed_Header) == sizeof(Packed_Position), "the header must keep the records aligned");
+
+int packed_position_pack(const Chess_Context* chess_ctx, int score, Packed_Result result, Packed_Position* position) {
+    int count = 0;
+
+    memset(position, 0, sizeof(Packed_Position));
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        Chess_Packed_Piece piece = chess_ctx->board[square];
+        if (piece == CHESS_PIECE_EMPTY) {
+            continue;
+        }
+        if (count == 32) {
+            return -1;
+        }
+        uint8_t nibble = CHESS_PIECE_TYPE(piece) | (CHESS_PIECE_COLOR(piece) == CHESS_COLOR_BLACK ? 0x8 : 0);
+        position->pieces[count / 2] |= nibble << (count % 2 * 4);
+        position->occupancy |= (uint64_t)1 << square;
+        ++count;
+    }
+
+    position->score = score > INT16_MAX ? INT16_MAX : score < -INT16_MAX ? -INT16_MAX : score;
+    position->fullmove_number = chess_ctx->fullmove_number;
+    position->state = (chess_ctx->current_turn == CHESS_COLOR_BLACK ? PACKED_STATE_BLACK : 0) |
+        chess_ctx->castling_rights << PACKED_STATE_CASTLING_SHIFT;
+    position->en_passant_square = chess_ctx->en_passant_square;
+    position->halfmove_clock = chess_ctx->halfmove_clock;
+    position->result = result;
+    return 0;
+}
+
+// The position is checked the way a FEN is before anything is written to chess_ctx: one king per side, no pawns
+// on the first or last rank, castling rights backed by their king and rook, an en passant square with the pawn
+// that just moved in front of it, and the side that just moved not in check.
+int packed_position_unpack(const Packed_Position* position, Chess_Context* chess_ctx) {
+    Chess_Context unpacked;
+    uint64_t occupancy = position->occupancy;
+    int kings[3] = { 0 };
+    int count = 0;
+
+    if (__builtin_popcountll(occupancy) > 32 || position->state >> (PACKED_STATE_CASTLING_SHIFT + 4) ||
+        position->en_passant_square > CHESS_SQUARE_NONE) {
+        return -1;
+    }
+
+    memset(&unpacked, 0, sizeof(Chess_Context));
+    for (; occupancy; occupancy &= occupancy - 1, ++count) {
+        int square = __builtin_ctzll(occupancy);
+        uint8_t nibble = position->pieces[count / 2] >> (count % 2 * 4) & 0xF;
+        Chess_Piece_Type type = nibble & 0x7;
+        Chess_Color color = nibble & 0x8 ? CHESS_COLOR_BLACK : CHESS_COLOR_WHITE;
+        if (type < CHESS_PIECE_KING || type > CHESS_PIECE_PAWN) {
+            return -1;
+        }
+        if (type == CHESS_PIECE_PAWN &&
+            (square < CHESS_BOARD_WIDTH || square >= CHESS_BOARD_WIDTH * (CHESS_BOARD_HEIGHT - 1))) {
+            return -1;
+        }
+        if (type == CHESS_PIECE_KING) {
+            if (kings[color]++) {
+                return -1;
+            }
+            unpacked.king_square[CHESS_COLOR_INDEX(color)] = square;
+        }
+        unpacked.board[square] = CHESS_PIECE_PACK(type, color);
+        unpacked.hash ^= chess_hash_piece_key(unpacked.board[square], square);
+    }
+    if (!kings[CHESS_COLOR_WHITE] || !kings[CHESS_COLOR_BLACK]) {
+        return -1;
+    }
+
+    unpacked.current_turn = position->state & PACKED_STATE_BLACK ? CHESS_COLOR_BLACK : CHESS_COLOR_WHITE;
+    unpacked.castling_rights = position->state >> PACKED_STATE_CASTLING_SHIFT;
+    unpacked.en_passant_square = position->en_passant_square;
+    if (unpacked.castling_rights & ~chess_castling_rights_supported(&unpacked) ||
+        !chess_en_passant_is_valid(&unpacked)) {
+        return -1;
+    }
+
+    unpacked.halfmove_clock = position->halfmove_clock;
+    unpacked.fullmove_number = position->fullmove_number;
+    unpacked.hash ^= chess_hash_state_key(&unpacked);
+    chess_check_flags_update(&unpacked);
+    if (chess_is_king_under_attack(&unpacked, CHESS_COLOR_OPPONENT(unpacked.current_turn))) {
+        return -1;
+    }
+    *chess_ctx = unpacked;
+    return 0;
+}
+
+static int write_all(int fd, const void* data, size_t size) {
+    const char* bytes = data;
+    while (size) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int packed_writer_open(Packed_Writer* writer, const char* path) {
+    Packed_Header header;
+
+    memset(writer, 0, sizeof(Packed_Writer));
+    writer->buffer = malloc(PACKED_WRITER_BUFFER_SIZE * sizeof(Packed_Position));
+    if (!writer->buffer) {
+        return -1;
+    }
+    writer->fd = path ? open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : STDOUT_FILENO;
+    writer->close_fd = path != NULL;
+    if (writer->fd < 0) {
+        free(writer->buffer);
+        return -1;
+    }
+
+    memset(&header, 0, sizeof(Packed_Header));
+    memcpy(header.magic, PACKED_MAGIC, sizeof(header.magic));
+    header.version = PACKED_VERSION;
+    header.record_size = sizeof(Packed_Position);
+    if (write_all(writer->fd, &header, sizeof(Packed_Header))) {
+        writer->failed = 1;
+    }
+    return 0;
+}
+
+int packed_writer_flush(Packed_Writer* writer) {
+    if (writer->buffered && write_all(writer->fd, writer->buffer, writer->buffered * sizeof(Packed_Position))) {
+        writer->failed = 1;
+    }
+    writer->written += writer->buffered;
+    writer->buffered = 0;
+    return writer->failed ? -1 : 0;
+}
+
+int packed_writer_append(Packed_Writer* writer, const Packed_Position* positions, size_t count) {
+    while (count) {
+        size_t chunk = PACKED_WRITER_BUFFER_SIZE - writer->buffered;
+        if (chunk > count) {
+            chunk = count;
+        }
+        memcpy(writer->buffer + writer->buffered, positions, chunk * sizeof(Packed_Position));
+        writer->buffered += chunk;
+        positions += chunk;
+        count -= chunk;
+        if (writer->buffered == PACKED_WRITER_BUFFER_SIZE && packed_writer_flush(writer)) {
+            return -1;
+        }
+    }
+    return writer->failed ? -1 : 0;
+}
+
+int packed_writer_close(Packed_Writer* writer) {
+    packed_writer_flush(writer);
+    if (writer->close_fd && close(writer->fd)) {
+        writer->failed = 1;
+    }
+    free(writer->buffer);
+    writer->buffer = NULL;
+    return writer->failed ? -1 : 0;
+}
+
+int packed_reader_open(Packed_Reader* reader, const char* path) {
+    struct stat file_stat;
+
+    memset(reader, 0, sizeof(Packed_Reader));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    if (fstat(fd, &file_stat) || file_stat.st_size < (off_t)sizeof(Packed_Header) ||
+        (file_stat.st_size - sizeof(Packed_Header)) % sizeof(Packed_Position)) {
+        close(fd);
+        return -1;
+    }
+
+    void* mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return -1;
+    }
+    madvise(mapping, file_stat.st_size, MADV_SEQUENTIAL);
+
+    const Packed_Header* header = mapping;
+    if (memcmp(header->magic, PACKED_MAGIC, sizeof(header->magic)) || header->version != PACKED_VERSION ||
+        header->record_size != sizeof(Packed_Position)) {
+        munmap(mapping, file_stat.st_size);
+        return -1;
+    }
+
+    reader->mapping = mapping;
+    reader->mapping_size = file_stat.st_size;
+    reader->positions = (const Packed_Position*)(header + 1);
+    reader->count = (file_stat.st_size - sizeof(Packed_Header)) / sizeof(Packed_Position);
+    return 0;
+}
+
+void packed_reader_close(Packed_Reader* reader) {
+    if (reader->mapping) {
+        munmap(reader->mapping, reader->mapping_size);
+    }
+    memset(reader, 0, sizeof(Packed_Reader));
+}
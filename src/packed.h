@@ -0,0 +1,79 @@
+#ifndef GOLDENPAWN_PACKED_H
+#define GOLDENPAWN_PACKED_H
+#include "chess.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Positions for training data and tooling in 32 bytes. The occupancy bitboard gives the occupied squares from a1 to
+// h8, and pieces holds one nibble per occupied square in the same order, low nibble first: the piece type in bits
+// 0-2 and bit 3 set for black. Files are a header followed by an array of these records, in host byte order.
+typedef struct {
+    uint64_t occupancy;
+    uint8_t pieces[16];
+    int16_t score;
+    uint16_t fullmove_number;
+    uint8_t state;
+    uint8_t en_passant_square;
+    uint8_t halfmove_clock;
+    uint8_t result;
+} Packed_Position;
+
+// state: side to move in bit 0 (set for black), castling rights in bits 1-4.
+#define PACKED_STATE_BLACK 0x1
+#define PACKED_STATE_CASTLING_SHIFT 1
+
+// Game result from white's point of view.
+typedef enum {
+    PACKED_RESULT_UNKNOWN,
+    PACKED_RESULT_WHITE_WIN,
+    PACKED_RESULT_DRAW,
+    PACKED_RESULT_BLACK_WIN
+} Packed_Result;
+
+#define PACKED_MAGIC "GPPACKED"
+#define PACKED_VERSION 1
+
+// Header sized like a record, so the records of a mapped file stay aligned.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint8_t reserved[16];
+} Packed_Header;
+
+#define PACKED_WRITER_BUFFER_SIZE 4096
+
+// Buffers records and writes them in large blocks. Not thread safe; writers shared by threads need a lock.
+typedef struct {
+    int fd;
+    int close_fd;
+    int failed;
+    size_t buffered;
+    uint64_t written;
+    Packed_Position* buffer;
+} Packed_Writer;
+
+// The whole file mapped read only; positions points at the first record.
+typedef struct {
+    const Packed_Position* positions;
+    size_t count;
+    void* mapping;
+    size_t mapping_size;
+} Packed_Reader;
+
+// The score is in centipawns from the point of view of the side to move. Fails if there are more than 32 pieces.
+int packed_position_pack(const Chess_Context* chess_ctx, int score, Packed_Result result, Packed_Position* position);
+// Rebuilds the full context, hash and check flags included. Fails on records that do not describe a position.
+int packed_position_unpack(const Packed_Position* position, Chess_Context* chess_ctx);
+
+// A NULL path writes to the standard output.
+int packed_writer_open(Packed_Writer* writer, const char* path);
+int packed_writer_append(Packed_Writer* writer, const Packed_Position* positions, size_t count);
+int packed_writer_flush(Packed_Writer* writer);
+// Flushes and closes; returns -1 if any write failed.
+int packed_writer_close(Packed_Writer* writer);
+
+int packed_reader_open(Packed_Reader* reader, const char* path);
+void packed_reader_close(Packed_Reader* reader);
+
+#endif
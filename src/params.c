@@ -0,0 +1,41 @@
+#include "params.h"
+#include <stdio.h>
+#include <string.h>
+
+int params_load(const char* path, AI_Eval_Params* params) {
+    char line[256];
+    char name[64];
+    float value;
+    int result = 0;
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    while (!result && fgets(line, sizeof(line), file)) {
+        if (line[0] == '#' || sscanf(line, "%63s", name) != 1) {
+            continue;
+        }
+        int param = 0;
+        for (; param < AI_PARAMS_NUM && strcmp(name, ai_param_names[param]); ++param);
+        if (param == AI_PARAMS_NUM || sscanf(line, "%*s %f", &value) != 1) {
+            result = -1;
+            break;
+        }
+        params->values[param] = value;
+    }
+    fclose(file);
+    return result;
+}
+
+int params_save(const char* path, const AI_Eval_Params* params) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        return -1;
+    }
+    fprintf(file, "# goldenpawn evaluation parameters, in pawns\n");
+    for (int param = 0; param < AI_PARAMS_NUM; ++param) {
+        fprintf(file, "%s %.6f\n", ai_param_names[param], params->values[param]);
+    }
+    return fclose(file) ? -1 : 0;
+}
@@ -0,0 +1,10 @@
+#ifndef GOLDENPAWN_PARAMS_H
+#define GOLDENPAWN_PARAMS_H
+#include "ai.h"
+
+// Parameter files hold one "name value" line per evaluation parameter; blank lines and lines starting with '#'
+// are skipped. Parameters missing from a file keep the value they had in params.
+int params_load(const char* path, AI_Eval_Params* params);
+int params_save(const char* path, const AI_Eval_Params* params);
+
+#endif
@@ -0,0 +1,484 @@
+#include "selfplay.h"
+#include "ai.h"
+#include "memory.h"
+#include "fen.h"
+#include "packed.h"
+#include "bitbase.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define SELFPLAY_MAX_PLIES 1024
+#define SELFPLAY_PGN_SIZE (SELFPLAY_MAX_PLIES * 12 + 1024)
+#define SELFPLAY_DEFAULT_NODES 10000
+#define SELFPLAY_DEFAULT_HASH_MB 16
+// A game is adjudicated as won once the score stays beyond SELFPLAY_WIN_SCORE for the winner for
+// SELFPLAY_WIN_PLIES plies in a row, and as drawn once it stays within SELFPLAY_DRAW_SCORE of zero for
+// SELFPLAY_DRAW_PLIES plies after SELFPLAY_DRAW_MIN_PLY.
+#define SELFPLAY_WIN_SCORE 1000
+#define SELFPLAY_WIN_PLIES 6
+#define SELFPLAY_DRAW_SCORE 10
+#define SELFPLAY_DRAW_PLIES 12
+#define SELFPLAY_DRAW_MIN_PLY 80
+
+static const char* start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+typedef enum {
+    SELFPLAY_FORMAT_PACKED,
+    SELFPLAY_FORMAT_PGN
+} Selfplay_Format;
+
+typedef struct {
+    AI_Limits limits;
+    size_t hash_size_mb;
+    int games_num;
+    int random_plies;
+    int max_plies;
+    Selfplay_Format format;
+    Syzygy_Context syzygy_ctx;
+    Chess_Context* openings;
+    int openings_num;
+    int next_game;
+    int results[4];
+    uint64_t positions_num;
+    Packed_Writer writer;
+    FILE* pgn_output;
+    int failed;
+    pthread_mutex_t mutex;
+} Selfplay_Context;
+
+// Everything about one game, kept per worker and reused from game to game.
+typedef struct {
+    Chess_Context start_ctx;
+    Chess_Packed_Move moves[SELFPLAY_MAX_PLIES];
+    uint64_t hashes[SELFPLAY_MAX_PLIES + 1];
+    Packed_Position positions[SELFPLAY_MAX_PLIES];
+    int plies;
+    int positions_num;
+    Packed_Result result;
+    int adjudicated;
+    char pgn[SELFPLAY_PGN_SIZE];
+} Selfplay_Game;
+
+static void usage_print() {
+    fprintf(stderr, "usage: goldenpawn selfplay [--games N] [--concurrency J] [--nodes K | --depth D] [--openings <file>]\n");
+    fprintf(stderr, "                           [--output <file>] [--format packed|pgn] [--random-plies R] [--max-plies P]\n");
+    fprintf(stderr, "                           [--hash MB] [--syzygy PATH]\n");
+}
+
+static uint64_t random_next(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static int is_insufficient_material(const Chess_Context* chess_ctx) {
+    int minors = 0;
+    for (int square = 0; square < CHESS_BOARD_HEIGHT * CHESS_BOARD_WIDTH; ++square) {
+        switch (CHESS_PIECE_TYPE(chess_ctx->board[square])) {
+            case CHESS_PIECE_PAWN:
+            case CHESS_PIECE_ROOK:
+            case CHESS_PIECE_QUEEN:
+                return 0;
+            case CHESS_PIECE_KNIGHT:
+            case CHESS_PIECE_BISHOP:
+                ++minors;
+                break;
+            default:
+                break;
+        }
+    }
+    return minors <= 1;
+}
+
+// Positions can only repeat since the last capture or pawn move, and only with the same side to move.
+static int is_threefold_repetition(const Selfplay_Game* game, const Chess_Context* chess_ctx) {
+    int repetitions = 0;
+    for (int ply = game->plies - 2; ply >= 0 && ply >= game->plies - chess_ctx->halfmove_clock; ply -= 2) {
+        if (game->hashes[ply] == chess_ctx->hash && ++repetitions == 2) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void game_play(Selfplay_Context* sp_ctx, AI_Context* ai_ctx, int game_index, Selfplay_Game* game) {
+    Chess_Context chess_ctx = sp_ctx->openings[game_index % sp_ctx->openings_num];
+    Chess_Move_List move_list;
+    AI_Result ai_result;
+    uint64_t random_state = (uint64_t)(game_index + 1) * 0x9E3779B97F4A7C15ULL;
+    int win_plies = 0, draw_plies = 0;
+
+    game->start_ctx = chess_ctx;
+    game->plies = 0;
+    game->positions_num = 0;
+    game->adjudicated = 0;
+    ai_new_game(ai_ctx);
+
+    for (;;) {
+        game->hashes[game->plies] = chess_ctx.hash;
+        chess_generate_moves(&chess_ctx, &move_list);
+        if (!move_list.count) {
+            if (!chess_is_king_under_attack(&chess_ctx, chess_ctx.current_turn)) {
+                game->result = PACKED_RESULT_DRAW;
+            } else {
+                game->result = chess_ctx.current_turn == CHESS_COLOR_WHITE ? PACKED_RESULT_BLACK_WIN : PACKED_RESULT_WHITE_WIN;
+            }
+            break;
+        }
+        if (chess_ctx.halfmove_clock >= 100 || is_threefold_repetition(game, &chess_ctx) ||
+            is_insufficient_material(&chess_ctx)) {
+            game->result = PACKED_RESULT_DRAW;
+            break;
+        }
+        if (game->plies >= sp_ctx->max_plies) {
+            game->result = PACKED_RESULT_DRAW;
+            game->adjudicated = 1;
+            break;
+        }
+
+        Chess_Packed_Move move;
+        if (game->plies < sp_ctx->random_plies) {
+            move = move_list.moves[random_next(&random_state) % move_list.count];
+        } else {
+            ai_search(ai_ctx, &chess_ctx, &sp_ctx->limits, &ai_result);
+            int score = ai_score_to_centipawns(ai_result.score);
+            if (!packed_position_pack(&chess_ctx, score, PACKED_RESULT_UNKNOWN, &game->positions[game->positions_num])) {
+                ++game->positions_num;
+            }
+
+            int white_score = chess_ctx.current_turn == CHESS_COLOR_WHITE ? score : -score;
+            if (white_score >= SELFPLAY_WIN_SCORE) {
+                win_plies = win_plies > 0 ? win_plies + 1 : 1;
+            } else if (white_score <= -SELFPLAY_WIN_SCORE) {
+                win_plies = win_plies < 0 ? win_plies - 1 : -1;
+            } else {
+                win_plies = 0;
+            }
+            draw_plies = game->plies >= SELFPLAY_DRAW_MIN_PLY && abs(score) <= SELFPLAY_DRAW_SCORE ? draw_plies + 1 : 0;
+            if (abs(win_plies) >= SELFPLAY_WIN_PLIES || draw_plies >= SELFPLAY_DRAW_PLIES) {
+                game->result = win_plies > 0 ? PACKED_RESULT_WHITE_WIN : win_plies < 0 ? PACKED_RESULT_BLACK_WIN : PACKED_RESULT_DRAW;
+                game->adjudicated = 1;
+                break;
+            }
+            // A node limit can stop the search before its first iteration completes.
+            move = ai_result.best_move != CHESS_MOVE_NONE ? ai_result.best_move : move_list.moves[0];
+        }
+
+        game->moves[game->plies++] = move;
+        chess_make_move(&chess_ctx, &chess_ctx, move);
+    }
+
+    for (int i = 0; i < game->positions_num; ++i) {
+        game->positions[i].result = game->result;
+    }
+}
+
+// Standard algebraic notation, which needs the legal moves of the position for disambiguation and the position
+// after the move for the check suffix.
+static int move_to_san(const Chess_Context* chess_ctx, Chess_Packed_Move move, char* san) {
+    static const char piece_letters[] = " KQNBRP";
+    Chess_Move_List move_list;
+    Chess_Context next_ctx;
+    int from = CHESS_MOVE_FROM(move), to = CHESS_MOVE_TO(move);
+    Chess_Piece_Type type = CHESS_PIECE_TYPE(chess_ctx->board[from]);
+    char* out = san;
+
+    if (CHESS_MOVE_FLAGS(move) == CHESS_MOVE_FLAG_CASTLING) {
+        out += sprintf(out, to % CHESS_BOARD_WIDTH == 6 ? "O-O" : "O-O-O");
+    } else {
+        if (type == CHESS_PIECE_PAWN) {
+            if (CHESS_MOVE_IS_CAPTURE(move)) {
+                *out++ = 'a' + from % CHESS_BOARD_WIDTH;
+            }
+        } else {
+            int same_file = 0, same_rank = 0, ambiguous = 0;
+            chess_generate_moves(chess_ctx, &move_list);
+            for (int i = 0; i < move_list.count; ++i) {
+                int other = CHESS_MOVE_FROM(move_list.moves[i]);
+                if (other == from || CHESS_MOVE_TO(move_list.moves[i]) != to ||
+                    CHESS_PIECE_TYPE(chess_ctx->board[other]) != type) {
+                    continue;
+                }
+                ambiguous = 1;
+                same_file |= other % CHESS_BOARD_WIDTH == from % CHESS_BOARD_WIDTH;
+                same_rank |= other / CHESS_BOARD_WIDTH == from / CHESS_BOARD_WIDTH;
+            }
+            *out++ = piece_letters[type];
+            if (ambiguous && (!same_file || same_rank)) {
+                *out++ = 'a' + from % CHESS_BOARD_WIDTH;
+            }
+            if (ambiguous && same_file) {
+                *out++ = '1' + from / CHESS_BOARD_WIDTH;
+            }
+        }
+        if (CHESS_MOVE_IS_CAPTURE(move)) {
+            *out++ = 'x';
+        }
+        *out++ = 'a' + to % CHESS_BOARD_WIDTH;
+        *out++ = '1' + to / CHESS_BOARD_WIDTH;
+        if (CHESS_MOVE_IS_PROMOTION(move)) {
+            *out++ = '=';
+            *out++ = piece_letters[chess_move_promotion_type(move)];
+        }
+    }
+
+    chess_make_move(chess_ctx, &next_ctx, move);
+    if (chess_is_king_under_attack(&next_ctx, next_ctx.current_turn)) {
+        chess_generate_moves(&next_ctx, &move_list);
+        *out++ = move_list.count ? '+' : '#';
+    }
+    *out = '\0';
+    return out - san;
+}
+
+static void game_pgn_build(Selfplay_Game* game, int game_index) {
+    static const char* results[] = { "*", "1-0", "1/2-1/2", "0-1" };
+    const char* result = results[game->result];
+    Chess_Context chess_ctx = game->start_ctx;
+    char fen[FEN_MAX_SIZE];
+    char san[16];
+    char* out = game->pgn;
+    char* end = game->pgn + SELFPLAY_PGN_SIZE;
+    int line_length = 0;
+
+    out += snprintf(out, end - out, "[Event \"goldenpawn selfplay\"]\n[Site \"?\"]\n[Date \"????.??.??\"]\n"
+        "[Round \"%d\"]\n[White \"goldenpawn\"]\n[Black \"goldenpawn\"]\n[Result \"%s\"]\n", game_index + 1, result);
+    fen_from_context(&chess_ctx, fen, sizeof(fen));
+    if (strcmp(fen, start_fen)) {
+        out += snprintf(out, end - out, "[SetUp \"1\"]\n[FEN \"%s\"]\n", fen);
+    }
+    out += snprintf(out, end - out, "[Termination \"%s\"]\n\n", game->adjudicated ? "adjudication" : "normal");
+
+    for (int ply = 0; ply < game->plies; ++ply) {
+        char token[32];
+        int length = 0;
+        if (chess_ctx.current_turn == CHESS_COLOR_WHITE) {
+            length = sprintf(token, "%d. ", chess_ctx.fullmove_number);
+        } else if (!ply) {
+            length = sprintf(token, "%d... ", chess_ctx.fullmove_number);
+        }
+        move_to_san(&chess_ctx, game->moves[ply], san);
+        length += sprintf(token + length, "%s", san);
+        if (line_length && line_length + 1 + length > 79) {
+            out += snprintf(out, end - out, "\n");
+            line_length = 0;
+        }
+        out += snprintf(out, end - out, line_length ? " %s" : "%s", token);
+        line_length += length + (line_length ? 1 : 0);
+        chess_make_move(&chess_ctx, &chess_ctx, game->moves[ply]);
+    }
+    snprintf(out, end - out, "%s%s\n\n", line_length ? " " : "", result);
+}
+
+static void* selfplay_worker(void* arg) {
+    Selfplay_Context* sp_ctx = arg;
+    memory_thread_pin();
+    AI_Context* ai_ctx = malloc(sizeof(AI_Context));
+    Selfplay_Game* game = malloc(sizeof(Selfplay_Game));
+    if (!ai_ctx || !game || ai_init(ai_ctx, &sp_ctx->syzygy_ctx, sp_ctx->hash_size_mb, NULL)) {
+        fprintf(stderr, "selfplay: could not allocate the search tables of a worker\n");
+        free(ai_ctx);
+        free(game);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&sp_ctx->mutex);
+    while (sp_ctx->next_game < sp_ctx->games_num && !sp_ctx->failed) {
+        int game_index = sp_ctx->next_game++;
+        pthread_mutex_unlock(&sp_ctx->mutex);
+
+        game_play(sp_ctx, ai_ctx, game_index, game);
+        if (sp_ctx->format == SELFPLAY_FORMAT_PGN) {
+            game_pgn_build(game, game_index);
+        }
+
+        pthread_mutex_lock(&sp_ctx->mutex);
+        ++sp_ctx->results[game->result];
+        sp_ctx->positions_num += game->positions_num;
+        if (sp_ctx->format == SELFPLAY_FORMAT_PGN) {
+            if (fputs(game->pgn, sp_ctx->pgn_output) == EOF) {
+                sp_ctx->failed = 1;
+            }
+        } else if (packed_writer_append(&sp_ctx->writer, game->positions, game->positions_num)) {
+            sp_ctx->failed = 1;
+        }
+    }
+    pthread_mutex_unlock(&sp_ctx->mutex);
+
+    ai_release(ai_ctx);
+    free(ai_ctx);
+    free(game);
+    return NULL;
+}
+
+static int openings_load(Selfplay_Context* sp_ctx, const char* path) {
+    if (!path) {
+        sp_ctx->openings = malloc(sizeof(Chess_Context));
+        if (!sp_ctx->openings) {
+            return -1;
+        }
+        sp_ctx->openings_num = 1;
+        return fen_chess_context_parse(sp_ctx->openings, start_fen);
+    }
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    int capacity = 0;
+    while ((length = getline(&line, &line_capacity, file)) >= 0) {
+        Chess_Context chess_ctx;
+        if (fen_chess_context_parse_view(&chess_ctx, line, length) < 0) {
+            continue;
+        }
+        if (sp_ctx->openings_num == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            Chess_Context* openings = realloc(sp_ctx->openings, capacity * sizeof(Chess_Context));
+            if (!openings) {
+                break;
+            }
+            sp_ctx->openings = openings;
+        }
+        sp_ctx->openings[sp_ctx->openings_num++] = chess_ctx;
+    }
+    free(line);
+    fclose(file);
+    return sp_ctx->openings_num ? 0 : -1;
+}
+
+static int arguments_parse(Selfplay_Context* sp_ctx, int argc, char** argv, int* jobs, const char** openings_path,
+    const char** output_path, const char** syzygy_path) {
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            return -1;
+        }
+        if (!strcmp(argv[i], "--games")) {
+            sp_ctx->games_num = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--concurrency")) {
+            *jobs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--nodes")) {
+            sp_ctx->limits.nodes = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--depth")) {
+            sp_ctx->limits.depth = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--openings")) {
+            *openings_path = argv[++i];
+        } else if (!strcmp(argv[i], "--output")) {
+            *output_path = argv[++i];
+        } else if (!strcmp(argv[i], "--format")) {
+            ++i;
+            if (!strcmp(argv[i], "packed")) {
+                sp_ctx->format = SELFPLAY_FORMAT_PACKED;
+            } else if (!strcmp(argv[i], "pgn")) {
+                sp_ctx->format = SELFPLAY_FORMAT_PGN;
+            } else {
+                return -1;
+            }
+        } else if (!strcmp(argv[i], "--random-plies")) {
+            sp_ctx->random_plies = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-plies")) {
+            sp_ctx->max_plies = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--hash")) {
+            sp_ctx->hash_size_mb = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--syzygy")) {
+            *syzygy_path = argv[++i];
+        } else {
+            return -1;
+        }
+    }
+    if (sp_ctx->games_num < 1 || *jobs < 1 || sp_ctx->hash_size_mb < 1 || sp_ctx->hash_size_mb > TT_MAX_SIZE_MB ||
+        sp_ctx->limits.depth < 0 || sp_ctx->limits.depth > AI_MAX_DEPTH || sp_ctx->random_plies < 0 ||
+        sp_ctx->max_plies < 1 || sp_ctx->max_plies > SELFPLAY_MAX_PLIES) {
+        return -1;
+    }
+    if (!sp_ctx->limits.depth && !sp_ctx->limits.nodes) {
+        sp_ctx->limits.nodes = SELFPLAY_DEFAULT_NODES;
+    }
+    return 0;
+}
+
+// Workers take games from a shared counter and play them start to finish on their own search state, so the only
+// shared work is appending each finished game to the output.
+int selfplay_main(int argc, char** argv) {
+    Selfplay_Context sp_ctx;
+    const char* openings_path = NULL;
+    const char* output_path = NULL;
+    const char* syzygy_path = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = cpus > 0 ? (int)cpus : 1;
+
+    memset(&sp_ctx, 0, sizeof(Selfplay_Context));
+    sp_ctx.games_num = 100;
+    sp_ctx.hash_size_mb = SELFPLAY_DEFAULT_HASH_MB;
+    sp_ctx.random_plies = 8;
+    sp_ctx.max_plies = 400;
+    if (arguments_parse(&sp_ctx, argc, argv, &jobs, &openings_path, &output_path, &syzygy_path)) {
+        usage_print();
+        return 1;
+    }
+    if (jobs > sp_ctx.games_num) {
+        jobs = sp_ctx.games_num;
+    }
+
+    if (openings_load(&sp_ctx, openings_path)) {
+        fprintf(stderr, "selfplay: no openings could be read from %s\n", openings_path);
+        free(sp_ctx.openings);
+        return 1;
+    }
+    if (sp_ctx.format == SELFPLAY_FORMAT_PGN) {
+        sp_ctx.pgn_output = output_path ? fopen(output_path, "w") : stdout;
+    }
+    if (sp_ctx.format == SELFPLAY_FORMAT_PGN ? !sp_ctx.pgn_output : packed_writer_open(&sp_ctx.writer, output_path) != 0) {
+        fprintf(stderr, "selfplay: could not create %s\n", output_path ? output_path : "the output");
+        free(sp_ctx.openings);
+        return 1;
+    }
+
+    bitbase_init();
+    syzygy_init(&sp_ctx.syzygy_ctx);
+    if (syzygy_path) {
+        syzygy_path_set(&sp_ctx.syzygy_ctx, syzygy_path);
+    }
+    pthread_mutex_init(&sp_ctx.mutex, NULL);
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    pthread_t* workers = malloc(jobs * sizeof(pthread_t));
+    int workers_num = 0;
+    for (; workers && workers_num < jobs; ++workers_num) {
+        if (pthread_create(&workers[workers_num], NULL, selfplay_worker, &sp_ctx)) {
+            break;
+        }
+    }
+    for (int i = 0; i < workers_num; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+
+    int result = !workers_num || sp_ctx.failed || sp_ctx.next_game < sp_ctx.games_num;
+    if (sp_ctx.format == SELFPLAY_FORMAT_PGN) {
+        if (fflush(sp_ctx.pgn_output)) result = 1;
+        if (sp_ctx.pgn_output != stdout) fclose(sp_ctx.pgn_output);
+    } else if (packed_writer_close(&sp_ctx.writer)) {
+        result = 1;
+    }
+
+    double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    int played = sp_ctx.results[PACKED_RESULT_WHITE_WIN] + sp_ctx.results[PACKED_RESULT_DRAW] + sp_ctx.results[PACKED_RESULT_BLACK_WIN];
+    fprintf(stderr, "selfplay: %d games (+%d =%d -%d), %llu positions in %.3f s (%.2f games per second)%s\n", played,
+        sp_ctx.results[PACKED_RESULT_WHITE_WIN], sp_ctx.results[PACKED_RESULT_DRAW], sp_ctx.results[PACKED_RESULT_BLACK_WIN],
+        (unsigned long long)sp_ctx.positions_num, seconds, seconds > 0 ? played / seconds : 0.0, result ? ", failed" : "");
+
+    pthread_mutex_destroy(&sp_ctx.mutex);
+    syzygy_release(&sp_ctx.syzygy_ctx);
+    free(workers);
+    free(sp_ctx.openings);
+    return result;
+}
@@ -0,0 +1,8 @@
+#ifndef GOLDENPAWN_SELFPLAY_H
+#define GOLDENPAWN_SELFPLAY_H
+
+// goldenpawn selfplay [--games N] [--concurrency J] [--nodes K | --depth D] [--openings <file>] [--output <file>]
+//                     [--format packed|pgn] [--random-plies R] [--max-plies P] [--hash MB] [--syzygy PATH]
+int selfplay_main(int argc, char** argv);
+
+#endif
@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include "io.h"
+#include "tt.h"
+#include "memory.h"
+#include "logger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define SERVER_DEFAULT_HASH_MB 1024
+#define SERVER_SESSIONS_SIZE 64
+
+typedef enum {
+    SERVER_SESSION_IDLE,
+    SERVER_SESSION_BUSY,
+    SERVER_SESSION_CLOSED
+} Server_Session_State;
+
+typedef struct Server_Session {
+    struct Server_Session* next_queued;
+    Server_Session_State state;
+    int fd;
+    IO_Context io_ctx;
+} Server_Session;
+
+// The poll thread owns the session list: it watches idle sessions and queues the readable ones, and a worker
+// runs the queued commands and hands the session back through the wake pipe. A session waiting for input holds
+// no worker, so two sessions playing each other can't starve the pool.
+typedef struct {
+    int listen_fd;
+    int wake_pipe[2];
+    TT_Budget tt_budget;
+    // Searches run on threads of their sessions; the slots keep them to one per worker.
+    IO_Search_Slots search_slots;
+    Server_Session** sessions;
+    int sessions_num;
+    int sessions_capacity;
+    Server_Session* queue_head;
+    Server_Session* queue_tail;
+    int finished;
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+} Server_Context;
+
+// Written from the signal handler, which has no other way to reach the poll loop.
+static int server_signal_fd = -1;
+static volatile sig_atomic_t server_stop;
+
+static void usage_print() {
+    fprintf(stderr, "usage: goldenpawn server --socket <path> [--workers N] [--hash MB]\n");
+}
+
+static void signal_handle(int signal_number) {
+    (void)signal_number;
+    server_stop = 1;
+    if (server_signal_fd >= 0) {
+        ssize_t ignored = write(server_signal_fd, "", 1);
+        (void)ignored;
+    }
+}
+
+static void wake_up(Server_Context* server_ctx) {
+    ssize_t ignored = write(server_ctx->wake_pipe[1], "", 1);
+    (void)ignored;
+}
+
+static void* server_worker(void* arg) {
+    Server_Context* server_ctx = arg;
+
+    // Sessions move from worker to worker and their tables are interleaved, so pinning only spreads the workers.
+    memory_thread_pin();
+    pthread_mutex_lock(&server_ctx->mutex);
+    for (;;) {
+        while (!server_ctx->queue_head && !server_ctx->finished) {
+            pthread_cond_wait(&server_ctx->work_available, &server_ctx->mutex);
+        }
+        if (!server_ctx->queue_head) {
+            break;
+        }
+
+        Server_Session* session = server_ctx->queue_head;
+        server_ctx->queue_head = session->next_queued;
+        if (!server_ctx->queue_head) {
+            server_ctx->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&server_ctx->mutex);
+
+        int over = io_process(&session->io_ctx);
+
+        pthread_mutex_lock(&server_ctx->mutex);
+        session->state = over ? SERVER_SESSION_CLOSED : SERVER_SESSION_IDLE;
+        wake_up(server_ctx);
+    }
+    pthread_mutex_unlock(&server_ctx->mutex);
+    return NULL;
+}
+
+static void session_release(Server_Session* session) {
+    io_release(&session->io_ctx);
+    close(session->fd);
+    free(session);
+}
+
+static void session_accept(Server_Context* server_ctx) {
+    int fd = accept4(server_ctx->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    if (server_ctx->sessions_num == server_ctx->sessions_capacity) {
+        int capacity = server_ctx->sessions_capacity ? server_ctx->sessions_capacity * 2 : SERVER_SESSIONS_SIZE;
+        Server_Session** sessions = realloc(server_ctx->sessions, capacity * sizeof(Server_Session*));
+        if (!sessions) {
+            close(fd);
+            return;
+        }
+        server_ctx->sessions = sessions;
+        server_ctx->sessions_capacity = capacity;
+    }
+
+    Server_Session* session = malloc(sizeof(Server_Session));
+    if (!session || io_init(&session->io_ctx, fd, fd, 1, &server_ctx->tt_budget, &server_ctx->search_slots)) {
+        static const char message[] = "info string server is out of memory for a new session\n";
+        ssize_t ignored = write(fd, message, sizeof(message) - 1);
+        (void)ignored;
+        free(session);
+        close(fd);
+        return;
+    }
+    session->next_queued = NULL;
+    session->state = SERVER_SESSION_IDLE;
+    session->fd = fd;
+    server_ctx->sessions[server_ctx->sessions_num++] = session;
+    log_info("session %d connected, %d open", fd, server_ctx->sessions_num);
+}
+
+// Frees the sessions whose worker saw them end. Only the poll thread adds or removes sessions.
+static void sessions_reap(Server_Context* server_ctx) {
+    int kept = 0;
+    for (int i = 0; i < server_ctx->sessions_num; ++i) {
+        Server_Session* session = server_ctx->sessions[i];
+        pthread_mutex_lock(&server_ctx->mutex);
+        Server_Session_State state = session->state;
+        pthread_mutex_unlock(&server_ctx->mutex);
+
+        if (state == SERVER_SESSION_CLOSED) {
+            log_info("session %d closed", session->fd);
+            session_release(session);
+        } else {
+            server_ctx->sessions[kept++] = session;
+        }
+    }
+    server_ctx->sessions_num = kept;
+}
+
+static void session_queue(Server_Context* server_ctx, Server_Session* session) {
+    pthread_mutex_lock(&server_ctx->mutex);
+    session->state = SERVER_SESSION_BUSY;
+    session->next_queued = NULL;
+    if (server_ctx->queue_tail) {
+        server_ctx->queue_tail->next_queued = session;
+    } else {
+        server_ctx->queue_head = session;
+    }
+    server_ctx->queue_tail = session;
+    pthread_cond_signal(&server_ctx->work_available);
+    pthread_mutex_unlock(&server_ctx->mutex);
+}
+
+static void server_run(Server_Context* server_ctx) {
+    struct pollfd* pollfds = NULL;
+    Server_Session** polled = NULL;
+    int polled_capacity = 0;
+
+    while (!server_stop) {
+        if (!pollfds || polled_capacity < server_ctx->sessions_num) {
+            int capacity = server_ctx->sessions_capacity ? server_ctx->sessions_capacity : SERVER_SESSIONS_SIZE;
+            struct pollfd* new_pollfds = realloc(pollfds, (capacity + 2) * sizeof(struct pollfd));
+            if (new_pollfds) {
+                pollfds = new_pollfds;
+            }
+            Server_Session** new_polled = realloc(polled, capacity * sizeof(Server_Session*));
+            if (new_polled) {
+                polled = new_polled;
+            }
+            if (!new_pollfds || !new_polled) {
+                log_info("Error: out of memory in the server loop");
+                break;
+            }
+            polled_capacity = capacity;
+        }
+
+        pollfds[0] = (struct pollfd){ .fd = server_ctx->listen_fd, .events = POLLIN };
+        pollfds[1] = (struct pollfd){ .fd = server_ctx->wake_pipe[0], .events = POLLIN };
+        int polled_num = 0;
+        pthread_mutex_lock(&server_ctx->mutex);
+        for (int i = 0; i < server_ctx->sessions_num; ++i) {
+            if (server_ctx->sessions[i]->state == SERVER_SESSION_IDLE) {
+                polled[polled_num] = server_ctx->sessions[i];
+                pollfds[polled_num + 2] = (struct pollfd){ .fd = server_ctx->sessions[i]->fd, .events = POLLIN };
+                ++polled_num;
+            }
+        }
+        pthread_mutex_unlock(&server_ctx->mutex);
+
+        if (poll(pollfds, polled_num + 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_info("Error: poll failed (%s)", strerror(errno));
+            break;
+        }
+
+        if (pollfds[1].revents) {
+            char drain[64];
+            while (read(server_ctx->wake_pipe[0], drain, sizeof(drain)) > 0);
+        }
+        for (int i = 0; i < polled_num; ++i) {
+            if (pollfds[i + 2].revents) {
+                session_queue(server_ctx, polled[i]);
+            }
+        }
+        sessions_reap(server_ctx);
+        if (pollfds[0].revents & POLLIN) {
+            session_accept(server_ctx);
+        }
+    }
+
+    free(pollfds);
+    free(polled);
+}
+
+static int listen_socket_open(const char* path) {
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "server: socket path %s is too long\n", path);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        fprintf(stderr, "server: could not create a socket (%s)\n", strerror(errno));
+        return -1;
+    }
+    // A socket file left by a previous run would make bind fail.
+    unlink(path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) || listen(fd, SOMAXCONN)) {
+        fprintf(stderr, "server: could not listen on %s (%s)\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int arguments_parse(int argc, char** argv, const char** socket_path, int* workers_num, size_t* hash_mb) {
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            return -1;
+        }
+        if (!strcmp(argv[i], "--socket")) {
+            *socket_path = argv[++i];
+        } else if (!strcmp(argv[i], "--workers")) {
+            *workers_num = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--hash")) {
+            *hash_mb = strtoull(argv[++i], NULL, 10);
+        } else {
+            return -1;
+        }
+    }
+    if (!*socket_path || *workers_num < 1 || *hash_mb < 1) {
+        return -1;
+    }
+    return 0;
+}
+
+int server_main(int argc, char** argv) {
+    Server_Context server_ctx;
+    const char* socket_path = NULL;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers_num = cpus > 0 ? (int)cpus : 1;
+    size_t hash_mb = SERVER_DEFAULT_HASH_MB;
+
+    if (arguments_parse(argc, argv, &socket_path, &workers_num, &hash_mb)) {
+        usage_print();
+        return 1;
+    }
+
+    memset(&server_ctx, 0, sizeof(Server_Context));
+    if (pipe2(server_ctx.wake_pipe, O_NONBLOCK | O_CLOEXEC)) {
+        fprintf(stderr, "server: could not create the wake pipe\n");
+        return 1;
+    }
+    server_ctx.listen_fd = listen_socket_open(socket_path);
+    if (server_ctx.listen_fd < 0) {
+        close(server_ctx.wake_pipe[0]);
+        close(server_ctx.wake_pipe[1]);
+        return 1;
+    }
+
+    // A client going away mid-reply must only end its own session.
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &action, NULL);
+    server_signal_fd = server_ctx.wake_pipe[1];
+    action.sa_handler = signal_handle;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    tt_budget_init(&server_ctx.tt_budget, hash_mb);
+    io_search_slots_init(&server_ctx.search_slots, workers_num);
+    pthread_mutex_init(&server_ctx.mutex, NULL);
+    pthread_cond_init(&server_ctx.work_available, NULL);
+
+    pthread_t* workers = malloc(workers_num * sizeof(pthread_t));
+    int started = 0;
+    for (; workers && started < workers_num; ++started) {
+        if (pthread_create(&workers[started], NULL, server_worker, &server_ctx)) {
+            break;
+        }
+    }
+
+    if (started) {
+        log_info("listening on %s with %d workers, %zu MB of hash and %d NUMA nodes", socket_path, started, hash_mb,
+            memory_numa_nodes_num());
+        server_run(&server_ctx);
+    } else {
+        fprintf(stderr, "server: could not start the workers\n");
+    }
+
+    pthread_mutex_lock(&server_ctx.mutex);
+    server_ctx.finished = 1;
+    pthread_cond_broadcast(&server_ctx.work_available);
+    pthread_mutex_unlock(&server_ctx.mutex);
+    for (int i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (int i = 0; i < server_ctx.sessions_num; ++i) {
+        session_release(server_ctx.sessions[i]);
+    }
+    server_signal_fd = -1;
+    close(server_ctx.listen_fd);
+    unlink(socket_path);
+    close(server_ctx.wake_pipe[0]);
+    close(server_ctx.wake_pipe[1]);
+    pthread_cond_destroy(&server_ctx.work_available);
+    pthread_mutex_destroy(&server_ctx.mutex);
+    tt_budget_release(&server_ctx.tt_budget);
+    io_search_slots_release(&server_ctx.search_slots);
+    free(server_ctx.sessions);
+    free(workers);
+    return started ? 0 : 1;
+}
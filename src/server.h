@@ -0,0 +1,7 @@
+#ifndef GOLDENPAWN_SERVER_H
+#define GOLDENPAWN_SERVER_H
+
+// goldenpawn server --socket <path> [--workers N] [--hash MB]
+int server_main(int argc, char** argv);
+
+#endif
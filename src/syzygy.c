@@ -0,0 +1,1158 @@
+#include "syzygy.h"
+#include "logger.h"
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Syzygy tables are indexed with squares a1 = 0 ... h8 = 63 and pieces coded as
+// P = 1, N = 2, B = 3, R = 4, Q = 5, K = 6, with 8 added for black pieces.
+// The encoding follows the reference probing code by Ronald de Man.
+
+#define SYZYGY_FLAG_STM 1
+#define SYZYGY_FLAG_MAPPED 2
+#define SYZYGY_FLAG_WIN_PLIES 4
+#define SYZYGY_FLAG_LOSS_PLIES 8
+#define SYZYGY_FLAG_WIDE 16
+#define SYZYGY_FLAG_SINGLE_VALUE 128
+
+typedef enum {
+    SYZYGY_TABLE_WDL = 0,
+    SYZYGY_TABLE_DTZ = 1
+} Syzygy_Table_Type;
+
+typedef enum {
+    SYZYGY_PROBE_FAIL = 0,
+    SYZYGY_PROBE_OK = 1,
+    SYZYGY_PROBE_CHANGE_STM = -1,
+    SYZYGY_PROBE_ZEROING_BEST_MOVE = 2
+} Syzygy_Probe_State;
+
+typedef struct {
+    uint8_t flags;
+    uint8_t pieces[SYZYGY_MAX_PIECES];
+    uint8_t group_len[SYZYGY_MAX_PIECES + 1];
+    uint64_t group_idx[SYZYGY_MAX_PIECES + 1];
+    uint64_t sizeof_block;
+    uint64_t span;
+    uint64_t sparse_index_size;
+    uint64_t block_length_size;
+    uint32_t num_blocks;
+    int max_sym_len;
+    int min_sym_len;
+    const uint8_t* lowest_sym;
+    const uint8_t* btree;
+    const uint8_t* sparse_index;
+    const uint8_t* block_length;
+    const uint8_t* data;
+    uint64_t* base64;
+    uint8_t* symlen;
+    int symlen_size;
+    uint16_t map_idx[4];
+} Syzygy_Pairs;
+
+typedef struct {
+    // 0 = not loaded yet, 1 = loaded, -1 = missing or corrupted
+    int state;
+    void* mapping;
+    size_t mapping_size;
+    const uint8_t* map;
+    Syzygy_Pairs items[2][4];
+} Syzygy_Table;
+
+struct Syzygy_Entry {
+    // key is the material signature when white owns the left side of the file name, key2 when black does.
+    uint64_t key;
+    uint64_t key2;
+    char name[SYZYGY_MAX_PIECES + 2];
+    int piece_count;
+    int has_pawns;
+    int has_unique_pieces;
+    int pawn_count[2];
+    Syzygy_Table tables[2];
+};
+
+static int map_b1h1h7[64];
+static int map_a1d1d4[64];
+static int map_kk[10][64];
+static uint64_t binomial[6][64];
+static int map_pawns[64];
+static int lead_pawn_idx[6][64];
+static int lead_pawns_size[6][4];
+static pthread_once_t encoding_tables_once = PTHREAD_ONCE_INIT;
+
+static const char piece_chars[] = " PNBRQK";
+
+static int square_rank(int square) { return square >> 3; }
+static int square_file(int square) { return square & 7; }
+static int off_a1h8(int square) { return square_rank(square) - square_file(square); }
+
+static int pop_lsb(Chess_Bitboard* bitboard) {
+    int square = __builtin_ctzll(*bitboard);
+    *bitboard &= *bitboard - 1;
+    return square;
+}
+
+static uint16_t read_le16(const uint8_t* data) {
+    return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint32_t read_le32(const uint8_t* data) {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint32_t read_be32(const uint8_t* data) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static uint64_t read_be64(const uint8_t* data) {
+    return ((uint64_t)read_be32(data) << 32) | read_be32(data + 4);
+}
+
+static int btree_left(const Syzygy_Pairs* d, int sym) {
+    const uint8_t* lr = d->btree + 3 * sym;
+    return ((lr[1] & 0xF) << 8) | lr[0];
+}
+
+static int btree_right(const Syzygy_Pairs* d, int sym) {
+    const uint8_t* lr = d->btree + 3 * sym;
+    return (lr[2] << 4) | (lr[1] >> 4);
+}
+
+static void encoding_tables_init() {
+    int code = 0;
+
+    // map_b1h1h7 encodes a square below the a1-h8 diagonal to 0..27
+    for (int s = 0; s < 64; ++s) {
+        if (off_a1h8(s) < 0) {
+            map_b1h1h7[s] = code++;
+        }
+    }
+
+    // map_a1d1d4 encodes a square in the a1-d1-d4 triangle to 0..9, diagonal squares last
+    int diagonal[4];
+    int diagonal_num = 0;
+    code = 0;
+    for (int s = 0; s <= 27; ++s) {
+        if (off_a1h8(s) < 0 && square_file(s) <= 3) {
+            map_a1d1d4[s] = code++;
+        } else if (!off_a1h8(s) && square_file(s) <= 3) {
+            diagonal[diagonal_num++] = s;
+        }
+    }
+    for (int i = 0; i < diagonal_num; ++i) {
+        map_a1d1d4[diagonal[i]] = code++;
+    }
+
+    // map_kk encodes the 462 legal placements of two kings with the first one in the a1-d1-d4 triangle
+    int both_on_diagonal[64 * 10][2];
+    int both_on_diagonal_num = 0;
+    code = 0;
+    for (int idx = 0; idx < 10; ++idx) {
+        for (int s1 = 0; s1 <= 27; ++s1) {
+            if (square_file(s1) > 3 || off_a1h8(s1) > 0 || map_a1d1d4[s1] != idx || (!idx && s1 != 1)) {
+                continue;
+            }
+            for (int s2 = 0; s2 < 64; ++s2) {
+                if (abs(square_rank(s1) - square_rank(s2)) <= 1 && abs(square_file(s1) - square_file(s2)) <= 1) {
+                    continue;
+                } else if (!off_a1h8(s1) && off_a1h8(s2) > 0) {
+                    continue;
+                } else if (!off_a1h8(s1) && !off_a1h8(s2)) {
+                    both_on_diagonal[both_on_diagonal_num][0] = idx;
+                    both_on_diagonal[both_on_diagonal_num][1] = s2;
+                    both_on_diagonal_num++;
+                } else {
+                    map_kk[idx][s2] = code++;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < both_on_diagonal_num; ++i) {
+        map_kk[both_on_diagonal[i][0]][both_on_diagonal[i][1]] = code++;
+    }
+
+    binomial[0][0] = 1;
+    for (int n = 1; n < 64; ++n) {
+        for (int k = 0; k < 6 && k <= n; ++k) {
+            binomial[k][n] = (k > 0 ? binomial[k - 1][n - 1] : 0) + (k < n ? binomial[k][n - 1] : 0);
+        }
+    }
+
+    // map_pawns encodes a2-h7 to 0..47, the pawn with the highest value being the leading one.
+    int available_squares = 47;
+    for (int lead_pawns_num = 1; lead_pawns_num <= 5; ++lead_pawns_num) {
+        for (int f = 0; f <= 3; ++f) {
+            int idx = 0;
+            for (int r = 1; r <= 6; ++r) {
+                int s = r * 8 + f;
+                if (lead_pawns_num == 1) {
+                    map_pawns[s] = available_squares--;
+                    map_pawns[s ^ 7] = available_squares--;
+                }
+                lead_pawn_idx[lead_pawns_num][s] = idx;
+                idx += binomial[lead_pawns_num - 1][map_pawns[s]];
+            }
+            lead_pawns_size[lead_pawns_num][f] = idx;
+        }
+    }
+}
+
+static int piece_code(Chess_Packed_Piece piece) {
+    int code;
+    switch (CHESS_PIECE_TYPE(piece)) {
+        case CHESS_PIECE_PAWN: code = 1; break;
+        case CHESS_PIECE_KNIGHT: code = 2; break;
+        case CHESS_PIECE_BISHOP: code = 3; break;
+        case CHESS_PIECE_ROOK: code = 4; break;
+        case CHESS_PIECE_QUEEN: code = 5; break;
+        case CHESS_PIECE_KING: code = 6; break;
+        default: return 0;
+    }
+    return CHESS_PIECE_COLOR(piece) == CHESS_COLOR_BLACK ? code + 8 : code;
+}
+
+// Material signatures pack the count of each non-king piece in a nibble: 20 bits per side, white in the low bits.
+static uint64_t side_signature_get(const Chess_Context* chess_ctx, Chess_Color color) {
+    static const Chess_Piece_Type types[] = { CHESS_PIECE_PAWN, CHESS_PIECE_KNIGHT, CHESS_PIECE_BISHOP, CHESS_PIECE_ROOK, CHESS_PIECE_QUEEN };
+    uint64_t signature = 0;
+    for (int i = 0; i < 5; ++i) {
+        signature |= (uint64_t)__builtin_popcountll(chess_pieces_get(chess_ctx, color, types[i])) << (4 * i);
+    }
+    return signature;
+}
+
+static int side_signature_piece_count(uint64_t signature, int code) {
+    return (signature >> (4 * (code - 1))) & 0xF;
+}
+
+static void table_name_build(uint64_t left, uint64_t right, char* name) {
+    *name++ = 'K';
+    for (int code = 5; code >= 1; --code) {
+        for (int i = 0; i < side_signature_piece_count(left, code); ++i) *name++ = piece_chars[code];
+    }
+    *name++ = 'v';
+    *name++ = 'K';
+    for (int code = 5; code >= 1; --code) {
+        for (int i = 0; i < side_signature_piece_count(right, code); ++i) *name++ = piece_chars[code];
+    }
+    *name = '\0';
+}
+
+static int table_file_path_get(const Syzygy_Context* syzygy_ctx, const char* name, const char* extension, char* out, int out_size) {
+    const char* dir = syzygy_ctx->path;
+    while (*dir) {
+        const char* end = strchr(dir, ':');
+        int dir_len = end ? (int)(end - dir) : (int)strlen(dir);
+        if (dir_len > 0) {
+            snprintf(out, out_size, "%.*s/%s%s", dir_len, dir, name, extension);
+            if (access(out, R_OK) == 0) {
+                return 1;
+            }
+        }
+        dir += dir_len;
+        if (*dir == ':') ++dir;
+    }
+    return 0;
+}
+
+static void set_groups(const struct Syzygy_Entry* entry, Syzygy_Pairs* d, const int order[2], int file) {
+    int n = 0;
+    int first_len = entry->has_pawns ? 0 : entry->has_unique_pieces ? 3 : 2;
+    d->group_len[n] = 1;
+
+    // The piece sequence defines the groups: leading group first, then same-kind pieces grouped together.
+    for (int i = 1; i < entry->piece_count; ++i) {
+        if (--first_len > 0 || d->pieces[i] == d->pieces[i - 1]) {
+            d->group_len[n]++;
+        } else {
+            d->group_len[++n] = 1;
+        }
+    }
+    d->group_len[++n] = 0;
+
+    int pp = entry->has_pawns && entry->pawn_count[1];
+    int next = pp ? 2 : 1;
+    int free_squares = 64 - d->group_len[0] - (pp ? d->group_len[1] : 0);
+    uint64_t idx = 1;
+
+    for (int k = 0; next < n || k == order[0] || k == order[1]; ++k) {
+        if (k == order[0]) {
+            d->group_idx[0] = idx;
+            idx *= entry->has_pawns ? (uint64_t)lead_pawns_size[d->group_len[0]][file] : entry->has_unique_pieces ? 31332 : 462;
+        } else if (k == order[1]) {
+            d->group_idx[1] = idx;
+            idx *= binomial[d->group_len[1]][48 - d->group_len[0]];
+        } else {
+            d->group_idx[next] = idx;
+            idx *= binomial[d->group_len[next]][free_squares];
+            free_squares -= d->group_len[next++];
+        }
+    }
+    d->group_idx[n] = idx;
+}
+
+static int set_symlen(Syzygy_Pairs* d, int sym, uint8_t* visited) {
+    visited[sym] = 1;
+    int right = btree_right(d, sym);
+    if (right == 0xFFF) {
+        return 0;
+    }
+    int left = btree_left(d, sym);
+    if (!visited[left]) d->symlen[left] = set_symlen(d, left, visited);
+    if (!visited[right]) d->symlen[right] = set_symlen(d, right, visited);
+    return d->symlen[left] + d->symlen[right] + 1;
+}
+
+static const uint8_t* set_sizes(Syzygy_Pairs* d, const uint8_t* data) {
+    d->flags = *data++;
+
+    if (d->flags & SYZYGY_FLAG_SINGLE_VALUE) {
+        d->num_blocks = 0;
+        d->span = 0;
+        d->block_length_size = 0;
+        d->sparse_index_size = 0;
+        // The single value is stored in min_sym_len.
+        d->min_sym_len = *data++;
+        return data;
+    }
+
+    int last_group = 0;
+    while (d->group_len[last_group]) ++last_group;
+    uint64_t tb_size = d->group_idx[last_group];
+
+    d->sizeof_block = 1ULL << *data++;
+    d->span = 1ULL << *data++;
+    d->sparse_index_size = (tb_size + d->span - 1) / d->span;
+    int padding = *data++;
+    d->num_blocks = read_le32(data);
+    data += 4;
+    d->block_length_size = d->num_blocks + padding;
+    d->max_sym_len = *data++;
+    d->min_sym_len = *data++;
+    d->lowest_sym = data;
+
+    // Canonical Huffman: longer codes have lower values, base64[i] is the lowest code of length i + min_sym_len left-aligned to 64 bits.
+    int base64_size = d->max_sym_len - d->min_sym_len + 1;
+    d->base64 = calloc(base64_size, sizeof(uint64_t));
+    for (int i = base64_size - 2; i >= 0; --i) {
+        d->base64[i] = (d->base64[i + 1] + read_le16(d->lowest_sym + 2 * i) - read_le16(d->lowest_sym + 2 * (i + 1))) / 2;
+    }
+    for (int i = 0; i < base64_size; ++i) {
+        d->base64[i] <<= 64 - i - d->min_sym_len;
+    }
+    data += base64_size * 2;
+
+    // Symbols are built by recursive pairing; symlen[s] is the number of original symbols in s minus one.
+    d->symlen_size = read_le16(data);
+    data += 2;
+    d->btree = data;
+    d->symlen = calloc(d->symlen_size, sizeof(uint8_t));
+    uint8_t* visited = calloc(d->symlen_size, sizeof(uint8_t));
+    for (int sym = 0; sym < d->symlen_size; ++sym) {
+        if (!visited[sym]) {
+            d->symlen[sym] = set_symlen(d, sym, visited);
+        }
+    }
+    free(visited);
+
+    return data + d->symlen_size * 3 + (d->symlen_size & 1);
+}
+
+static const uint8_t* set_dtz_map(Syzygy_Table* table, const uint8_t* data, int max_file) {
+    table->map = data;
+
+    for (int f = 0; f <= max_file; ++f) {
+        Syzygy_Pairs* d = &table->items[0][f];
+        if (d->flags & SYZYGY_FLAG_MAPPED) {
+            if (d->flags & SYZYGY_FLAG_WIDE) {
+                data += (uintptr_t)data & 1;
+                for (int i = 0; i < 4; ++i) {
+                    d->map_idx[i] = (uint16_t)((data - table->map) / 2 + 1);
+                    data += 2 * read_le16(data) + 2;
+                }
+            } else {
+                for (int i = 0; i < 4; ++i) {
+                    d->map_idx[i] = (uint16_t)(data - table->map + 1);
+                    data += *data + 1;
+                }
+            }
+        }
+    }
+
+    return data + ((uintptr_t)data & 1);
+}
+
+static void table_setup(struct Syzygy_Entry* entry, Syzygy_Table_Type type, const uint8_t* data) {
+    Syzygy_Table* table = &entry->tables[type];
+    int sides = type == SYZYGY_TABLE_WDL && entry->key != entry->key2 ? 2 : 1;
+    int max_file = entry->has_pawns ? 3 : 0;
+    int pp = entry->has_pawns && entry->pawn_count[1];
+
+    // First byte stores the flags.
+    data++;
+
+    for (int f = 0; f <= max_file; ++f) {
+        int order[2][2] = {
+            { *data & 0xF, pp ? data[1] & 0xF : 0xF },
+            { *data >> 4, pp ? data[1] >> 4 : 0xF }
+        };
+        data += 1 + pp;
+
+        for (int k = 0; k < entry->piece_count; ++k, ++data) {
+            for (int i = 0; i < sides; ++i) {
+                table->items[i][f].pieces[k] = i ? *data >> 4 : *data & 0xF;
+            }
+        }
+
+        for (int i = 0; i < sides; ++i) {
+            set_groups(entry, &table->items[i][f], order[i], f);
+        }
+    }
+
+    data += (uintptr_t)data & 1;
+
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            data = set_sizes(&table->items[i][f], data);
+        }
+    }
+
+    if (type == SYZYGY_TABLE_DTZ) {
+        data = set_dtz_map(table, data, max_file);
+    }
+
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            Syzygy_Pairs* d = &table->items[i][f];
+            d->sparse_index = data;
+            data += d->sparse_index_size * 6;
+        }
+    }
+
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            Syzygy_Pairs* d = &table->items[i][f];
+            d->block_length = data;
+            data += d->block_length_size * 2;
+        }
+    }
+
+    for (int f = 0; f <= max_file; ++f) {
+        for (int i = 0; i < sides; ++i) {
+            Syzygy_Pairs* d = &table->items[i][f];
+            data = (const uint8_t*)(((uintptr_t)data + 0x3F) & ~(uintptr_t)0x3F);
+            d->data = data;
+            data += (uint64_t)d->num_blocks * d->sizeof_block;
+        }
+    }
+}
+
+static void table_release(Syzygy_Table* table) {
+    if (table->state == 1) {
+        for (int i = 0; i < 2; ++i) {
+            for (int f = 0; f < 4; ++f) {
+                free(table->items[i][f].base64);
+                free(table->items[i][f].symlen);
+            }
+        }
+        munmap(table->mapping, table->mapping_size);
+    }
+    memset(table, 0, sizeof(Syzygy_Table));
+}
+
+// Maps the table file on first use. Must be called with the context mutex held.
+static int table_load(Syzygy_Context* syzygy_ctx, struct Syzygy_Entry* entry, Syzygy_Table_Type type) {
+    static const uint8_t magics[2][4] = { { 0x71, 0xE8, 0x23, 0x5D }, { 0xD7, 0x66, 0x0C, 0xA5 } };
+    Syzygy_Table* table = &entry->tables[type];
+
+    if (table->state) {
+        return table->state == 1;
+    }
+    table->state = -1;
+
+    char file_path[SYZYGY_PATH_SIZE + 32];
+    if (!table_file_path_get(syzygy_ctx, entry->name, type == SYZYGY_TABLE_WDL ? ".rtbw" : ".rtbz", file_path, sizeof(file_path))) {
+        return 0;
+    }
+
+    int fd = open(file_path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) || file_stat.st_size < 16 || file_stat.st_size % 64 != 16) {
+        log_debug("corrupted tablebase file %s", file_path);
+        close(fd);
+        return 0;
+    }
+
+    void* mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return 0;
+    }
+    madvise(mapping, file_stat.st_size, MADV_RANDOM);
+
+    const uint8_t* data = mapping;
+    if (memcmp(data, magics[type], 4) || ((data[4] & 2) != 0) != (entry->has_pawns != 0)) {
+        log_debug("corrupted tablebase file %s", file_path);
+        munmap(mapping, file_stat.st_size);
+        return 0;
+    }
+
+    table->mapping = mapping;
+    table->mapping_size = file_stat.st_size;
+    table_setup(entry, type, data + 4);
+    table->state = 1;
+    return 1;
+}
+
+static struct Syzygy_Entry* entry_create(Syzygy_Context* syzygy_ctx, uint64_t key) {
+    struct Syzygy_Entry* entry = calloc(1, sizeof(struct Syzygy_Entry));
+    char name[SYZYGY_MAX_PIECES + 2];
+    char file_path[SYZYGY_PATH_SIZE + 32];
+
+    // Files are named with the stronger side first, so try white first and fall back to black first.
+    uint64_t left = key & 0xFFFFF, right = key >> 20;
+    table_name_build(left, right, name);
+    if (!table_file_path_get(syzygy_ctx, name, ".rtbw", file_path, sizeof(file_path))) {
+        uint64_t tmp = left;
+        left = right;
+        right = tmp;
+        table_name_build(left, right, name);
+    }
+
+    strcpy(entry->name, name);
+    entry->key = left | (right << 20);
+    entry->key2 = right | (left << 20);
+    entry->piece_count = 2;
+
+    int left_pawns = side_signature_piece_count(left, 1);
+    int right_pawns = side_signature_piece_count(right, 1);
+    for (int code = 1; code <= 5; ++code) {
+        int left_count = side_signature_piece_count(left, code);
+        int right_count = side_signature_piece_count(right, code);
+        entry->piece_count += left_count + right_count;
+        if (left_count == 1 || right_count == 1) {
+            entry->has_unique_pieces = 1;
+        }
+    }
+    entry->has_pawns = left_pawns + right_pawns > 0;
+
+    // The leading color is the one with fewer pawns, when both sides have them.
+    int left_leads = !right_pawns || (left_pawns && right_pawns >= left_pawns);
+    entry->pawn_count[0] = left_leads ? left_pawns : right_pawns;
+    entry->pawn_count[1] = left_leads ? right_pawns : left_pawns;
+
+    return entry;
+}
+
+static int entry_slot_find(const Syzygy_Context* syzygy_ctx, uint64_t key) {
+    int slot = (int)((key * 0x9E3779B97F4A7C15ULL) >> 52) & (SYZYGY_TABLE_SLOTS - 1);
+    for (int i = 0; i < SYZYGY_TABLE_SLOTS; ++i) {
+        const struct Syzygy_Entry* entry = syzygy_ctx->entries[slot];
+        if (!entry || entry->key == key || entry->key2 == key) {
+            return slot;
+        }
+        slot = (slot + 1) & (SYZYGY_TABLE_SLOTS - 1);
+    }
+    return -1;
+}
+
+static struct Syzygy_Entry* entry_get(Syzygy_Context* syzygy_ctx, uint64_t key, Syzygy_Table_Type type) {
+    pthread_mutex_lock(&syzygy_ctx->mutex);
+
+    struct Syzygy_Entry* entry = NULL;
+    int slot = entry_slot_find(syzygy_ctx, key);
+    if (slot != -1) {
+        entry = syzygy_ctx->entries[slot];
+        if (!entry) {
+            entry = entry_create(syzygy_ctx, key);
+            syzygy_ctx->entries[slot] = entry;
+        }
+        if (!table_load(syzygy_ctx, entry, type)) {
+            entry = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&syzygy_ctx->mutex);
+    return entry;
+}
+
+static int decompress_pairs(const Syzygy_Pairs* d, uint64_t idx) {
+    if (d->flags & SYZYGY_FLAG_SINGLE_VALUE) {
+        return d->min_sym_len;
+    }
+
+    uint32_t k = (uint32_t)(idx / d->span);
+    uint32_t block = read_le32(d->sparse_index + 6 * k);
+    int offset = read_le16(d->sparse_index + 6 * k + 4);
+    offset += (int)(idx % d->span) - (int)(d->span / 2);
+
+    while (offset < 0) {
+        offset += read_le16(d->block_length + 2 * (--block)) + 1;
+    }
+    while (offset > read_le16(d->block_length + 2 * block)) {
+        offset -= read_le16(d->block_length + 2 * (block++)) + 1;
+    }
+
+    const uint8_t* ptr = d->data + (uint64_t)block * d->sizeof_block;
+    uint64_t buf64 = read_be64(ptr);
+    ptr += 8;
+    int buf64_size = 64;
+    int sym;
+
+    for (;;) {
+        int len = 0;
+        while (buf64 < d->base64[len]) {
+            ++len;
+        }
+        sym = (int)((buf64 - d->base64[len]) >> (64 - len - d->min_sym_len));
+        sym += read_le16(d->lowest_sym + 2 * len);
+
+        if (offset < d->symlen[sym] + 1) {
+            break;
+        }
+        offset -= d->symlen[sym] + 1;
+        len += d->min_sym_len;
+        buf64 <<= len;
+        buf64_size -= len;
+
+        if (buf64_size <= 32) {
+            buf64_size += 32;
+            buf64 |= (uint64_t)read_be32(ptr) << (64 - buf64_size);
+            ptr += 4;
+        }
+    }
+
+    // Expand the pair symbol until we reach the original symbol holding our offset.
+    while (d->symlen[sym]) {
+        int left = btree_left(d, sym);
+        if (offset < d->symlen[left] + 1) {
+            sym = left;
+        } else {
+            offset -= d->symlen[left] + 1;
+            sym = btree_right(d, sym);
+        }
+    }
+
+    return btree_left(d, sym);
+}
+
+static int map_score(const Syzygy_Table* table, Syzygy_Table_Type type, int file, int value, Syzygy_WDL wdl) {
+    static const int wdl_map[] = { 1, 3, 0, 2, 0 };
+
+    if (type == SYZYGY_TABLE_WDL) {
+        return value - 2;
+    }
+
+    const Syzygy_Pairs* d = &table->items[0][file];
+    if (d->flags & SYZYGY_FLAG_MAPPED) {
+        int idx = d->map_idx[wdl_map[wdl + 2]] + value;
+        value = (d->flags & SYZYGY_FLAG_WIDE) ? read_le16(table->map + 2 * idx) : table->map[idx];
+    }
+
+    // DTZ is stored in moves or plies; we always return plies.
+    if ((wdl == SYZYGY_WDL_WIN && !(d->flags & SYZYGY_FLAG_WIN_PLIES)) ||
+        (wdl == SYZYGY_WDL_LOSS && !(d->flags & SYZYGY_FLAG_LOSS_PLIES)) ||
+        wdl == SYZYGY_WDL_CURSED_WIN || wdl == SYZYGY_WDL_BLESSED_LOSS) {
+        value *= 2;
+    }
+
+    return value + 1;
+}
+
+static int pawns_compare(int a, int b) {
+    return map_pawns[a] < map_pawns[b];
+}
+
+static void sort_by_map_pawns(int* squares, int num) {
+    // Stable insertion sort, ascending by map_pawns.
+    for (int i = 1; i < num; ++i) {
+        int s = squares[i];
+        int j = i - 1;
+        while (j >= 0 && pawns_compare(s, squares[j])) {
+            squares[j + 1] = squares[j];
+            --j;
+        }
+        squares[j + 1] = s;
+    }
+}
+
+static void sort_ascending(int* squares, int num) {
+    for (int i = 1; i < num; ++i) {
+        int s = squares[i];
+        int j = i - 1;
+        while (j >= 0 && s < squares[j]) {
+            squares[j + 1] = squares[j];
+            --j;
+        }
+        squares[j + 1] = s;
+    }
+}
+
+static int probe_table(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, Syzygy_Table_Type type,
+    Syzygy_WDL wdl, Syzygy_Probe_State* result) {
+    Chess_Bitboard all_pieces = chess_color_pieces_get(chess_ctx, CHESS_COLOR_WHITE) | chess_color_pieces_get(chess_ctx, CHESS_COLOR_BLACK);
+
+    // KvK
+    if (__builtin_popcountll(all_pieces) == 2) {
+        return SYZYGY_WDL_DRAW;
+    }
+
+    uint64_t key = side_signature_get(chess_ctx, CHESS_COLOR_WHITE) | (side_signature_get(chess_ctx, CHESS_COLOR_BLACK) << 20);
+    struct Syzygy_Entry* entry = entry_get(syzygy_ctx, key, type);
+    if (!entry) {
+        *result = SYZYGY_PROBE_FAIL;
+        return 0;
+    }
+    const Syzygy_Table* table = &entry->tables[type];
+
+    int squares[SYZYGY_MAX_PIECES];
+    int pieces[SYZYGY_MAX_PIECES];
+    int size = 0, lead_pawns_num = 0, tb_file = 0;
+    Chess_Bitboard b, lead_pawns = 0;
+    int black_to_move = chess_ctx->current_turn == CHESS_COLOR_BLACK;
+
+    // Tables are stored with white as the stronger side and, when symmetric, only with white to move.
+    int symmetric_black_to_move = entry->key == entry->key2 && black_to_move;
+    int black_stronger = key != entry->key;
+    int flip = symmetric_black_to_move || black_stronger;
+    int flip_color = flip * 8;
+    int flip_squares = flip * 56;
+    int stm = flip ^ black_to_move;
+
+    if (entry->has_pawns) {
+        int lead_code = table->items[0][0].pieces[0] ^ flip_color;
+        b = lead_pawns = chess_pieces_get(chess_ctx, (lead_code & 8) ? CHESS_COLOR_BLACK : CHESS_COLOR_WHITE, CHESS_PIECE_PAWN);
+        do {
+            squares[size++] = pop_lsb(&b) ^ flip_squares;
+        } while (b);
+        lead_pawns_num = size;
+
+        int lead = 0;
+        for (int i = 1; i < lead_pawns_num; ++i) {
+            if (pawns_compare(squares[lead], squares[i])) lead = i;
+        }
+        int tmp = squares[0];
+        squares[0] = squares[lead];
+        squares[lead] = tmp;
+
+        tb_file = square_file(squares[0]);
+        if (tb_file > 3) tb_file = 7 - tb_file;
+    }
+
+    // DTZ tables store only one side to move.
+    if (type == SYZYGY_TABLE_DTZ) {
+        int flags = table->items[0][tb_file].flags;
+        if ((flags & SYZYGY_FLAG_STM) != stm && !(entry->key == entry->key2 && !entry->has_pawns)) {
+            *result = SYZYGY_PROBE_CHANGE_STM;
+            return 0;
+        }
+    }
+
+    b = all_pieces ^ lead_pawns;
+    do {
+        int s = pop_lsb(&b);
+        squares[size] = s ^ flip_squares;
+        pieces[size++] = piece_code(chess_ctx->board[s]) ^ flip_color;
+    } while (b);
+
+    const Syzygy_Pairs* d = &table->items[type == SYZYGY_TABLE_WDL ? stm : 0][tb_file];
+
+    // Reorder the pieces to match the sequence stored in the table.
+    for (int i = lead_pawns_num; i < size - 1; ++i) {
+        for (int j = i + 1; j < size; ++j) {
+            if (d->pieces[i] == pieces[j]) {
+                int tmp = pieces[i]; pieces[i] = pieces[j]; pieces[j] = tmp;
+                tmp = squares[i]; squares[i] = squares[j]; squares[j] = tmp;
+                break;
+            }
+        }
+    }
+
+    // The leading piece must be in the a1-d1-d4 triangle (or on files a-d with pawns).
+    if (square_file(squares[0]) > 3) {
+        for (int i = 0; i < size; ++i) squares[i] ^= 7;
+    }
+
+    uint64_t idx;
+    if (entry->has_pawns) {
+        idx = lead_pawn_idx[lead_pawns_num][squares[0]];
+        sort_by_map_pawns(squares + 1, lead_pawns_num - 1);
+        for (int i = 1; i < lead_pawns_num; ++i) {
+            idx += binomial[i][map_pawns[squares[i]]];
+        }
+    } else {
+        if (square_rank(squares[0]) > 3) {
+            for (int i = 0; i < size; ++i) squares[i] ^= 56;
+        }
+
+        // The first piece of the leading group off the a1-h8 diagonal must be below it.
+        for (int i = 0; i < d->group_len[0]; ++i) {
+            if (!off_a1h8(squares[i])) {
+                continue;
+            }
+            if (off_a1h8(squares[i]) > 0) {
+                for (int j = i; j < size; ++j) {
+                    squares[j] = ((squares[j] >> 3) | (squares[j] << 3)) & 63;
+                }
+            }
+            break;
+        }
+
+        if (entry->has_unique_pieces) {
+            int adjust1 = squares[1] > squares[0];
+            int adjust2 = (squares[2] > squares[0]) + (squares[2] > squares[1]);
+
+            if (off_a1h8(squares[0])) {
+                idx = ((uint64_t)map_a1d1d4[squares[0]] * 63 + (squares[1] - adjust1)) * 62 + squares[2] - adjust2;
+            } else if (off_a1h8(squares[1])) {
+                idx = ((uint64_t)6 * 63 + square_rank(squares[0]) * 28 + map_b1h1h7[squares[1]]) * 62 + squares[2] - adjust2;
+            } else if (off_a1h8(squares[2])) {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + square_rank(squares[0]) * 7 * 28 +
+                    (square_rank(squares[1]) - adjust1) * 28 + map_b1h1h7[squares[2]];
+            } else {
+                idx = 6 * 63 * 62 + 4 * 28 * 62 + 4 * 7 * 28 + square_rank(squares[0]) * 7 * 6 +
+                    (square_rank(squares[1]) - adjust1) * 6 + (square_rank(squares[2]) - adjust2);
+            }
+        } else {
+            idx = map_kk[map_a1d1d4[squares[0]]][squares[1]];
+        }
+    }
+
+    // Encode the remaining groups, each as a combination of free squares.
+    idx *= d->group_idx[0];
+    int* group_squares = squares + d->group_len[0];
+    int remaining_pawns = entry->has_pawns && entry->pawn_count[1];
+    int next = 0;
+
+    while (d->group_len[++next]) {
+        sort_ascending(group_squares, d->group_len[next]);
+        uint64_t n = 0;
+        for (int i = 0; i < d->group_len[next]; ++i) {
+            int adjust = 0;
+            for (int* s = squares; s < group_squares; ++s) {
+                adjust += group_squares[i] > *s;
+            }
+            n += binomial[i + 1][group_squares[i] - adjust - 8 * remaining_pawns];
+        }
+        remaining_pawns = 0;
+        idx += n * d->group_idx[next];
+        group_squares += d->group_len[next];
+    }
+
+    return map_score(table, type, tb_file, decompress_pairs(d, idx), wdl);
+}
+
+static int move_is_zeroing(const Chess_Context* chess_ctx, Chess_Packed_Move move) {
+    int from = CHESS_MOVE_FROM(move);
+    return CHESS_MOVE_IS_CAPTURE(move) || CHESS_PIECE_TYPE(chess_ctx->board[from]) == CHESS_PIECE_PAWN;
+}
+
+static int has_legal_moves(const Chess_Context* chess_ctx) {
+    Chess_Move_List move_list;
+    chess_generate_moves(chess_ctx, &move_list);
+    return move_list.count > 0;
+}
+
+static int is_in_check(const Chess_Context* chess_ctx) {
+    return chess_is_king_under_attack(chess_ctx, chess_ctx->current_turn);
+}
+
+// Resolves captures (and pawn moves when check_zeroing_moves is set) before probing, because tables
+// store "don't care" values for positions where the best move is a capture.
+static Syzygy_WDL search(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, int check_zeroing_moves, Syzygy_Probe_State* result) {
+    Chess_Move_List move_list;
+    Chess_Context child_ctx;
+    Syzygy_WDL value, best_value = SYZYGY_WDL_LOSS;
+    int searched_num = 0;
+
+    chess_generate_moves(chess_ctx, &move_list);
+
+    for (int i = 0; i < move_list.count; ++i) {
+        Chess_Packed_Move move = move_list.moves[i];
+        if (!CHESS_MOVE_IS_CAPTURE(move) && (!check_zeroing_moves || !move_is_zeroing(chess_ctx, move))) {
+            continue;
+        }
+
+        searched_num++;
+        chess_make_move(chess_ctx, &child_ctx, move);
+        value = -search(syzygy_ctx, &child_ctx, 0, result);
+
+        if (*result == SYZYGY_PROBE_FAIL) {
+            return SYZYGY_WDL_DRAW;
+        }
+
+        if (value > best_value) {
+            best_value = value;
+            if (value >= SYZYGY_WDL_WIN) {
+                *result = SYZYGY_PROBE_ZEROING_BEST_MOVE;
+                return value;
+            }
+        }
+    }
+
+    // If every legal move was searched the stored value could be wrong (e.g. en passant rights), so trust the search.
+    int no_more_moves = searched_num && searched_num == move_list.count;
+    if (no_more_moves) {
+        value = best_value;
+    } else {
+        value = probe_table(syzygy_ctx, chess_ctx, SYZYGY_TABLE_WDL, SYZYGY_WDL_DRAW, result);
+        if (*result == SYZYGY_PROBE_FAIL) {
+            return SYZYGY_WDL_DRAW;
+        }
+    }
+
+    if (best_value >= value) {
+        *result = (best_value > SYZYGY_WDL_DRAW || no_more_moves) ? SYZYGY_PROBE_ZEROING_BEST_MOVE : SYZYGY_PROBE_OK;
+        return best_value;
+    }
+
+    *result = SYZYGY_PROBE_OK;
+    return value;
+}
+
+static int dtz_before_zeroing(Syzygy_WDL wdl) {
+    switch (wdl) {
+        case SYZYGY_WDL_WIN: return 1;
+        case SYZYGY_WDL_CURSED_WIN: return 101;
+        case SYZYGY_WDL_BLESSED_LOSS: return -101;
+        case SYZYGY_WDL_LOSS: return -1;
+        default: return 0;
+    }
+}
+
+static int sign_of(int value) {
+    return (value > 0) - (value < 0);
+}
+
+static int probe_dtz(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, Syzygy_Probe_State* result) {
+    *result = SYZYGY_PROBE_OK;
+    Syzygy_WDL wdl = search(syzygy_ctx, chess_ctx, 1, result);
+
+    // DTZ tables don't store draws.
+    if (*result == SYZYGY_PROBE_FAIL || wdl == SYZYGY_WDL_DRAW) {
+        return 0;
+    }
+
+    if (*result == SYZYGY_PROBE_ZEROING_BEST_MOVE) {
+        return dtz_before_zeroing(wdl);
+    }
+
+    int dtz = probe_table(syzygy_ctx, chess_ctx, SYZYGY_TABLE_DTZ, wdl, result);
+    if (*result == SYZYGY_PROBE_FAIL) {
+        return 0;
+    }
+
+    if (*result != SYZYGY_PROBE_CHANGE_STM) {
+        return (dtz + 100 * (wdl == SYZYGY_WDL_BLESSED_LOSS || wdl == SYZYGY_WDL_CURSED_WIN)) * sign_of(wdl);
+    }
+
+    // The table stores the other side to move: do a 1-ply search and pick the best DTZ.
+    Chess_Move_List move_list;
+    Chess_Context child_ctx;
+    int min_dtz = 0xFFFF;
+
+    chess_generate_moves(chess_ctx, &move_list);
+
+    for (int i = 0; i < move_list.count; ++i) {
+        int zeroing = move_is_zeroing(chess_ctx, move_list.moves[i]);
+        chess_make_move(chess_ctx, &child_ctx, move_list.moves[i]);
+
+        // For zeroing moves we want the DTZ before the move, otherwise the DTZ of the child plus one ply.
+        dtz = zeroing ? -dtz_before_zeroing(search(syzygy_ctx, &child_ctx, 0, result)) : -probe_dtz(syzygy_ctx, &child_ctx, result);
+
+        if (dtz == 1 && is_in_check(&child_ctx) && !has_legal_moves(&child_ctx)) {
+            min_dtz = 1;
+        }
+
+        if (!zeroing) {
+            dtz += sign_of(dtz);
+        }
+
+        if (dtz < min_dtz && sign_of(dtz) == sign_of(wdl)) {
+            min_dtz = dtz;
+        }
+
+        if (*result == SYZYGY_PROBE_FAIL) {
+            return 0;
+        }
+    }
+
+    // No legal moves: the position is mate.
+    return min_dtz == 0xFFFF ? -1 : min_dtz;
+}
+
+void syzygy_init(Syzygy_Context* syzygy_ctx) {
+    pthread_once(&encoding_tables_once, encoding_tables_init);
+    memset(syzygy_ctx, 0, sizeof(Syzygy_Context));
+    pthread_mutex_init(&syzygy_ctx->mutex, NULL);
+    syzygy_ctx->probe_depth = 1;
+    syzygy_ctx->probe_limit = SYZYGY_MAX_PIECES;
+}
+
+static void entries_release(Syzygy_Context* syzygy_ctx) {
+    for (int i = 0; i < SYZYGY_TABLE_SLOTS; ++i) {
+        struct Syzygy_Entry* entry = syzygy_ctx->entries[i];
+        if (entry) {
+            table_release(&entry->tables[SYZYGY_TABLE_WDL]);
+            table_release(&entry->tables[SYZYGY_TABLE_DTZ]);
+            free(entry);
+            syzygy_ctx->entries[i] = NULL;
+        }
+    }
+}
+
+// Tables are only mapped when first probed; here we just scan the directories to know the largest table available.
+void syzygy_path_set(Syzygy_Context* syzygy_ctx, const char* path) {
+    pthread_mutex_lock(&syzygy_ctx->mutex);
+    entries_release(syzygy_ctx);
+    syzygy_ctx->max_pieces = 0;
+    syzygy_ctx->tables_found = 0;
+
+    if (!path || !strcmp(path, "<empty>")) {
+        syzygy_ctx->path[0] = '\0';
+        pthread_mutex_unlock(&syzygy_ctx->mutex);
+        return;
+    }
+
+    snprintf(syzygy_ctx->path, SYZYGY_PATH_SIZE, "%s", path);
+
+    const char* dir = syzygy_ctx->path;
+    while (*dir) {
+        const char* end = strchr(dir, ':');
+        int dir_len = end ? (int)(end - dir) : (int)strlen(dir);
+        char dir_name[SYZYGY_PATH_SIZE];
+        snprintf(dir_name, sizeof(dir_name), "%.*s", dir_len, dir);
+
+        DIR* dir_handle = dir_len > 0 ? opendir(dir_name) : NULL;
+        if (dir_handle) {
+            struct dirent* dir_entry;
+            while ((dir_entry = readdir(dir_handle))) {
+                int name_len = strlen(dir_entry->d_name);
+                if (name_len < 8 || strcmp(dir_entry->d_name + name_len - 5, ".rtbw")) {
+                    continue;
+                }
+                // The piece count is the name length without 'v' and the extension.
+                int pieces = name_len - 6;
+                if (pieces > SYZYGY_MAX_PIECES) {
+                    continue;
+                }
+                if (pieces > syzygy_ctx->max_pieces) {
+                    syzygy_ctx->max_pieces = pieces;
+                }
+                syzygy_ctx->tables_found++;
+            }
+            closedir(dir_handle);
+        }
+
+        dir += dir_len;
+        if (*dir == ':') ++dir;
+    }
+
+    pthread_mutex_unlock(&syzygy_ctx->mutex);
+    log_debug("found %d tablebases with up to %d pieces", syzygy_ctx->tables_found, syzygy_ctx->max_pieces);
+}
+
+void syzygy_release(Syzygy_Context* syzygy_ctx) {
+    entries_release(syzygy_ctx);
+    pthread_mutex_destroy(&syzygy_ctx->mutex);
+}
+
+int syzygy_can_probe(const Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx) {
+    if (!syzygy_ctx || !syzygy_ctx->max_pieces) {
+        return 0;
+    }
+
+    // Tables don't know about castling.
+    if (chess_ctx->castling_rights) {
+        return 0;
+    }
+
+    int limit = syzygy_ctx->probe_limit < syzygy_ctx->max_pieces ? syzygy_ctx->probe_limit : syzygy_ctx->max_pieces;
+    Chess_Bitboard all_pieces = chess_color_pieces_get(chess_ctx, CHESS_COLOR_WHITE) | chess_color_pieces_get(chess_ctx, CHESS_COLOR_BLACK);
+    return __builtin_popcountll(all_pieces) <= limit;
+}
+
+int syzygy_probe_wdl(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, Syzygy_WDL* wdl) {
+    Syzygy_Probe_State result = SYZYGY_PROBE_OK;
+    *wdl = search(syzygy_ctx, chess_ctx, 0, &result);
+    return result != SYZYGY_PROBE_FAIL;
+}
+
+int syzygy_probe_dtz(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, int* dtz) {
+    Syzygy_Probe_State result = SYZYGY_PROBE_OK;
+    *dtz = probe_dtz(syzygy_ctx, chess_ctx, &result);
+    return result != SYZYGY_PROBE_FAIL;
+}
+
+// Ranks every root move by its DTZ, taking the fifty-move rule into account, and returns the best one.
+int syzygy_root_probe(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, Chess_Packed_Move* move, Syzygy_WDL* wdl) {
+    Chess_Move_List move_list;
+    Chess_Context child_ctx;
+    Syzygy_Probe_State result = SYZYGY_PROBE_OK;
+    int cnt50 = chess_ctx->halfmove_clock;
+    int best_rank = -0x7FFFFFFF;
+    int best_dtz = 0;
+
+    chess_generate_moves(chess_ctx, &move_list);
+    if (move_list.count == 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < move_list.count; ++i) {
+        int dtz;
+        chess_make_move(chess_ctx, &child_ctx, move_list.moves[i]);
+
+        if (child_ctx.halfmove_clock == 0) {
+            // Zeroing move: dtz is one of -101, -1, 0, 1, 101.
+            dtz = dtz_before_zeroing(-search(syzygy_ctx, &child_ctx, 0, &result));
+        } else {
+            dtz = -probe_dtz(syzygy_ctx, &child_ctx, &result);
+            dtz = dtz > 0 ? dtz + 1 : dtz < 0 ? dtz - 1 : dtz;
+        }
+
+        if (is_in_check(&child_ctx) && dtz == 2 && !has_legal_moves(&child_ctx)) {
+            dtz = 1;
+        }
+
+        if (result == SYZYGY_PROBE_FAIL) {
+            return 0;
+        }
+
+        // Wins within the fifty-move rule first (fastest to zero), then wins spoiled by the rule, draws,
+        // losses saved by the rule and finally real losses (slowest to zero).
+        int rank;
+        if (dtz > 0) {
+            rank = dtz + cnt50 <= 99 ? 40000 - dtz : 20000 - dtz;
+        } else if (dtz < 0) {
+            rank = -dtz * 2 + cnt50 < 100 ? -40000 - dtz : -20000 - dtz;
+        } else {
+            rank = 0;
+        }
+
+        if (rank > best_rank) {
+            best_rank = rank;
+            best_dtz = dtz;
+            *move = move_list.moves[i];
+        }
+    }
+
+    if (best_dtz > 0) {
+        *wdl = best_dtz + cnt50 <= 99 ? SYZYGY_WDL_WIN : SYZYGY_WDL_CURSED_WIN;
+    } else if (best_dtz < 0) {
+        *wdl = -best_dtz * 2 + cnt50 < 100 ? SYZYGY_WDL_LOSS : SYZYGY_WDL_BLESSED_LOSS;
+    } else {
+        *wdl = SYZYGY_WDL_DRAW;
+    }
+
+    return 1;
+}
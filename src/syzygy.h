@@ -0,0 +1,38 @@
+#ifndef GOLDENPAWN_SYZYGY_H
+#define GOLDENPAWN_SYZYGY_H
+#include "chess.h"
+#include <pthread.h>
+
+#define SYZYGY_MAX_PIECES 7
+#define SYZYGY_PATH_SIZE 1024
+#define SYZYGY_TABLE_SLOTS 4096
+
+typedef enum {
+    SYZYGY_WDL_LOSS = -2,
+    SYZYGY_WDL_BLESSED_LOSS = -1,
+    SYZYGY_WDL_DRAW = 0,
+    SYZYGY_WDL_CURSED_WIN = 1,
+    SYZYGY_WDL_WIN = 2
+} Syzygy_WDL;
+
+struct Syzygy_Entry;
+
+typedef struct {
+    char path[SYZYGY_PATH_SIZE];
+    int probe_depth;
+    int probe_limit;
+    int max_pieces;
+    int tables_found;
+    pthread_mutex_t mutex;
+    struct Syzygy_Entry* entries[SYZYGY_TABLE_SLOTS];
+} Syzygy_Context;
+
+void syzygy_init(Syzygy_Context* syzygy_ctx);
+void syzygy_path_set(Syzygy_Context* syzygy_ctx, const char* path);
+void syzygy_release(Syzygy_Context* syzygy_ctx);
+int syzygy_can_probe(const Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx);
+int syzygy_probe_wdl(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, Syzygy_WDL* wdl);
+int syzygy_probe_dtz(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, int* dtz);
+int syzygy_root_probe(Syzygy_Context* syzygy_ctx, const Chess_Context* chess_ctx, Chess_Packed_Move* move, Syzygy_WDL* wdl);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef GOLDENPAWN_TABLES_H
+#define GOLDENPAWN_TABLES_H
+#include "chess.h"
+#include <stdint.h>
+
+// Lookup tables generated at build time by tools/tables_gen.c into tables.c, so they cost nothing at startup and
+// sit in read-only pages shared by every engine process. Squares are indexed as in chess.h.
+
+// Ray directions, in the order of the king steps: up, up-right, right, down-right, down, down-left, left, up-left.
+// Even directions are straight and odd ones diagonal.
+#define TABLES_DIRECTIONS 8
+// Directions whose squares grow away from the start, so the nearest square of a ray is its lowest.
+#define TABLES_DIRECTION_ASCENDING(direction) ((direction) <= 2 || (direction) == 7)
+
+extern const Chess_Bitboard tables_knight_attacks[64];
+extern const Chess_Bitboard tables_king_attacks[64];
+// Indexed by color index: the squares a pawn of that color on the square attacks.
+extern const Chess_Bitboard tables_pawn_attacks[2][64];
+// Squares from the square to the edge of the board, the square itself excluded.
+extern const Chess_Bitboard tables_rays[TABLES_DIRECTIONS][64];
+// Squares strictly between two squares on a common line, and the whole line through both; 0 when not aligned.
+extern const Chess_Bitboard tables_between[64][64];
+extern const Chess_Bitboard tables_line[64][64];
+// King moves from one square to the other.
+extern const uint8_t tables_distance[64][64];
+
+// The square of the bits nearest to the start of a ray in the direction.
+#define TABLES_RAY_NEAREST(bits, direction) \
+    (TABLES_DIRECTION_ASCENDING(direction) ? __builtin_ctzll(bits) : 63 - __builtin_clzll(bits))
+
+#endif
@@ -0,0 +1,349 @@
+#include "tt.h"
+#include "logger.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TT_SHARE_ATTEMPTS 3
+
+_Static_assert(sizeof(TT_Entry) == 16, "TT_Entry must stay 16 bytes");
+_Static_assert(offsetof(TT_Entry, score) == sizeof(uint64_t), "the data of an entry must be its second word");
+_Static_assert(sizeof(TT_Slot) == sizeof(TT_Entry), "slots hold whole entries");
+_Static_assert(sizeof(TT_File_Header) % sizeof(TT_Slot) == 0, "the file header must keep the slots aligned");
+
+void tt_budget_init(TT_Budget* budget, size_t limit_mb) {
+    pthread_mutex_init(&budget->mutex, NULL);
+    budget->limit_mb = limit_mb;
+    budget->used_mb = 0;
+}
+
+void tt_budget_release(TT_Budget* budget) {
+    pthread_mutex_destroy(&budget->mutex);
+}
+
+size_t tt_budget_reserve(TT_Budget* budget, size_t size_mb) {
+    pthread_mutex_lock(&budget->mutex);
+    size_t available_mb = budget->limit_mb - budget->used_mb;
+    size_t granted_mb = size_mb < available_mb ? size_mb : available_mb;
+    budget->used_mb += granted_mb;
+    pthread_mutex_unlock(&budget->mutex);
+    return granted_mb;
+}
+
+void tt_budget_return(TT_Budget* budget, size_t size_mb) {
+    pthread_mutex_lock(&budget->mutex);
+    budget->used_mb -= size_mb;
+    pthread_mutex_unlock(&budget->mutex);
+}
+
+// Swaps the reservation of a table for that of its replacement, failing without a change when the rest of the
+// budget can't cover the difference.
+static int budget_exchange(TT_Budget* budget, size_t old_size_mb, size_t new_size_mb) {
+    pthread_mutex_lock(&budget->mutex);
+    int fits = budget->used_mb - old_size_mb + new_size_mb <= budget->limit_mb;
+    if (fits) {
+        budget->used_mb = budget->used_mb - old_size_mb + new_size_mb;
+    }
+    pthread_mutex_unlock(&budget->mutex);
+    return fits ? 0 : -1;
+}
+
+// The table size is rounded down to a power of two so the index is a mask of the key. Tables under a budget belong
+// to server sessions, which are searched from whichever worker picks them up, so their pages are interleaved over
+// the NUMA nodes; other tables are first touched by the thread searching them.
+int tt_init(TT_Context* tt_ctx, size_t size_mb, TT_Budget* budget) {
+    if (budget) {
+        size_t granted_mb = tt_budget_reserve(budget, size_mb);
+        if (!granted_mb) {
+            log_debug("Error: the hash budget of %zu MB is exhausted", budget->limit_mb);
+            return -1;
+        }
+        if (granted_mb < size_mb) {
+            log_debug("only %zu of the %zu MB requested for the transposition table are left in the budget", granted_mb, size_mb);
+        }
+        size_mb = granted_mb;
+    }
+
+    size_t entries_num = 1;
+    while (entries_num * 2 * sizeof(TT_Slot) <= size_mb * 1024 * 1024) {
+        entries_num *= 2;
+    }
+
+    if (memory_block_alloc(&tt_ctx->memory, entries_num * sizeof(TT_Slot), budget ? MEMORY_INTERLEAVE : 0)) {
+        log_debug("Error: could not allocate %zu MB for the transposition table", size_mb);
+        if (budget) {
+            tt_budget_return(budget, size_mb);
+        }
+        return -1;
+    }
+
+    tt_ctx->slots = tt_ctx->memory.data;
+    tt_ctx->mask = entries_num - 1;
+    tt_ctx->generation = 0;
+    tt_ctx->size_mb = size_mb;
+    tt_ctx->budget = budget;
+    tt_ctx->shared = NULL;
+    tt_ctx->shared_fd = -1;
+    return 0;
+}
+
+// The lock on the descriptor orders attaching and detaching between processes, so that the last one to leave
+// removes the segment before anyone can attach to it again.
+static void table_unmap(TT_Context* tt_ctx) {
+    if (tt_ctx->shared) {
+        flock(tt_ctx->shared_fd, LOCK_EX);
+        if (!__atomic_sub_fetch(&tt_ctx->shared->attached, 1, __ATOMIC_ACQ_REL)) {
+            shm_unlink(tt_ctx->shared_name);
+        }
+        memory_block_free(&tt_ctx->memory);
+        close(tt_ctx->shared_fd);
+    } else {
+        memory_block_free(&tt_ctx->memory);
+    }
+    tt_ctx->shared = NULL;
+    tt_ctx->shared_fd = -1;
+}
+
+void tt_release(TT_Context* tt_ctx) {
+    table_unmap(tt_ctx);
+    if (tt_ctx->budget) {
+        tt_budget_return(tt_ctx->budget, tt_ctx->size_mb);
+    }
+    tt_ctx->slots = NULL;
+    tt_ctx->mask = 0;
+    tt_ctx->size_mb = 0;
+    tt_ctx->budget = NULL;
+}
+
+void tt_clear(TT_Context* tt_ctx) {
+    if (tt_ctx->shared) {
+        return;
+    }
+    memset(tt_ctx->slots, 0, (tt_ctx->mask + 1) * sizeof(TT_Slot));
+    tt_ctx->generation = 0;
+}
+
+// Entries written by earlier searches are kept, but become the first ones to be replaced.
+void tt_new_search(TT_Context* tt_ctx) {
+    if (tt_ctx->shared) {
+        tt_ctx->generation = __atomic_add_fetch(&tt_ctx->shared->generation, 1, __ATOMIC_RELAXED) & 0x3F;
+        return;
+    }
+    tt_ctx->generation = (tt_ctx->generation + 1) & 0x3F;
+}
+
+static void header_fill(const TT_Context* tt_ctx, uint64_t entries_num, size_t size_mb, TT_File_Header* header) {
+    memset(header, 0, sizeof(TT_File_Header));
+    memcpy(header->magic, TT_FILE_MAGIC, sizeof(header->magic));
+    header->version = TT_FILE_VERSION;
+    header->entry_size = sizeof(TT_Slot);
+    header->key_size = sizeof(((TT_Entry*)NULL)->key);
+    header->generation = tt_ctx->generation;
+    header->entries_num = entries_num;
+    header->size_mb = size_mb;
+}
+
+// The slots must fill the mapping exactly and be a power of two, so that the index stays a mask of the key.
+static int header_check(const TT_File_Header* header, uint64_t size) {
+    uint64_t entries_num = header->entries_num;
+    return memcmp(header->magic, TT_FILE_MAGIC, sizeof(header->magic)) || header->version != TT_FILE_VERSION ||
+        header->entry_size != sizeof(TT_Slot) || header->key_size != sizeof(((TT_Entry*)NULL)->key) ||
+        !entries_num || (entries_num & (entries_num - 1)) || size != sizeof(TT_File_Header) + entries_num * sizeof(TT_Slot) ||
+        !header->size_mb || header->size_mb > TT_MAX_SIZE_MB ? -1 : 0;
+}
+
+// Takes over a mapping holding a header and its slots.
+static void table_replace(TT_Context* tt_ctx, Memory_Block* memory, int shared_fd, const char* shared_name) {
+    TT_File_Header* header = memory->data;
+
+    table_unmap(tt_ctx);
+    tt_ctx->memory = *memory;
+    tt_ctx->slots = (TT_Slot*)(header + 1);
+    tt_ctx->mask = header->entries_num - 1;
+    tt_ctx->generation = header->generation & 0x3F;
+    tt_ctx->size_mb = header->size_mb;
+    if (shared_name) {
+        tt_ctx->shared = header;
+        tt_ctx->shared_fd = shared_fd;
+        snprintf(tt_ctx->shared_name, sizeof(tt_ctx->shared_name), "%s", shared_name);
+    }
+}
+
+static int write_all(int fd, const void* data, size_t size) {
+    const char* bytes = data;
+    while (size) {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int tt_save(const TT_Context* tt_ctx, const char* path) {
+    TT_File_Header header;
+
+    header_fill(tt_ctx, tt_ctx->mask + 1, tt_ctx->size_mb, &header);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        log_debug("Error: could not create the hash file %s", path);
+        return -1;
+    }
+    int failed = write_all(fd, &header, sizeof(TT_File_Header)) ||
+        write_all(fd, tt_ctx->slots, header.entries_num * sizeof(TT_Slot));
+    if (close(fd) || failed) {
+        log_debug("Error: could not write the hash file %s", path);
+        return -1;
+    }
+    return 0;
+}
+
+int tt_load(TT_Context* tt_ctx, const char* path) {
+    struct stat file_stat;
+    Memory_Block memory;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        log_debug("Error: could not open the hash file %s", path);
+        return -1;
+    }
+    if (fstat(fd, &file_stat) || file_stat.st_size < (off_t)sizeof(TT_File_Header) ||
+        memory_block_map(&memory, fd, file_stat.st_size, 0)) {
+        log_debug("Error: could not map the hash file %s", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    const TT_File_Header* header = memory.data;
+    if (header_check(header, file_stat.st_size)) {
+        log_debug("Error: %s is not a hash file of this version", path);
+        memory_block_free(&memory);
+        return -1;
+    }
+    if (tt_ctx->budget && budget_exchange(tt_ctx->budget, tt_ctx->size_mb, header->size_mb)) {
+        log_debug("Error: the hash budget can't hold the %llu MB of %s", (unsigned long long)header->size_mb, path);
+        memory_block_free(&memory);
+        return -1;
+    }
+    table_replace(tt_ctx, &memory, -1, NULL);
+    return 0;
+}
+
+// A segment found with nobody attached was removed by its last process after we opened it, so it is opened again.
+int tt_share(TT_Context* tt_ctx, const char* name, size_t size_mb) {
+    char shared_name[TT_SHARED_NAME_SIZE];
+    struct stat file_stat;
+
+    if (snprintf(shared_name, sizeof(shared_name), "%s%s", name[0] == '/' ? "" : "/", name) >= (int)sizeof(shared_name) ||
+        strchr(shared_name + 1, '/')) {
+        log_debug("Error: invalid shared hash name %s", name);
+        return -1;
+    }
+
+    for (int attempt = 0; attempt < TT_SHARE_ATTEMPTS; ++attempt) {
+        Memory_Block memory = { 0 };
+        int fd = shm_open(shared_name, O_RDWR | O_CREAT, 0600);
+        if (fd == -1 || flock(fd, LOCK_EX) || fstat(fd, &file_stat)) {
+            log_debug("Error: could not open the shared hash %s", shared_name);
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+
+        int created = !file_stat.st_size;
+        if (created) {
+            uint64_t entries_num = 1;
+            while (entries_num * 2 * sizeof(TT_Slot) <= size_mb * 1024 * 1024) {
+                entries_num *= 2;
+            }
+            file_stat.st_size = sizeof(TT_File_Header) + entries_num * sizeof(TT_Slot);
+            if (ftruncate(fd, file_stat.st_size) || memory_block_map(&memory, fd, file_stat.st_size, MEMORY_SHARED)) {
+                log_debug("Error: could not allocate %zu MB for the shared hash %s", size_mb, shared_name);
+                shm_unlink(shared_name);
+                close(fd);
+                return -1;
+            }
+            header_fill(tt_ctx, entries_num, size_mb, memory.data);
+        } else if (file_stat.st_size < (off_t)sizeof(TT_File_Header) ||
+            memory_block_map(&memory, fd, file_stat.st_size, MEMORY_SHARED) ||
+            header_check(memory.data, file_stat.st_size)) {
+            log_debug("Error: %s is not a shared hash of this version", shared_name);
+            memory_block_free(&memory);
+            close(fd);
+            return -1;
+        }
+
+        TT_File_Header* header = memory.data;
+        if (!created && !__atomic_load_n(&header->attached, __ATOMIC_ACQUIRE)) {
+            memory_block_free(&memory);
+            close(fd);
+            continue;
+        }
+        if (tt_ctx->budget && budget_exchange(tt_ctx->budget, tt_ctx->size_mb, header->size_mb)) {
+            log_debug("Error: the hash budget can't hold the %llu MB of %s", (unsigned long long)header->size_mb, shared_name);
+            memory_block_free(&memory);
+            if (created) {
+                shm_unlink(shared_name);
+            }
+            close(fd);
+            return -1;
+        }
+
+        __atomic_add_fetch(&header->attached, 1, __ATOMIC_ACQ_REL);
+        flock(fd, LOCK_UN);
+        table_replace(tt_ctx, &memory, fd, shared_name);
+        return 0;
+    }
+    log_debug("Error: the shared hash %s keeps being removed", shared_name);
+    return -1;
+}
+
+static void slot_read(const TT_Slot* slot, TT_Entry* entry) {
+    uint64_t check = __atomic_load_n(&slot->check, __ATOMIC_RELAXED);
+    uint64_t data = __atomic_load_n(&slot->data, __ATOMIC_RELAXED);
+    entry->key = check ^ data;
+    memcpy((char*)entry + offsetof(TT_Entry, score), &data, sizeof(data));
+}
+
+int tt_probe(const TT_Context* tt_ctx, uint64_t key, TT_Entry* entry) {
+    slot_read(&tt_ctx->slots[key & tt_ctx->mask], entry);
+    return entry->key == key && entry->bound != TT_BOUND_NONE;
+}
+
+void tt_store(TT_Context* tt_ctx, uint64_t key, int depth, float score, TT_Bound bound, Chess_Packed_Move move) {
+    TT_Slot* slot = &tt_ctx->slots[key & tt_ctx->mask];
+    TT_Entry entry;
+    uint64_t data;
+
+    slot_read(slot, &entry);
+    // Deeper results of the current search are not overwritten by shallower ones of other positions.
+    if (entry.key != key && entry.generation == tt_ctx->generation && entry.depth > depth) {
+        return;
+    }
+    if (entry.key == key && move == CHESS_MOVE_NONE) {
+        move = entry.move;
+    }
+
+    entry.key = key;
+    entry.score = score;
+    entry.move = move;
+    entry.depth = (int8_t)depth;
+    entry.bound = bound;
+    entry.generation = tt_ctx->generation;
+    memcpy(&data, (char*)&entry + offsetof(TT_Entry, score), sizeof(data));
+    __atomic_store_n(&slot->data, data, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->check, key ^ data, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,96 @@
+#ifndef GOLDENPAWN_TT_H
+#define GOLDENPAWN_TT_H
+#include "chess.h"
+#include "memory.h"
+#include <stddef.h>
+#include <pthread.h>
+
+#define TT_DEFAULT_SIZE_MB 16
+#define TT_MAX_SIZE_MB 4096
+#define TT_SHARED_NAME_SIZE 64
+
+typedef enum {
+    TT_BOUND_NONE = 0,
+    TT_BOUND_LOWER = 1,
+    TT_BOUND_UPPER = 2,
+    TT_BOUND_EXACT = 3
+} TT_Bound;
+
+// Scores are stored from the point of view of the side to move.
+typedef struct {
+    uint64_t key;
+    float score;
+    Chess_Packed_Move move;
+    int8_t depth;
+    uint8_t bound : 2;
+    uint8_t generation : 6;
+} TT_Entry;
+
+// How entries sit in the table: the last 8 bytes of the entry as one word, and the key XORed with that word. Words
+// are read and written whole but without locks, so a reader racing a writer, possibly in another process, can get
+// the halves of two different entries; the key then fails to match and the probe is a miss.
+typedef struct {
+    uint64_t check;
+    uint64_t data;
+} TT_Slot;
+
+// Memory shared by several tables, e.g. the transposition tables and eval caches of all the sessions of a server. A
+// table gets what is left when the budget cannot cover its full size.
+typedef struct {
+    pthread_mutex_t mutex;
+    size_t limit_mb;
+    size_t used_mb;
+} TT_Budget;
+
+#define TT_FILE_MAGIC "GPHASHTT"
+#define TT_FILE_VERSION 2
+
+// Saved and shared tables are this header followed by the slots, in host byte order. The header is a multiple of
+// the slot size, so the slots of a mapping stay aligned. attached counts the processes using a shared table.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t key_size;
+    uint32_t generation;
+    uint64_t entries_num;
+    uint64_t size_mb;
+    uint32_t attached;
+    uint8_t reserved[20];
+} TT_File_Header;
+
+// shared points at the header of a shared table, whose generation then replaces the local one so that all the
+// processes age entries alike.
+typedef struct {
+    TT_Slot* slots;
+    Memory_Block memory;
+    uint64_t mask;
+    uint8_t generation;
+    size_t size_mb;
+    TT_Budget* budget;
+    TT_File_Header* shared;
+    int shared_fd;
+    char shared_name[TT_SHARED_NAME_SIZE];
+} TT_Context;
+
+void tt_budget_init(TT_Budget* budget, size_t limit_mb);
+void tt_budget_release(TT_Budget* budget);
+// Grants as much of size_mb as is left, possibly nothing.
+size_t tt_budget_reserve(TT_Budget* budget, size_t size_mb);
+void tt_budget_return(TT_Budget* budget, size_t size_mb);
+int tt_init(TT_Context* tt_ctx, size_t size_mb, TT_Budget* budget);
+void tt_release(TT_Context* tt_ctx);
+// Shared tables are left as they are, since other processes are using them.
+void tt_clear(TT_Context* tt_ctx);
+void tt_new_search(TT_Context* tt_ctx);
+int tt_save(const TT_Context* tt_ctx, const char* path);
+// Replaces the table with a mapping of a saved one, which costs next to nothing up front. On failure the current
+// table is kept.
+int tt_load(TT_Context* tt_ctx, const char* path);
+// Attaches to the POSIX shared memory table of that name, or creates it with size_mb when no process has it yet.
+// The table is removed when the last process detaches from it. On failure the current table is kept.
+int tt_share(TT_Context* tt_ctx, const char* name, size_t size_mb);
+int tt_probe(const TT_Context* tt_ctx, uint64_t key, TT_Entry* entry);
+void tt_store(TT_Context* tt_ctx, uint64_t key, int depth, float score, TT_Bound bound, Chess_Packed_Move move);
+
+#endif
@@ -0,0 +1,288 @@
+#include "tune.h"
+#include "ai.h"
+#include "packed.h"
+#include "params.h"
+#include "bitbase.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define TUNE_DEFAULT_EPOCHS 300
+#define TUNE_DEFAULT_RATE 0.01
+#define TUNE_K_ITERATIONS 40
+#define TUNE_ADAM_BETA1 0.9
+#define TUNE_ADAM_BETA2 0.999
+#define TUNE_ADAM_EPSILON 1e-8
+
+// Every position is reduced to its row of evaluation coefficients, so an epoch only needs dot products: the
+// white score is the row times the weights and the predicted result is sigmoid(k * score).
+typedef struct {
+    float* rows;
+    float* results;
+    size_t positions_num;
+} Tune_Data;
+
+typedef struct {
+    const Packed_Position* positions;
+    size_t count;
+    float* rows;
+    float* results;
+    size_t kept;
+} Load_Slice;
+
+typedef struct {
+    const float* rows;
+    const float* results;
+    size_t count;
+    const float* weights;
+    double k;
+    int gradient_wanted;
+    double loss;
+    double gradient[AI_PARAMS_NUM];
+} Pass_Slice;
+
+static void usage_print() {
+    fprintf(stderr, "usage: goldenpawn tune --input <packed file> [--output <params file>] [--epochs N] [--rate R] [--jobs J]\n");
+}
+
+// Runs the routine over slices on up to jobs threads; the calling thread takes the first slice.
+static void slices_run(void* (*routine)(void*), void* slices, size_t slice_size, int jobs) {
+    pthread_t threads[jobs];
+    int started = 1;
+    for (; started < jobs; ++started) {
+        if (pthread_create(&threads[started], NULL, routine, (char*)slices + started * slice_size)) {
+            break;
+        }
+    }
+    routine(slices);
+    for (int i = started; i < jobs; ++i) {
+        routine((char*)slices + i * slice_size);
+    }
+    for (int i = 1; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// Positions in check are left out since their static evaluation says little about them, and so are positions
+// without a result or where the bitbase overrides the evaluation.
+static void* load_slice_run(void* arg) {
+    static const float results[] = { 0.0f, 1.0f, 0.5f, 0.0f };
+    Load_Slice* slice = arg;
+    Chess_Context chess_ctx;
+
+    slice->kept = 0;
+    for (size_t i = 0; i < slice->count; ++i) {
+        const Packed_Position* position = &slice->positions[i];
+        if (position->result == PACKED_RESULT_UNKNOWN || position->result > PACKED_RESULT_BLACK_WIN ||
+            packed_position_unpack(position, &chess_ctx) ||
+            chess_is_king_under_attack(&chess_ctx, chess_ctx.current_turn) ||
+            ai_eval_features(&chess_ctx, slice->rows + slice->kept * AI_PARAMS_NUM)) {
+            continue;
+        }
+        slice->results[slice->kept++] = results[position->result];
+    }
+    return NULL;
+}
+
+static int data_load(Tune_Data* data, const char* path, int jobs) {
+    Packed_Reader reader;
+    Load_Slice slices[jobs];
+
+    if (packed_reader_open(&reader, path)) {
+        return -1;
+    }
+    data->rows = malloc((reader.count ? reader.count : 1) * AI_PARAMS_NUM * sizeof(float));
+    data->results = malloc((reader.count ? reader.count : 1) * sizeof(float));
+    if (!data->rows || !data->results) {
+        packed_reader_close(&reader);
+        return -1;
+    }
+
+    size_t start = 0;
+    for (int i = 0; i < jobs; ++i) {
+        size_t count = reader.count / jobs + ((size_t)i < reader.count % jobs);
+        slices[i] = (Load_Slice){ reader.positions + start, count, data->rows + start * AI_PARAMS_NUM, data->results + start, 0 };
+        start += count;
+    }
+    slices_run(load_slice_run, slices, sizeof(Load_Slice), jobs);
+    packed_reader_close(&reader);
+
+    // Each slice kept a prefix of its own range; close the gaps between them.
+    data->positions_num = 0;
+    for (int i = 0; i < jobs; ++i) {
+        memmove(data->rows + data->positions_num * AI_PARAMS_NUM, slices[i].rows, slices[i].kept * AI_PARAMS_NUM * sizeof(float));
+        memmove(data->results + data->positions_num, slices[i].results, slices[i].kept * sizeof(float));
+        data->positions_num += slices[i].kept;
+    }
+    return 0;
+}
+
+// Log loss of the predictions and its gradient over the weights.
+static void* pass_slice_run(void* arg) {
+    Pass_Slice* slice = arg;
+    double loss = 0.0;
+    double gradient[AI_PARAMS_NUM] = { 0 };
+
+    for (size_t i = 0; i < slice->count; ++i) {
+        const float* row = slice->rows + i * AI_PARAMS_NUM;
+        float score = 0.0f;
+        for (int param = 0; param < AI_PARAMS_NUM; ++param) {
+            score += row[param] * slice->weights[param];
+        }
+        double prediction = 1.0 / (1.0 + exp(-slice->k * score));
+        double result = slice->results[i];
+        prediction = prediction < 1e-9 ? 1e-9 : prediction > 1.0 - 1e-9 ? 1.0 - 1e-9 : prediction;
+        loss -= result * log(prediction) + (1.0 - result) * log(1.0 - prediction);
+        if (slice->gradient_wanted) {
+            double error = (prediction - result) * slice->k;
+            for (int param = 0; param < AI_PARAMS_NUM; ++param) {
+                gradient[param] += error * row[param];
+            }
+        }
+    }
+
+    slice->loss = loss;
+    memcpy(slice->gradient, gradient, sizeof(gradient));
+    return NULL;
+}
+
+static double data_pass(const Tune_Data* data, const float* weights, double k, int jobs, double* gradient) {
+    Pass_Slice slices[jobs];
+    size_t start = 0;
+
+    for (int i = 0; i < jobs; ++i) {
+        size_t count = data->positions_num / jobs + ((size_t)i < data->positions_num % jobs);
+        slices[i] = (Pass_Slice){ data->rows + start * AI_PARAMS_NUM, data->results + start, count, weights, k, gradient != NULL };
+        start += count;
+    }
+    slices_run(pass_slice_run, slices, sizeof(Pass_Slice), jobs);
+
+    double loss = 0.0;
+    if (gradient) {
+        memset(gradient, 0, AI_PARAMS_NUM * sizeof(double));
+    }
+    for (int i = 0; i < jobs; ++i) {
+        loss += slices[i].loss;
+        for (int param = 0; gradient && param < AI_PARAMS_NUM; ++param) {
+            gradient[param] += slices[i].gradient[param] / data->positions_num;
+        }
+    }
+    return loss / data->positions_num;
+}
+
+// Scales scores to probabilities: a golden section search for the k that fits the starting weights best.
+static double k_fit(const Tune_Data* data, const float* weights, int jobs) {
+    const double ratio = 0.6180339887498949;
+    double low = 0.01, high = 10.0;
+    double a = high - ratio * (high - low), b = low + ratio * (high - low);
+    double loss_a = data_pass(data, weights, a, jobs, NULL), loss_b = data_pass(data, weights, b, jobs, NULL);
+
+    for (int i = 0; i < TUNE_K_ITERATIONS; ++i) {
+        if (loss_a < loss_b) {
+            high = b;
+            b = a;
+            loss_b = loss_a;
+            a = high - ratio * (high - low);
+            loss_a = data_pass(data, weights, a, jobs, NULL);
+        } else {
+            low = a;
+            a = b;
+            loss_a = loss_b;
+            b = low + ratio * (high - low);
+            loss_b = data_pass(data, weights, b, jobs, NULL);
+        }
+    }
+    return (low + high) / 2;
+}
+
+static int arguments_parse(int argc, char** argv, const char** input_path, const char** output_path, int* epochs,
+    double* rate, int* jobs) {
+    for (int i = 0; i < argc; ++i) {
+        if (i + 1 >= argc) {
+            return -1;
+        }
+        if (!strcmp(argv[i], "--input")) {
+            *input_path = argv[++i];
+        } else if (!strcmp(argv[i], "--output")) {
+            *output_path = argv[++i];
+        } else if (!strcmp(argv[i], "--epochs")) {
+            *epochs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--rate")) {
+            *rate = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--jobs")) {
+            *jobs = atoi(argv[++i]);
+        } else {
+            return -1;
+        }
+    }
+    return !*input_path || *epochs < 0 || *rate <= 0.0 || *jobs < 1 ? -1 : 0;
+}
+
+// Starts from the parameters the engine runs with (see --params), fits k once and then runs full batch Adam.
+int tune_main(int argc, char** argv) {
+    const char* input_path = NULL;
+    const char* output_path = "goldenpawn.params";
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int jobs = cpus > 0 ? (int)cpus : 1;
+    int epochs = TUNE_DEFAULT_EPOCHS;
+    double rate = TUNE_DEFAULT_RATE;
+    Tune_Data data = { 0 };
+    AI_Eval_Params params;
+
+    if (arguments_parse(argc, argv, &input_path, &output_path, &epochs, &rate, &jobs)) {
+        usage_print();
+        return 1;
+    }
+
+    struct timespec started, loaded, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    bitbase_init();
+    if (data_load(&data, input_path, jobs) || !data.positions_num) {
+        fprintf(stderr, "tune: no labeled positions could be read from %s\n", input_path);
+        free(data.rows);
+        free(data.results);
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &loaded);
+    fprintf(stderr, "tune: %zu positions loaded in %.3f s\n", data.positions_num,
+        (loaded.tv_sec - started.tv_sec) + (loaded.tv_nsec - started.tv_nsec) / 1e9);
+
+    ai_eval_params_get(&params);
+    double k = k_fit(&data, params.values, jobs);
+    double loss = data_pass(&data, params.values, k, jobs, NULL);
+    fprintf(stderr, "tune: k %.4f, starting loss %.6f\n", k, loss);
+
+    double gradient[AI_PARAMS_NUM];
+    double moment[AI_PARAMS_NUM] = { 0 }, velocity[AI_PARAMS_NUM] = { 0 };
+    for (int epoch = 1; epoch <= epochs; ++epoch) {
+        loss = data_pass(&data, params.values, k, jobs, gradient);
+        for (int param = 0; param < AI_PARAMS_NUM; ++param) {
+            moment[param] = TUNE_ADAM_BETA1 * moment[param] + (1 - TUNE_ADAM_BETA1) * gradient[param];
+            velocity[param] = TUNE_ADAM_BETA2 * velocity[param] + (1 - TUNE_ADAM_BETA2) * gradient[param] * gradient[param];
+            double moment_hat = moment[param] / (1 - pow(TUNE_ADAM_BETA1, epoch));
+            double velocity_hat = velocity[param] / (1 - pow(TUNE_ADAM_BETA2, epoch));
+            params.values[param] -= rate * moment_hat / (sqrt(velocity_hat) + TUNE_ADAM_EPSILON);
+        }
+        if (epoch % 50 == 0 || epoch == epochs) {
+            fprintf(stderr, "tune: epoch %d loss %.6f\n", epoch, loss);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    fprintf(stderr, "tune: %d epochs in %.3f s\n", epochs,
+        (finished.tv_sec - loaded.tv_sec) + (finished.tv_nsec - loaded.tv_nsec) / 1e9);
+
+    free(data.rows);
+    free(data.results);
+    if (params_save(output_path, &params)) {
+        fprintf(stderr, "tune: could not write %s\n", output_path);
+        return 1;
+    }
+    for (int param = 0; param < AI_PARAMS_NUM; ++param) {
+        fprintf(stderr, "%s %.6f\n", ai_param_names[param], params.values[param]);
+    }
+    return 0;
+}
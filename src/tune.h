@@ -0,0 +1,7 @@
+#ifndef GOLDENPAWN_TUNE_H
+#define GOLDENPAWN_TUNE_H
+
+// goldenpawn tune --input <packed file> [--output <params file>] [--epochs N] [--rate R] [--jobs J]
+int tune_main(int argc, char** argv);
+
+#endif
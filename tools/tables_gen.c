@@ -0,0 +1,122 @@
+// Writes the lookup tables declared in src/tables.h as C source. Run by the Makefile: tables_gen <output file>.
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+static const int knight_steps[8][2] = { {1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2} };
+// The ray directions of tables.h.
+static const int king_steps[8][2] = { {1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1} };
+
+static uint64_t knight_attacks[64];
+static uint64_t king_attacks[64];
+static uint64_t pawn_attacks[2][64];
+static uint64_t rays[8][64];
+static uint64_t between[64][64];
+static uint64_t line[64][64];
+static uint8_t distance[64][64];
+
+static int on_board(int y, int x) {
+    return y >= 0 && y < 8 && x >= 0 && x < 8;
+}
+
+static uint64_t steps_attacks(int square, const int steps[8][2]) {
+    uint64_t attacks = 0;
+    for (int i = 0; i < 8; ++i) {
+        int y = square / 8 + steps[i][0], x = square % 8 + steps[i][1];
+        if (on_board(y, x)) {
+            attacks |= 1ULL << (y * 8 + x);
+        }
+    }
+    return attacks;
+}
+
+static void tables_compute() {
+    for (int square = 0; square < 64; ++square) {
+        int y = square / 8, x = square % 8;
+        knight_attacks[square] = steps_attacks(square, knight_steps);
+        king_attacks[square] = steps_attacks(square, king_steps);
+        for (int c = 0; c < 2; ++c) {
+            int pawn_y = y + (c ? -1 : 1);
+            for (int dx = -1; dx <= 1; dx += 2) {
+                if (on_board(pawn_y, x + dx)) {
+                    pawn_attacks[c][square] |= 1ULL << (pawn_y * 8 + x + dx);
+                }
+            }
+        }
+        for (int direction = 0; direction < 8; ++direction) {
+            int dy = king_steps[direction][0], dx = king_steps[direction][1];
+            for (int ray_y = y + dy, ray_x = x + dx; on_board(ray_y, ray_x); ray_y += dy, ray_x += dx) {
+                rays[direction][square] |= 1ULL << (ray_y * 8 + ray_x);
+            }
+        }
+        for (int target = 0; target < 64; ++target) {
+            int dy = abs(target / 8 - y), dx = abs(target % 8 - x);
+            distance[square][target] = dy > dx ? dy : dx;
+        }
+    }
+
+    // A target on a ray of the square: the line is both rays through the square plus the square, and the squares
+    // between are the ray minus what lies beyond the target on it.
+    for (int square = 0; square < 64; ++square) {
+        for (int direction = 0; direction < 8; ++direction) {
+            uint64_t ray = rays[direction][square];
+            for (int target = 0; target < 64; ++target) {
+                if (!(ray >> target & 1)) {
+                    continue;
+                }
+                between[square][target] = ray & ~rays[direction][target] & ~(1ULL << target);
+                line[square][target] = ray | rays[(direction + 4) % 8][square] | 1ULL << square;
+            }
+        }
+    }
+}
+
+// Tables of several rows get a brace pair per row.
+static void bitboards_write(FILE* file, const char* declaration, const uint64_t* values, int rows, int columns) {
+    fprintf(file, "\n%s = {", declaration);
+    for (int row = 0; row < rows; ++row) {
+        fprintf(file, rows > 1 ? "\n    {" : "");
+        for (int i = 0; i < columns; ++i) {
+            fprintf(file, "%s0x%016llxULL,", i % 4 ? " " : rows > 1 ? "\n        " : "\n    ",
+                (unsigned long long)values[row * columns + i]);
+        }
+        fprintf(file, rows > 1 ? "\n    }," : "");
+    }
+    fprintf(file, "\n};\n");
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: tables_gen <output file>\n");
+        return 1;
+    }
+    FILE* file = fopen(argv[1], "w");
+    if (!file) {
+        fprintf(stderr, "tables_gen: could not write %s\n", argv[1]);
+        return 1;
+    }
+
+    tables_compute();
+    fprintf(file, "// Generated by tools/tables_gen.c. Do not edit.\n#include \"tables.h\"\n");
+    bitboards_write(file, "const Chess_Bitboard tables_knight_attacks[64]", knight_attacks, 1, 64);
+    bitboards_write(file, "const Chess_Bitboard tables_king_attacks[64]", king_attacks, 1, 64);
+    bitboards_write(file, "const Chess_Bitboard tables_pawn_attacks[2][64]", &pawn_attacks[0][0], 2, 64);
+    bitboards_write(file, "const Chess_Bitboard tables_rays[TABLES_DIRECTIONS][64]", &rays[0][0], 8, 64);
+    bitboards_write(file, "const Chess_Bitboard tables_between[64][64]", &between[0][0], 64, 64);
+    bitboards_write(file, "const Chess_Bitboard tables_line[64][64]", &line[0][0], 64, 64);
+    fprintf(file, "\nconst uint8_t tables_distance[64][64] = {");
+    for (int square = 0; square < 64; ++square) {
+        fprintf(file, "\n    {");
+        for (int target = 0; target < 64; ++target) {
+            fprintf(file, "%s%d,", target % 16 ? " " : "\n        ", distance[square][target]);
+        }
+        fprintf(file, "\n    },");
+    }
+    fprintf(file, "\n};\n");
+
+    if (fclose(file)) {
+        fprintf(stderr, "tables_gen: could not write %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}